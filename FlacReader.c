@@ -1,30 +1,82 @@
 #if USE_FLAC == 2
 #include "flac.c"
 
+/*
+  The foxen decoder is fed from a window of FAUN_FLAC_READ_SIZE bytes which
+  is refilled when less than a quarter remains.  FAUN_FLAC_DECODE_SIZE
+  samples are output per call; the default holds an entire stereo block at
+  the subset maximum, so each call normally decodes one complete frame.
+  Both may be set when building.
+*/
+#ifndef FAUN_FLAC_READ_SIZE
+#define FAUN_FLAC_READ_SIZE     (64*1024)
+#endif
+#ifndef FAUN_FLAC_DECODE_SIZE
+#define FAUN_FLAC_DECODE_SIZE   (FLAC_SUBSET_MAX_BLOCK_SIZE_48KHZ * 2)
+#endif
+
+// Foxen output samples are left-aligned in 32 bits.
+#define FOXEN_CONV_SHIFT    16
+
+static fx_flac_t* foxen_init()
+{
+    return fx_flac_init(mem_alloc(fx_flac_size(FLAC_SUBSET_MAX_BLOCK_SIZE_48KHZ,
+                                               2)),
+                        FLAC_SUBSET_MAX_BLOCK_SIZE_48KHZ, 2);
+}
+
+/*
+  Allocate the buffer samples once the STREAMINFO has been read.
+  Return error message or NULL if successful.
+*/
+static const char* foxen_allocBuffer(fx_flac_t* flac, FaunBuffer* buf)
+{
+    uint32_t frate     = fx_flac_get_streaminfo(flac, FLAC_KEY_SAMPLE_RATE);
+    uint32_t fchannels = fx_flac_get_streaminfo(flac, FLAC_KEY_N_CHANNELS);
+    uint32_t frames    = fx_flac_get_streaminfo(flac, FLAC_KEY_N_SAMPLES);
+
+    //printf("FLAC rate:%d channels:%d samples:%d\n",
+    //        frate, fchannels, frames);
+
+    if (frate < LOAD_RATE_MIN || frate > LOAD_RATE_MAX)
+        return "FLAC sample rate is unsupported";
+
+    // NOTE: Zero for total samples denotes 'unknown' and is valid.
+    if (! frames)
+        return "FLAC total samples is unknown";
+
+    if (! _allocBufferLoad(buf, fchannels, frate, frames))
+        return "No memory for FLAC samples";
+    return NULL;
+}
+
 static const char* foxenFlacDecode(FILE* fp, uint32_t size, FaunBuffer* buf,
                                    const void* preRead, size_t preReadLen)
 {
     const char* error = NULL;
-    const int bufSize = 256;
-    const int decodeSize = 512;
+    const uint32_t bufSize = FAUN_FLAC_READ_SIZE;
     uint8_t* readBuf;
     int32_t* decodeBuf;
     size_t toRead, n;
     uint32_t inUsed, procLen;
-    uint32_t bufPos = 0;
-    uint32_t frate;
-    uint32_t fchannels;
-    uint32_t frames = 0;
+    uint32_t bufPos = 0;        // Unprocessed bytes are bufPos to bufEnd.
+    uint32_t bufEnd;
+    int refill = 1;
     float* pcmOut = NULL;
-    float ds0, ds1;
     fx_flac_state_t fstate;
-    fx_flac_t* flac = FX_FLAC_ALLOC_SUBSET_FORMAT_DAT();
-
-    decodeBuf = (int32_t*) malloc(decodeSize*sizeof(int32_t) + bufSize);
-    readBuf   = (uint8_t*) (decodeBuf + decodeSize);
+    fx_flac_t* flac;
+
+    flac = foxen_init();
+    decodeBuf = (int32_t*) mem_alloc(FAUN_FLAC_DECODE_SIZE*sizeof(int32_t) +
+                                     bufSize);
+    if (! flac || ! decodeBuf) {
+        error = "FLAC decoder alloc failed";
+        goto cleanup;
+    }
+    readBuf = (uint8_t*) (decodeBuf + FAUN_FLAC_DECODE_SIZE);
 
     memcpy(readBuf, preRead, preReadLen);
-    bufPos = preReadLen;
+    bufEnd = preReadLen;
 
     if (size)
         size -= preReadLen;
@@ -32,106 +84,120 @@ static const char* foxenFlacDecode(FILE* fp, uint32_t size, FaunBuffer* buf,
         size = UINT32_MAX;
 
     while (1) {
-        if (size) {
-            toRead = bufSize - bufPos;
-            if (toRead > 0) {
-                if (toRead > size)
-                    toRead = size;
-                n = fread(readBuf + bufPos, 1, toRead, fp);
-                if (n == 0) {
-                    size = 0;       // Stop reading but continue decoding.
-                } else {
-                    size -= n;
-                    bufPos += n;    // Advance the write cursor
-                }
+        if (refill && size) {
+            // Move unprocessed bytes to the beginning of readBuf & top up.
+            n = bufEnd - bufPos;
+            if (bufPos) {
+                memmove(readBuf, readBuf + bufPos, n);
+                bufPos = 0;
+                bufEnd = n;
+            }
+            toRead = bufSize - bufEnd;
+            if (toRead > size)
+                toRead = size;
+            n = fread(readBuf + bufEnd, 1, toRead, fp);
+            if (n == 0) {
+                size = 0;       // Stop reading but continue decoding.
+            } else {
+                size -= n;
+                bufEnd += n;
             }
         }
 
-        inUsed  = bufPos;
-        procLen = decodeSize;
-        fstate = fx_flac_process(flac, readBuf, &inUsed,
+        inUsed  = bufEnd - bufPos;
+        procLen = FAUN_FLAC_DECODE_SIZE;
+        fstate = fx_flac_process(flac, readBuf + bufPos, &inUsed,
                                        decodeBuf, &procLen);
         if (fstate == FLAC_ERR) {
             error = "FLAC decode failed";
             break;
         }
         if (fstate == FLAC_END_OF_METADATA) {
-            frate     = fx_flac_get_streaminfo(flac, FLAC_KEY_SAMPLE_RATE);
-            fchannels = fx_flac_get_streaminfo(flac, FLAC_KEY_N_CHANNELS);
-            frames    = fx_flac_get_streaminfo(flac, FLAC_KEY_N_SAMPLES);
-
-            //printf("FLAC rate:%d channels:%d samples:%d\n",
-            //        frate, fchannels, frames);
-
-            if (frate != 44100 && frate != 22050) {
-                error = "FLAC sample rate is unsupported";
-                break;
-            }
-
-            // NOTE: Zero for total samples denotes 'unknown' and is valid.
-            if (! frames) {
-                error = "FLAC total samples is unknown";
+            if ((error = foxen_allocBuffer(flac, buf)))
                 break;
-            }
-
-            _allocBufferVoice(buf, frames);
             pcmOut = buf->sample.f32;
         }
 
         // Save decoded samples to PCM buffer.
         if (pcmOut) {
-            if (frate == 22050) {
-                if (fchannels == 1) {
-                    for (uint32_t i = 0; i < procLen; i++) {
-                        ds0 = (decodeBuf[i] >> 16) / 32767.0f;
-                        *pcmOut++ = ds0;
-                        *pcmOut++ = ds0;
-                        *pcmOut++ = ds0;
-                        *pcmOut++ = ds0;
-                    }
-                } else {
-                    for (uint32_t i = 0; i < procLen; i++) {
-                        ds0 = (decodeBuf[i] >> 16) / 32767.0f;
-                        ++i;
-                        ds1 = (decodeBuf[i] >> 16) / 32767.0f;
-                        *pcmOut++ = ds0;
-                        *pcmOut++ = ds1;
-                        *pcmOut++ = ds0;
-                        *pcmOut++ = ds1;
-                    }
-                }
-            } else {
-                if (fchannels == 1) {
-                    for (uint32_t i = 0; i < procLen; i++) {
-                        ds0 = (decodeBuf[i] >> 16) / 32767.0f;
-                        *pcmOut++ = ds0;
-                        *pcmOut++ = ds0;
-                    }
-                } else {
-                    for (uint32_t i = 0; i < procLen; i++)
-                        *pcmOut++ = (decodeBuf[i] >> 16) / 32767.0f;
-                }
-            }
+            _mixk.convS32(pcmOut, decodeBuf, procLen, FOXEN_CONV_SHIFT);
+            pcmOut += procLen;
         }
 
-        n = bufPos - inUsed;
-        if (n == 0) {
+        bufPos += inUsed;
+        if (inUsed == 0 && procLen == 0) {
             // Exit loop when both decoding & reading are done.
-            if (procLen == 0 && size == 0)
+            if (size == 0)
+                break;
+            refill = 1;
+        } else {
+            refill = (bufEnd - bufPos < bufSize / 4);
+        }
+    }
+    if (pcmOut)
+        buf->used = buf->avail;
+
+cleanup:
+    mem_free(decodeBuf);
+    mem_free(flac);
+    return error;
+}
+
+#ifdef USE_LOAD_MEM
+/*
+  Decode FLAC data held in memory.  The data is passed directly to the
+  decoder rather than being copied through a read buffer.
+*/
+static const char* foxenFlacDecodeMem(const uint8_t* data, uint32_t size,
+                                      FaunBuffer* buf)
+{
+    const char* error = NULL;
+    int32_t* decodeBuf;
+    uint32_t inUsed, procLen;
+    float* pcmOut = NULL;
+    fx_flac_state_t fstate;
+    fx_flac_t* flac;
+
+    flac = foxen_init();
+    decodeBuf = (int32_t*) mem_alloc(FAUN_FLAC_DECODE_SIZE * sizeof(int32_t));
+    if (! flac || ! decodeBuf) {
+        error = "FLAC decoder alloc failed";
+        goto cleanup;
+    }
+
+    while (1) {
+        inUsed  = size;
+        procLen = FAUN_FLAC_DECODE_SIZE;
+        fstate = fx_flac_process(flac, data, &inUsed, decodeBuf, &procLen);
+        if (fstate == FLAC_ERR) {
+            error = "FLAC decode failed";
+            break;
+        }
+        if (fstate == FLAC_END_OF_METADATA) {
+            if ((error = foxen_allocBuffer(flac, buf)))
                 break;
-        } else if (inUsed) {
-            // Move unprocessed bytes to the beginning of readBuf.
-            //printf("KR unproc %ld pos:%d used:%d\n", n, bufPos, inUsed);
-            memmove(readBuf, readBuf + inUsed, n);
+            pcmOut = buf->sample.f32;
+        } else if (inUsed == 0 && procLen == 0) {
+            break;
         }
-        bufPos = n;
+
+        if (pcmOut) {
+            _mixk.convS32(pcmOut, decodeBuf, procLen, FOXEN_CONV_SHIFT);
+            pcmOut += procLen;
+        }
+
+        data += inUsed;
+        size -= inUsed;
     }
-    buf->used = frames;
+    if (pcmOut)
+        buf->used = buf->avail;
 
-    free(decodeBuf);
-    free(flac);
+cleanup:
+    mem_free(decodeBuf);
+    mem_free(flac);
     return error;
 }
+#endif
 
 #else
 #include <FLAC/stream_decoder.h>
@@ -141,6 +207,7 @@ typedef struct {
     float* pcmOut;
 
     FILE* fp;
+    const uint8_t* mem;     // Data to read if fp is NULL.
     uint32_t length;
 
     uint64_t totalSamples;
@@ -158,13 +225,18 @@ static FLAC__StreamDecoderReadStatus flacRead(const FLAC__StreamDecoder* fdec,
 
     if (len > rd->length)
         len = rd->length;
-    len = fread(buffer, 1, len, rd->fp);
+    if (rd->fp) {
+        len = fread(buffer, 1, len, rd->fp);
+    } else {
+        memcpy(buffer, rd->mem, len);
+        rd->mem += len;
+    }
     rd->length -= len;
     *bytes = len;
 
     if (len > 0)
         return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
-    if (ferror(rd->fp))
+    if (rd->fp && ferror(rd->fp))
         return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
     return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
 }
@@ -190,7 +262,7 @@ static void flacMetadata(const FLAC__StreamDecoder* fdec,
                rd->totalSamples, rd->rate, rd->channels, rd->bitsPerSample);
 #endif
 
-        if (rd->rate != 44100 && rd->rate != 22050) {
+        if (rd->rate < LOAD_RATE_MIN || rd->rate > LOAD_RATE_MAX) {
             fprintf(_errStream, "FLAC sample rate %d not handled\n", rd->rate);
             return;
         }
@@ -201,7 +273,12 @@ static void flacMetadata(const FLAC__StreamDecoder* fdec,
         }
 
         if (rd->totalSamples) {
-            _allocBufferVoice(rd->buf, rd->totalSamples);
+            if (! _allocBufferLoad(rd->buf, rd->channels, rd->rate,
+                                   rd->totalSamples)) {
+                fprintf(_errStream, "FLAC no memory for %lu samples\n",
+                        rd->totalSamples);
+                return;
+            }
             rd->pcmOut = rd->buf->sample.f32;
         }
     }
@@ -212,53 +289,20 @@ static FLAC__StreamDecoderWriteStatus flacWrite(const FLAC__StreamDecoder* fdec,
 {
     FlacReader* rd = (FlacReader*) client_data;
     float* pcmOut = rd->pcmOut;
-    const FLAC__int32* chan0 = buffer[0];
-    const FLAC__int32* chan1;
-    size_t i, procLen = frame->header.blocksize;
+    uint32_t procLen = frame->header.blocksize;
     int shift = rd->bitsPerSample - 16;
-    float ds0, ds1;
     (void) fdec;
 
     if (! pcmOut)
         return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 
-    if (rd->rate == 22050) {
-        if (rd->channels == 1) {
-            for (i = 0; i < procLen; i++) {
-                ds0 = (chan0[i] >> shift) / 32767.0f;
-                *pcmOut++ = ds0;
-                *pcmOut++ = ds0;
-                *pcmOut++ = ds0;
-                *pcmOut++ = ds0;
-            }
-        } else {
-            chan1 = buffer[1];
-            for (i = 0; i < procLen; i++) {
-                ds0 = (chan0[i] >> shift) / 32767.0f;
-                ds1 = (chan1[i] >> shift) / 32767.0f;
-                *pcmOut++ = ds0;
-                *pcmOut++ = ds1;
-                *pcmOut++ = ds0;
-                *pcmOut++ = ds1;
-            }
-        }
+    if (rd->channels == 1) {
+        _mixk.convS32(pcmOut, buffer[0], procLen, shift);
+        rd->pcmOut = pcmOut + procLen;
     } else {
-        if (rd->channels == 1) {
-            for (i = 0; i < procLen; i++) {
-                ds0 = (chan0[i] >> shift) / 32767.0f;
-                *pcmOut++ = ds0;
-                *pcmOut++ = ds0;
-            }
-        } else {
-            chan1 = buffer[1];
-            for (i = 0; i < procLen; i++) {
-                *pcmOut++ = (chan0[i] >> shift) / 32767.0f;
-                *pcmOut++ = (chan1[i] >> shift) / 32767.0f;
-            }
-        }
+        _mixk.interleaveS32(pcmOut, buffer[0], buffer[1], procLen, shift);
+        rd->pcmOut = pcmOut + procLen*2;
     }
-
-    rd->pcmOut = pcmOut;
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
@@ -271,7 +315,16 @@ static void flacError(const FLAC__StreamDecoder* fdec,
             FLAC__StreamDecoderErrorStatusString[status]);
 }
 
-static const char* libFlacDecode(FILE* fp, uint32_t size, FaunBuffer* buf)
+/*
+  Decode FLAC data from either a file or memory.
+
+  \param fp    File to read or NULL to read mem.
+  \param mem   Data in memory.
+  \param size  Bytes of data.  If reading a file this may be zero to read
+                to the file end.
+*/
+static const char* libFlacDecode(FILE* fp, const uint8_t* mem, uint32_t size,
+                                 FaunBuffer* buf)
 {
     FLAC__StreamDecoder* dec;
     const char* error = NULL;
@@ -280,6 +333,7 @@ static const char* libFlacDecode(FILE* fp, uint32_t size, FaunBuffer* buf)
     fr.buf = buf;
     fr.pcmOut = NULL;
     fr.fp = fp;
+    fr.mem = mem;
     fr.length = size ? size : UINT32_MAX;
     fr.totalSamples = 0;
     fr.rate = 0;
@@ -0,0 +1,224 @@
+/*
+  Faun IMA ADPCM buffer storage
+
+  Samples are stored as 4-bit IMA ADPCM codes in blocks of
+  ADPCM_BLOCK_FRAMES.  Each block holds a header & the codes for each
+  channel in turn.  The header is the predictor (16-bit little endian) and
+  step index at the start of the block, so decoding can begin at any block
+  without reading those before it.
+
+  The encoder state carries over between blocks, so the headers add no
+  error of their own.
+*/
+
+#define ADPCM_BLOCK_FRAMES  128
+#define ADPCM_HEADER        4
+#define ADPCM_CHAN_BYTES    (ADPCM_HEADER + ADPCM_BLOCK_FRAMES/2)
+
+#ifdef FAUN_FIXED
+#define ADPCM_SAMPLE(v)     ((int16_t) (v))
+#else
+#define ADPCM_SAMPLE(v)     ((float) (v) * (1.0f / 32767.0f))
+#endif
+
+static const int16_t adpcm_stepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t adpcm_indexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+
+/*
+  Return the number of bytes needed to store the given number of frames.
+*/
+static uint32_t adpcm_size(int chan, uint32_t frames)
+{
+    uint32_t blocks = (frames + ADPCM_BLOCK_FRAMES - 1) / ADPCM_BLOCK_FRAMES;
+    return blocks * chan * ADPCM_CHAN_BYTES;
+}
+
+
+/*
+  Apply a code to the predictor & step index.
+*/
+static inline void adpcm_step(int* pred, int* index, int code)
+{
+    int step = adpcm_stepTable[*index];
+    int diff = step >> 3;
+    int p, i;
+
+    if (code & 4)
+        diff += step;
+    if (code & 2)
+        diff += step >> 1;
+    if (code & 1)
+        diff += step >> 2;
+
+    p = (code & 8) ? *pred - diff : *pred + diff;
+    if (p > 32767)
+        p = 32767;
+    else if (p < -32768)
+        p = -32768;
+    *pred = p;
+
+    i = *index + adpcm_indexTable[code];
+    if (i < 0)
+        i = 0;
+    else if (i > 88)
+        i = 88;
+    *index = i;
+}
+
+
+// Convert a float sample to 16-bit with clipping.
+static int adpcm_quantize(float v)
+{
+    v *= 32767.0f;
+    if (v > 32767.0f)
+        v = 32767.0f;
+    else if (v < -32768.0f)
+        v = -32768.0f;
+    return (int) lrintf(v);
+}
+
+
+/*
+  Encode float samples.
+
+  \param dst     Output memory of adpcm_size() bytes.
+  \param src     Interleaved samples.
+  \param chan    Number of channels.
+  \param frames  Number of frames in src.
+*/
+static void adpcm_encode(uint8_t* dst, const float* src, int chan,
+                         uint32_t frames)
+{
+    int pred[2] = { 0, 0 };
+    int index[2] = { 0, 0 };
+    const float* in;
+    uint8_t* cp;
+    uint32_t n, i;
+    int c, code, diff, step, s;
+
+    // Start with a step near the first difference so the encoder does not
+    // need to catch up with the signal.
+    for (c = 0; c < chan && frames > 1; ++c) {
+        diff = abs(adpcm_quantize(src[chan + c]) - adpcm_quantize(src[c]));
+        while (index[c] < 88 && adpcm_stepTable[index[c]] < diff)
+            ++index[c];
+    }
+
+    for (; frames; frames -= n, src += n*chan) {
+        n = (frames < ADPCM_BLOCK_FRAMES) ? frames : ADPCM_BLOCK_FRAMES;
+        for (c = 0; c < chan; ++c) {
+            cp = dst;
+            dst += ADPCM_CHAN_BYTES;
+            cp[0] = pred[c] & 0xff;
+            cp[1] = (pred[c] >> 8) & 0xff;
+            cp[2] = index[c];
+            cp[3] = 0;
+            cp += ADPCM_HEADER;
+            memset(cp, 0, ADPCM_BLOCK_FRAMES/2);
+
+            in = src + c;
+            for (i = 0; i < n; ++i, in += chan) {
+                s = adpcm_quantize(*in);
+
+                // Pick the code which best approximates the difference.
+                diff = s - pred[c];
+                code = 0;
+                if (diff < 0) {
+                    code = 8;
+                    diff = -diff;
+                }
+                step = adpcm_stepTable[index[c]];
+                if (diff >= step) {
+                    code |= 4;
+                    diff -= step;
+                }
+                step >>= 1;
+                if (diff >= step) {
+                    code |= 2;
+                    diff -= step;
+                }
+                step >>= 1;
+                if (diff >= step)
+                    code |= 1;
+
+                adpcm_step(pred + c, index + c, code);
+                cp[i >> 1] |= code << ((i & 1) * 4);
+            }
+        }
+    }
+}
+
+
+/*
+  Decode the codes of one channel of a block.
+
+  \param dst     Output for count samples.
+  \param stride  Distance between output samples.
+  \param cp      Channel header of the block.
+  \param skip    Number of frames to decode before the output begins.
+  \param count   Number of samples to output.
+*/
+static void adpcm_decodeChan(FaunSample* dst, int stride, const uint8_t* cp,
+                             uint32_t skip, uint32_t count)
+{
+    const uint8_t* codes = cp + ADPCM_HEADER;
+    int pred  = (int16_t) (cp[0] | (cp[1] << 8));
+    int index = cp[2];
+    uint32_t i, end;
+
+    for (i = 0; i < skip; ++i)
+        adpcm_step(&pred, &index, (codes[i >> 1] >> ((i & 1) * 4)) & 15);
+
+    for (end = skip + count; i < end; ++i) {
+        adpcm_step(&pred, &index, (codes[i >> 1] >> ((i & 1) * 4)) & 15);
+        *dst = ADPCM_SAMPLE(pred);
+        dst += stride;
+    }
+}
+
+
+/*
+  Decode frames to interleaved mix samples.
+
+  \param dst     Output for frames*chan samples.
+  \param data    Encoded blocks.
+  \param chan    Number of channels.
+  \param pos     First frame to decode.
+  \param frames  Number of frames to decode.
+*/
+static void adpcm_decode(FaunSample* dst, const uint8_t* data, int chan,
+                         uint32_t pos, uint32_t frames)
+{
+    const uint8_t* bp;
+    uint32_t skip = pos % ADPCM_BLOCK_FRAMES;
+    uint32_t n;
+    int c;
+
+    bp = data + (pos / ADPCM_BLOCK_FRAMES) * chan * ADPCM_CHAN_BYTES;
+    for (; frames; frames -= n) {
+        n = ADPCM_BLOCK_FRAMES - skip;
+        if (n > frames)
+            n = frames;
+        for (c = 0; c < chan; ++c) {
+            adpcm_decodeChan(dst + c, chan, bp, skip, n);
+            bp += ADPCM_CHAN_BYTES;
+        }
+        dst += n*chan;
+        skip = 0;
+    }
+}
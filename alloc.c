@@ -0,0 +1,261 @@
+/*
+  Faun sample memory
+
+  Buffer samples begin on a SAMPLE_ALIGN byte boundary and are preceded by
+  a SampleHeader which records their size & origin.  Memory is obtained
+  from the functions set with faun_setAllocator() (malloc & free by
+  default).
+
+  Loaded buffers may instead be placed in an arena, which hands out memory
+  from large blocks.  Arena samples are not released individually; the
+  blocks are all freed at once by faun_freeArena().  A mapped sound bank
+  (see bank.c) is also held by an arena.
+
+  Arena ids are reused, so samples are tagged with the id and the arena
+  generation, which is incremented each time the arena is freed.  A buffer
+  loaded into an arena which is freed before the audio thread receives it
+  can then be recognized & discarded.
+*/
+
+#define SAMPLE_ALIGN    64
+#define ARENA_MAX       8
+#define ARENA_BLOCK     (4*1024*1024)
+
+#define ALIGN_PTR(p) \
+    ((uint8_t*) (((uintptr_t) (p) + SAMPLE_ALIGN-1) & \
+                 ~(uintptr_t) (SAMPLE_ALIGN-1)))
+#define SAMPLE_HEADER(ptr)  (((SampleHeader*) (ptr)) - 1)
+#define SAMPLE_EXTRA        (sizeof(SampleHeader) + SAMPLE_ALIGN-1)
+
+#define ARENA_TAG(id,gen)   ((uint32_t) (id) | ((gen) << 8))
+#define ARENA_ID(tag)       ((int) ((tag) & 0xff))
+#define ARENA_GEN(tag)      ((tag) >> 8)
+
+typedef struct {
+    void*    base;      // Allocator memory or NULL if in an arena.
+    uint32_t size;      // Bytes requested.
+    uint32_t arena;     // Arena tag or zero.
+}
+SampleHeader;
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    uint8_t* pos;       // Start of unused memory.
+    uint8_t* end;
+}
+ArenaBlock;
+
+typedef struct {
+    ArenaBlock* blocks; // Block being filled first.
+    void*    map;       // Mapped bank file or NULL.
+    size_t   mapSize;
+    uint32_t blockSize;
+    uint32_t inUse;
+    uint32_t gen;       // Number of times the arena has been freed.
+}
+Arena;
+
+static void* mem_mallocHook(size_t size, void* user)
+{
+    (void) user;
+    return malloc(size);
+}
+
+static void mem_freeHook(void* ptr, void* user)
+{
+    (void) user;
+    free(ptr);
+}
+
+static FaunAllocFunc _memAlloc = mem_mallocHook;
+static FaunFreeFunc  _memFree  = mem_freeHook;
+static void* _memUser = NULL;
+
+static Arena _arena[ARENA_MAX];
+static uint32_t _arenaCur = 0;  // Arena tag for loaded buffers or zero.
+static atomic_flag _arenaLock = ATOMIC_FLAG_INIT;
+
+// Arena generations as seen by the audio thread (frees it has handled).
+static uint32_t _arenaGenA[ARENA_MAX];
+
+#define mem_alloc(size)     _memAlloc(size, _memUser)
+
+static void mem_free(void* ptr)
+{
+    if (ptr)
+        _memFree(ptr, _memUser);
+}
+
+
+static void* sample_alloc(size_t size)
+{
+    SampleHeader* hdr;
+    uint8_t* base;
+    uint8_t* mem;
+
+    base = (uint8_t*) mem_alloc(SAMPLE_EXTRA + size);
+    if (! base)
+        return NULL;
+    mem = ALIGN_PTR(base + sizeof(SampleHeader));
+    hdr = SAMPLE_HEADER(mem);
+    hdr->base  = base;
+    hdr->size  = size;
+    hdr->arena = 0;
+    return mem;
+}
+
+
+// Arena samples are left for faun_freeArena().
+static void sample_free(void* ptr)
+{
+    if (ptr) {
+        SampleHeader* hdr = SAMPLE_HEADER(ptr);
+        if (! hdr->arena)
+            mem_free(hdr->base);
+    }
+}
+
+
+/*
+  Resize sample memory, keeping the leading bytes.  Arena memory is only
+  trimmed; it cannot grow.
+
+  Return NULL and leave ptr unchanged if allocation fails.
+*/
+static void* sample_realloc(void* ptr, size_t size)
+{
+    SampleHeader* hdr = NULL;
+    void* mem;
+
+    if (ptr) {
+        hdr = SAMPLE_HEADER(ptr);
+        if (hdr->arena) {
+            if (size > hdr->size)
+                return NULL;
+            hdr->size = size;
+            return ptr;
+        }
+    }
+
+    mem = sample_alloc(size);
+    if (mem && ptr) {
+        memcpy(mem, ptr, (size < hdr->size) ? size : hdr->size);
+        sample_free(ptr);
+    }
+    return mem;
+}
+
+
+/*
+  Add a block of at least size bytes to an arena.  A block larger than the
+  arena blockSize is placed behind the one being filled so that its unused
+  memory is not lost.
+*/
+static ArenaBlock* arena_addBlock(Arena* ar, size_t size)
+{
+    ArenaBlock* blk;
+    int dedicated = (size > ar->blockSize);
+
+    if (! dedicated)
+        size = ar->blockSize;
+    blk = (ArenaBlock*) mem_alloc(sizeof(ArenaBlock) + size);
+    if (blk) {
+        blk->pos = (uint8_t*) (blk + 1);
+        blk->end = blk->pos + size;
+        if (dedicated && ar->blocks) {
+            blk->next = ar->blocks->next;
+            ar->blocks->next = blk;
+        } else {
+            blk->next = ar->blocks;
+            ar->blocks = blk;
+        }
+    }
+    return blk;
+}
+
+
+static void* arena_alloc(uint32_t tag, size_t size)
+{
+    Arena* ar = _arena + (ARENA_ID(tag) - 1);
+    ArenaBlock* blk = ar->blocks;
+    SampleHeader* hdr;
+    uint8_t* mem;
+
+    if (! blk || (size_t) (blk->end - blk->pos) < SAMPLE_EXTRA + size) {
+        blk = arena_addBlock(ar, SAMPLE_EXTRA + size);
+        if (! blk)
+            return NULL;
+    }
+
+    mem = ALIGN_PTR(blk->pos + sizeof(SampleHeader));
+    blk->pos = mem + size;
+    hdr = SAMPLE_HEADER(mem);
+    hdr->base  = NULL;
+    hdr->size  = size;
+    hdr->arena = tag;
+    return mem;
+}
+
+
+/*
+  Reserve an unused arena.  Return arena tag or zero if all are in use.
+*/
+static uint32_t arena_claim(uint32_t blockSize, int makeCurrent)
+{
+    Arena* ar;
+    int i;
+    uint32_t tag = 0;
+
+    while (atomic_flag_test_and_set(&_arenaLock)) {}
+    for (i = 0; i < ARENA_MAX; ++i) {
+        ar = _arena + i;
+        if (! ar->inUse) {
+            ar->inUse = 1;
+            ar->blockSize = blockSize;
+            tag = ARENA_TAG(i + 1, ar->gen);
+            if (makeCurrent)
+                _arenaCur = tag;
+            break;
+        }
+    }
+    atomic_flag_clear(&_arenaLock);
+    return tag;
+}
+
+
+static void arena_releaseBlocks(ArenaBlock* blk)
+{
+    ArenaBlock* next;
+    for (; blk; blk = next) {
+        next = blk->next;
+        mem_free(blk);
+    }
+}
+
+
+/*
+  Move heap samples into the arena with the given tag.  If that arena has
+  been freed (or holds a bank) or is out of memory then ptr is returned.
+
+  The copy is made while holding the lock so that faun_freeArena() cannot
+  release the memory during it.
+*/
+static void* arena_adopt(void* ptr, uint32_t tag)
+{
+    void* mem = NULL;
+    uint32_t size = SAMPLE_HEADER(ptr)->size;
+    const Arena* ar = _arena + (ARENA_ID(tag) - 1);
+
+    while (atomic_flag_test_and_set(&_arenaLock)) {}
+    if (ar->inUse && ar->blockSize && ar->gen == ARENA_GEN(tag)) {
+        mem = arena_alloc(tag, size);
+        if (mem)
+            memcpy(mem, ptr, size);
+    }
+    atomic_flag_clear(&_arenaLock);
+
+    if (! mem)
+        return ptr;
+    sample_free(ptr);
+    return mem;
+}
@@ -0,0 +1,149 @@
+/*
+  Faun sound bank
+
+  A bank file holds buffers which have already been converted to their
+  playback rate & storage format so that faun_loadBank() can map the file
+  and use the samples in place.  Banks are made with the faun_bank tool.
+
+  File layout (little endian):
+
+    BankHeader
+    BankEntry[count]
+    Sample data of each entry
+
+  The data of each entry begins on a SAMPLE_ALIGN boundary and is preceded
+  by at least BANK_SLOT unused bytes.  The loader writes a SampleHeader
+  there, so the file is mapped copy-on-write.
+*/
+
+#define BANK_MAGIC      "FnBk"
+#define BANK_VERSION    1
+#define BANK_SLOT       SAMPLE_ALIGN
+
+typedef struct {
+    char     magic[4];
+    uint16_t version;
+    uint16_t count;         // Number of BankEntry.
+    uint32_t reserved[2];
+}
+BankHeader;
+
+typedef struct {
+    uint32_t offset;        // File position of sample data.
+    uint32_t size;          // Bytes of sample data.
+    uint32_t frames;
+    uint32_t rate;
+    uint8_t  chanLayout;    // FAUN_CHAN_1 or FAUN_CHAN_2.
+    uint8_t  format;        // FaunSampleFormat.
+    uint16_t reserved;
+}
+BankEntry;
+
+
+/*
+  Return non-zero if the entry describes data inside the mapped file which
+  this build can play.
+*/
+static int bank_validEntry(const BankEntry* ent, const uint8_t* map,
+                           size_t fileSize)
+{
+    uint64_t need;
+    int chan;
+
+    if (ent->offset < sizeof(BankHeader) + BANK_SLOT ||
+        ent->offset % SAMPLE_ALIGN ||
+        (uint64_t) ent->offset + ent->size > fileSize)
+        return 0;
+    if (ent->chanLayout != FAUN_CHAN_1 && ent->chanLayout != FAUN_CHAN_2)
+        return 0;
+    if (! ent->frames ||
+        ent->rate < LOAD_RATE_MIN || ent->rate > LOAD_RATE_MAX)
+        return 0;
+    chan = ent->chanLayout;
+
+    switch (ent->format) {
+#ifndef FAUN_FIXED
+        case FAUN_F32:
+#endif
+        case FAUN_S16:
+            need = (uint64_t) ent->frames * chan * faun_formatSize[ent->format];
+            break;
+        case FAUN_ADPCM:
+            need = adpcm_size(chan, ent->frames);
+            break;
+        case FAUN_VORBIS:
+            // The encoded size is stored in the header & must fit too.
+            if (ent->size < ENCODED_HEADER)
+                return 0;
+            need = ENCODED_HEADER +
+                   (uint64_t) *((const uint32_t*) (map + ent->offset));
+            break;
+        default:
+            return 0;
+    }
+    return ent->size >= need;
+}
+
+
+#ifdef _WIN32
+#include <windows.h>
+
+static void* bank_map(const char* file, size_t* size)
+{
+    HANDLE fh, mh;
+    LARGE_INTEGER len;
+    void* mem = NULL;
+
+    fh = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL,
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (GetFileSizeEx(fh, &len) && len.QuadPart) {
+        mh = CreateFileMappingA(fh, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (mh) {
+            mem = MapViewOfFile(mh, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(mh);
+            *size = (size_t) len.QuadPart;
+        }
+    }
+    CloseHandle(fh);
+    return mem;
+}
+
+static void bank_unmap(void* mem, size_t size)
+{
+    (void) size;
+    UnmapViewOfFile(mem);
+}
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void* bank_map(const char* file, size_t* size)
+{
+    struct stat st;
+    void* mem = NULL;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fd, 0);
+        if (mem == MAP_FAILED)
+            mem = NULL;
+        else
+            *size = st.st_size;
+    }
+    close(fd);
+    return mem;
+}
+
+static void bank_unmap(void* mem, size_t size)
+{
+    munmap(mem, size);
+}
+#endif
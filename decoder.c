@@ -0,0 +1,785 @@
+/*
+  Faun stream decoders
+
+  A stream reads its data from a file chunk or from memory through one of
+  the StreamDecoder method tables below.  The decoder is chosen by
+  stream_open() from the first four bytes of the data.
+
+  Ogg Vorbis is decoded by libvorbisfile.  WAVE sample data is converted
+  directly from the file or memory.  FLAC uses the decoder selected by
+  USE_FLAC; seeking with the foxen decoder starts at the nearest point of
+  a SEEKTABLE (or the first frame if there is none) and discards samples up
+  to the target.
+*/
+
+static size_t stream_readBytes(StreamOV* st, void* buf, size_t len)
+{
+    if (st->mem.data)
+        return mem_fread(buf, 1, len, &st->mem);
+    return fread(buf, 1, len, st->chunk.cfile);
+}
+
+// Position the input at a byte offset from the stream start.
+static int stream_seekBytes(StreamOV* st, uint32_t pos)
+{
+    if (st->mem.data)
+        return mem_fseek(&st->mem, pos, SEEK_SET);
+    return chunk_fseek(&st->chunk, pos, SEEK_SET);
+}
+
+// Duplicate mono samples at the start of dst to fill stereo frames.
+static void stream_expandMono(float* dst, long frames)
+{
+    float* it = dst + frames;
+    float* out = dst + frames*2;
+    while (it != dst) {
+        out -= 2;
+        out[0] = out[1] = *--it;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Ogg Vorbis
+
+static const char* vorbis_open(StreamOV* st)
+{
+    vorbis_info* vinfo;
+    int err;
+
+    if (st->mem.data)
+        err = ov_open_callbacks(&st->mem, &st->in.vf, NULL, 0, memMethods);
+    else
+        err = ov_open_callbacks(&st->chunk, &st->in.vf, NULL, 0, chunkMethods);
+    if (err < 0)
+        return "Cannot open Ogg";
+
+    vinfo = ov_info(&st->in.vf, -1);
+    st->rate = vinfo->rate;
+    st->channels = (vinfo->channels > 1) ? 2 : 1;
+    return NULL;
+}
+
+static long vorbis_read(StreamOV* st, float* dst, int frames, int chan)
+{
+    float** pcm;
+    int bitstream;
+    long amt;
+
+    // Samples are decoded internally to float so ov_read_float is faster
+    // than ov_read.  One packet is decoded per call.
+    amt = ov_read_float(&st->in.vf, &pcm, frames, &bitstream);
+    if (amt > 0) {
+        if (chan == 1)
+            memcpy(dst, pcm[0], amt * sizeof(float));
+        else
+            _mixk.interleave(dst, pcm[0], pcm[st->channels - 1], amt);
+    }
+    return amt;
+}
+
+static void vorbis_seek(StreamOV* st, double sec)
+{
+    ov_time_seek(&st->in.vf, sec);
+}
+
+static void vorbis_rewind(StreamOV* st)
+{
+    ov_raw_seek(&st->in.vf, 0);
+}
+
+static uint64_t vorbis_pcmTotal(StreamOV* st)
+{
+    ogg_int64_t n = ov_pcm_total(&st->in.vf, -1);
+    return (n < 0) ? 0 : n;
+}
+
+static void vorbis_close(StreamOV* st)
+{
+    ov_clear(&st->in.vf);       // Closes st->chunk.cfile for us.
+}
+
+static const StreamDecoder streamVorbis = {
+    vorbis_open, vorbis_read, vorbis_seek, vorbis_rewind, vorbis_pcmTotal,
+    vorbis_close
+};
+
+//----------------------------------------------------------------------------
+// WAVE
+
+static const char* wave_open(StreamOV* st)
+{
+    WavStream* ws = &st->in.wav;
+    WavHeader wh;
+    const char* error;
+
+    if (st->mem.data) {
+#ifdef USE_LOAD_MEM
+        const uint8_t* pcm;
+        if (wav_parseMem(&wh, st->mem.data, st->mem.size, &pcm))
+            return "WAVE header is invalid";
+        ws->dataPos = pcm - st->mem.data;
+#else
+        return "WAVE data in memory is unsupported";
+#endif
+    } else {
+        if (wav_readHeader(st->chunk.cfile, &wh))
+            return "WAVE header is invalid";
+        ws->dataPos = ftell(st->chunk.cfile) - st->chunk.offset;
+    }
+
+    if ((error = wav_checkFormat(&wh)))
+        return error;
+    ws->frameSize = wh.channels * (wh.bitsPerSample / 8);
+    if (! ws->frameSize || ws->frameSize > WAV_READ_CHUNK)
+        return "WAVE channel count is unsupported";
+
+    ws->dataSize = wh.dataSize - (wh.dataSize % ws->frameSize);
+    ws->pos      = 0;
+    ws->format   = wh.format;
+    ws->channels = wh.channels;
+    st->rate = wh.sampleRate;
+    st->channels = (wh.channels > 1) ? 2 : 1;
+    return NULL;
+}
+
+static long wave_read(StreamOV* st, float* dst, int frames, int chan)
+{
+    uint32_t chunk[WAV_READ_CHUNK / sizeof(uint32_t)];
+    WavStream* ws = &st->in.wav;
+    const void* src;
+    uint32_t avail = (ws->dataSize - ws->pos) / ws->frameSize;
+    uint32_t chunkFrames = sizeof(chunk) / ws->frameSize;
+    uint32_t n;
+    long count;
+    int direct;
+
+    if ((uint32_t) frames > avail)
+        frames = avail;
+
+    // Float data of the same layout is read straight into dst.
+    direct = (ws->format == WAV_IEEE_FLOAT && ws->channels == chan &&
+              ! st->mem.data);
+
+    for (count = 0; count < frames; count += n, dst += n * chan) {
+        n = frames - count;
+        if (direct) {
+            if (fread(dst, ws->frameSize, n, st->chunk.cfile) != n)
+                return -1;
+            ws->pos += n * ws->frameSize;
+            continue;
+        }
+
+        if (n > chunkFrames)
+            n = chunkFrames;
+        if (st->mem.data) {
+            src = st->mem.data + ws->dataPos + ws->pos;
+            if ((uintptr_t) src & 3) {
+                memcpy(chunk, src, n * ws->frameSize);
+                src = chunk;
+            }
+        } else {
+            if (fread(chunk, ws->frameSize, n, st->chunk.cfile) != n)
+                return -1;
+            src = chunk;
+        }
+        ws->pos += n * ws->frameSize;
+
+        wav_convertFrames(dst, ws->format, ws->channels, src, n);
+        if (chan > st->channels)
+            stream_expandMono(dst, n);
+    }
+    return count;
+}
+
+static void wave_seek(StreamOV* st, double sec)
+{
+    WavStream* ws = &st->in.wav;
+    uint64_t frame = (uint64_t) (sec * st->rate);
+    uint64_t pos = frame * ws->frameSize;
+
+    ws->pos = (pos < ws->dataSize) ? (uint32_t) pos : ws->dataSize;
+    if (! st->mem.data)
+        stream_seekBytes(st, ws->dataPos + ws->pos);
+}
+
+static void wave_rewind(StreamOV* st)
+{
+    wave_seek(st, 0.0);
+}
+
+static uint64_t wave_pcmTotal(StreamOV* st)
+{
+    return st->in.wav.dataSize / st->in.wav.frameSize;
+}
+
+static void wave_close(StreamOV* st)
+{
+    (void) st;
+}
+
+static const StreamDecoder streamWav = {
+    wave_open, wave_read, wave_seek, wave_rewind, wave_pcmTotal, wave_close
+};
+
+//----------------------------------------------------------------------------
+// FLAC
+
+#if USE_FLAC == 2
+#define FLAC_BE32(p) \
+    (((uint32_t) (p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+
+typedef struct {
+    uint64_t sample;
+    uint32_t offset;        // From the first frame.
+}
+FlacSeekPoint;
+
+struct FlacStream {
+    fx_flac_t* flac;
+    int32_t* out;           // FAUN_FLAC_DECODE_SIZE decoded samples.
+    const uint8_t* in;      // Input window or the memory data.
+    FlacSeekPoint* seekTable;
+    uint32_t seekCount;
+    uint32_t frames;
+    uint32_t audioStart;    // Offset of the first frame.
+    uint32_t srcPos;        // File offset following the window data.
+    uint32_t srcEnd;
+    uint32_t inPos, inEnd;
+    uint32_t outPos, outLen;
+    uint64_t blockPos;      // Frame of the next decoded sample.
+    uint64_t skipTo;        // Frames before this are discarded.
+    int blockBegin;
+    uint8_t info[FLAC_STREAMINFO_END];  // Metadata given to the decoder.
+};
+
+/*
+  Reset the decoder and position the input at a frame header.
+
+  \param offset  Byte offset from the first frame.
+*/
+static void flac_restart(StreamOV* st, FlacStream* fs, uint32_t offset)
+{
+    const uint8_t* in = fs->info;
+    uint32_t avail = FLAC_STREAMINFO_END;
+    uint32_t inLen;
+
+    fx_flac_reset(fs->flac);
+    while (avail) {
+        inLen = avail;
+        if (fx_flac_process(fs->flac, in, &inLen, NULL, NULL) == FLAC_ERR ||
+            ! inLen)
+            break;
+        in += inLen;
+        avail -= inLen;
+    }
+
+    offset += fs->audioStart;
+    if (st->mem.data) {
+        fs->inPos = (offset < fs->inEnd) ? offset : fs->inEnd;
+    } else {
+        fs->inPos = fs->inEnd = 0;
+        fs->srcPos = offset;
+        stream_seekBytes(st, offset);
+    }
+    fs->outPos = fs->outLen = 0;
+    fs->blockPos = 0;
+    fs->skipTo = 0;
+    fs->blockBegin = 1;
+}
+
+// Read the SEEKTABLE metadata block.
+static int flac_readSeekTable(StreamOV* st, FlacStream* fs, uint32_t len)
+{
+    FlacSeekPoint* sp;
+    uint8_t pt[18];
+    uint64_t sample, offset;
+    uint32_t i, count = len / 18;
+
+    fs->seekTable = sp = (FlacSeekPoint*)
+                         mem_alloc(count * sizeof(FlacSeekPoint) + 1);
+    if (! sp)
+        return 0;
+    for (i = 0; i < count; ++i) {
+        if (stream_readBytes(st, pt, 18) != 18)
+            return 0;
+        sample = ((uint64_t) FLAC_BE32(pt) << 32) | FLAC_BE32(pt + 4);
+        offset = ((uint64_t) FLAC_BE32(pt + 8) << 32) | FLAC_BE32(pt + 12);
+        // Skip placeholders & points which are not in order.
+        if (sample == UINT64_MAX || offset > UINT32_MAX ||
+            (sp != fs->seekTable && sample <= sp[-1].sample))
+            continue;
+        sp->sample = sample;
+        sp->offset = (uint32_t) offset;
+        ++sp;
+    }
+    fs->seekCount = sp - fs->seekTable;
+    return 1;
+}
+
+static void flac_close(StreamOV* st)
+{
+    FlacStream* fs = st->in.flac;
+    mem_free(fs->seekTable);
+    mem_free(fs->flac);
+    mem_free(fs);
+    st->in.flac = NULL;
+}
+
+static const char* flac_open(StreamOV* st)
+{
+    FlacStream* fs;
+    FlacInfo fi;
+    uint8_t hdr[4];
+    uint32_t pos, len;
+    size_t size = sizeof(FlacStream) + FAUN_FLAC_DECODE_SIZE * sizeof(int32_t);
+    int last;
+
+    if (! st->mem.data)
+        size += FAUN_FLAC_READ_SIZE;
+    st->in.flac = fs = (FlacStream*) mem_alloc(size);
+    if (! fs)
+        return "FLAC decoder alloc failed";
+    fs->out = (int32_t*) (fs + 1);
+    fs->seekTable = NULL;
+    fs->seekCount = 0;
+    fs->flac = foxen_init();
+    if (! fs->flac)
+        goto fail_alloc;
+
+    // Read the metadata block headers, keeping the STREAMINFO & SEEKTABLE.
+    if (stream_readBytes(st, fs->info, FLAC_STREAMINFO_END) !=
+            FLAC_STREAMINFO_END || ! split_flacInfo(&fi, fs->info))
+        goto fail_info;
+    last = fs->info[4] & 0x80;
+    fs->info[4] |= 0x80;
+    for (pos = FLAC_STREAMINFO_END; ! last; pos += len) {
+        if (stream_readBytes(st, hdr, 4) != 4)
+            goto fail_info;
+        last = hdr[0] & 0x80;
+        len = (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+        pos += 4;
+        if ((hdr[0] & 0x7F) == META_TYPE_SEEKTABLE && ! fs->seekTable &&
+            ! flac_readSeekTable(st, fs, len))
+            goto fail_info;
+        if (stream_seekBytes(st, pos + len))
+            goto fail_info;
+    }
+    fs->audioStart = pos;
+    fs->frames = fi.frames;
+
+    if (st->mem.data) {
+        fs->in = st->mem.data;
+        fs->inEnd = st->mem.size;
+    } else {
+        fs->in = (const uint8_t*) (fs->out + FAUN_FLAC_DECODE_SIZE);
+        fs->srcEnd = st->chunk.size ? st->chunk.size : UINT32_MAX;
+    }
+    flac_restart(st, fs, 0);
+
+    st->rate = fi.rate;
+    st->channels = fi.chan;
+    return NULL;
+
+fail_info:
+    flac_close(st);
+    return "FLAC stream is unsupported";
+
+fail_alloc:
+    flac_close(st);
+    return "FLAC decoder alloc failed";
+}
+
+// Move the unread input to the start of the window and fill the rest.
+static void flac_fill(StreamOV* st, FlacStream* fs)
+{
+    uint8_t* window = (uint8_t*) (fs->out + FAUN_FLAC_DECODE_SIZE);
+    uint32_t keep = fs->inEnd - fs->inPos;
+    size_t n = FAUN_FLAC_READ_SIZE - keep;
+
+    memmove(window, window + fs->inPos, keep);
+    if (n > fs->srcEnd - fs->srcPos)
+        n = fs->srcEnd - fs->srcPos;
+    n = fread(window + keep, 1, n, st->chunk.cfile);
+    if (! n)
+        fs->srcEnd = fs->srcPos;
+    fs->srcPos += n;
+    fs->inPos = 0;
+    fs->inEnd = keep + n;
+}
+
+static long flac_read(StreamOV* st, float* dst, int frames, int chan)
+{
+    FlacStream* fs = st->in.flac;
+    fx_flac_state_t fstate;
+    uint32_t inLen, procLen, n;
+    uint64_t skip;
+    int fchan = st->channels;
+    long count = 0;
+
+    while (count < frames) {
+        if (fs->outPos < fs->outLen) {
+            n = (fs->outLen - fs->outPos) / fchan;
+            if (n > (uint32_t) (frames - count))
+                n = frames - count;
+            _mixk.convS32(dst, fs->out + fs->outPos, n * fchan,
+                          FOXEN_CONV_SHIFT);
+            if (chan > fchan)
+                stream_expandMono(dst, n);
+            fs->outPos += n * fchan;
+            dst += n * chan;
+            count += n;
+            continue;
+        }
+
+        if (! st->mem.data && fs->srcPos < fs->srcEnd &&
+            fs->inEnd - fs->inPos < FAUN_FLAC_READ_SIZE / 4)
+            flac_fill(st, fs);
+
+        inLen = fs->inEnd - fs->inPos;
+        procLen = FAUN_FLAC_DECODE_SIZE;
+        fstate = fx_flac_process(fs->flac, fs->in + fs->inPos, &inLen,
+                                 fs->out, &procLen);
+        if (fstate == FLAC_ERR)
+            return count ? count : -1;
+        fs->inPos += inLen;
+
+        if (procLen) {
+            if (fs->blockBegin) {
+                fs->blockPos = split_flacBlockStart(fs->flac);
+                fs->blockBegin = 0;
+            }
+            fs->outPos = 0;
+            fs->outLen = procLen;
+
+            // Discard samples before a seek target.
+            if (fs->blockPos < fs->skipTo) {
+                skip = fs->skipTo - fs->blockPos;
+                if (skip > procLen / fchan)
+                    skip = procLen / fchan;
+                fs->outPos = skip * fchan;
+            }
+            fs->blockPos += procLen / fchan;
+        }
+
+        if (fstate == FLAC_END_OF_FRAME)
+            fs->blockBegin = 1;
+        else if (! inLen && ! procLen)
+            break;
+    }
+    return count;
+}
+
+static void flac_seek(StreamOV* st, double sec)
+{
+    FlacStream* fs = st->in.flac;
+    const FlacSeekPoint* sp  = fs->seekTable;
+    const FlacSeekPoint* end = sp + fs->seekCount;
+    uint64_t target = (uint64_t) (sec * st->rate);
+    uint32_t offset = 0;
+
+    for (; sp != end && sp->sample <= target; ++sp)
+        offset = sp->offset;
+    flac_restart(st, fs, offset);
+    fs->skipTo = target;
+}
+
+static void flac_rewind(StreamOV* st)
+{
+    flac_restart(st, st->in.flac, 0);
+}
+
+static uint64_t flac_pcmTotal(StreamOV* st)
+{
+    return st->in.flac->frames;
+}
+
+#elif defined(USE_FLAC)
+struct FlacStream {
+    FLAC__StreamDecoder* dec;
+    StreamOV* st;
+    float* pcm;             // Decoded block of st->channels samples.
+    uint32_t pcmPos, pcmLen;    // Frames.
+    uint32_t blockSize;
+    uint32_t length;        // Bytes of stream data.
+    uint64_t frames;
+    int bitsPerSample;
+    const char* error;
+};
+
+static long flac_tell(StreamOV* st)
+{
+    if (st->mem.data)
+        return st->mem.pos;
+    return chunk_ftell(&st->chunk);
+}
+
+static FLAC__StreamDecoderReadStatus flacStreamRead(
+        const FLAC__StreamDecoder* fdec, FLAC__byte buffer[], size_t* bytes,
+        void* client_data)
+{
+    FlacStream* fs = (FlacStream*) client_data;
+    long pos = flac_tell(fs->st);
+    size_t len = *bytes;
+    (void) fdec;
+
+    if (pos < 0)
+        return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+    if (len > fs->length - (uint32_t) pos)
+        len = fs->length - (uint32_t) pos;
+    *bytes = len = stream_readBytes(fs->st, buffer, len);
+    if (len > 0)
+        return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+    if (! fs->st->mem.data && ferror(fs->st->chunk.cfile))
+        return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+    return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+}
+
+static FLAC__StreamDecoderSeekStatus flacStreamSeek(
+        const FLAC__StreamDecoder* fdec, FLAC__uint64 offset,
+        void* client_data)
+{
+    FlacStream* fs = (FlacStream*) client_data;
+    (void) fdec;
+    if (offset > fs->length || stream_seekBytes(fs->st, (uint32_t) offset))
+        return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+    return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamDecoderTellStatus flacStreamTell(
+        const FLAC__StreamDecoder* fdec, FLAC__uint64* offset,
+        void* client_data)
+{
+    long pos = flac_tell(((FlacStream*) client_data)->st);
+    (void) fdec;
+    if (pos < 0)
+        return FLAC__STREAM_DECODER_TELL_STATUS_ERROR;
+    *offset = pos;
+    return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+static FLAC__StreamDecoderLengthStatus flacStreamLength(
+        const FLAC__StreamDecoder* fdec, FLAC__uint64* length,
+        void* client_data)
+{
+    (void) fdec;
+    *length = ((FlacStream*) client_data)->length;
+    return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
+static FLAC__bool flacStreamEof(const FLAC__StreamDecoder* fdec,
+                                void* client_data)
+{
+    FlacStream* fs = (FlacStream*) client_data;
+    long pos = flac_tell(fs->st);
+    (void) fdec;
+    return pos < 0 || (uint32_t) pos >= fs->length;
+}
+
+static void flacStreamMetadata(const FLAC__StreamDecoder* fdec,
+                               const FLAC__StreamMetadata* metadata,
+                               void* client_data)
+{
+    FlacStream* fs = (FlacStream*) client_data;
+    const FLAC__StreamMetadata_StreamInfo* si = &metadata->data.stream_info;
+    (void) fdec;
+
+    if (metadata->type != FLAC__METADATA_TYPE_STREAMINFO || fs->pcm)
+        return;
+    if (si->sample_rate < LOAD_RATE_MIN || si->sample_rate > LOAD_RATE_MAX) {
+        fs->error = "FLAC sample rate is unsupported";
+        return;
+    }
+    if (si->bits_per_sample < 16) {
+        fs->error = "FLAC bits per sample is unsupported";
+        return;
+    }
+
+    fs->st->rate = si->sample_rate;
+    fs->st->channels = (si->channels > 1) ? 2 : 1;
+    fs->frames = si->total_samples;
+    fs->bitsPerSample = si->bits_per_sample;
+    fs->blockSize = si->max_blocksize;
+    fs->pcm = (float*) mem_alloc(fs->blockSize * fs->st->channels *
+                                 sizeof(float));
+    if (! fs->pcm)
+        fs->error = "FLAC decoder alloc failed";
+}
+
+static FLAC__StreamDecoderWriteStatus flacStreamWrite(
+        const FLAC__StreamDecoder* fdec, const FLAC__Frame* frame,
+        const FLAC__int32* const buffer[], void* client_data)
+{
+    FlacStream* fs = (FlacStream*) client_data;
+    uint32_t procLen = frame->header.blocksize;
+    int shift = fs->bitsPerSample - 16;
+    (void) fdec;
+
+    if (! fs->pcm || procLen > fs->blockSize)
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+    if (fs->st->channels == 1)
+        _mixk.convS32(fs->pcm, buffer[0], procLen, shift);
+    else
+        _mixk.interleaveS32(fs->pcm, buffer[0], buffer[1], procLen, shift);
+    fs->pcmPos = 0;
+    fs->pcmLen = procLen;
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void flac_close(StreamOV* st)
+{
+    FlacStream* fs = st->in.flac;
+    FLAC__stream_decoder_finish(fs->dec);
+    FLAC__stream_decoder_delete(fs->dec);
+    mem_free(fs->pcm);
+    mem_free(fs);
+    st->in.flac = NULL;
+}
+
+static const char* flac_open(StreamOV* st)
+{
+    FlacStream* fs;
+    const char* error;
+    long end;
+
+    st->in.flac = fs = (FlacStream*) mem_alloc(sizeof(FlacStream));
+    if (! fs)
+        return "FLAC decoder alloc failed";
+    fs->st = st;
+    fs->pcm = NULL;
+    fs->pcmPos = fs->pcmLen = 0;
+    fs->error = NULL;
+    st->rate = 0;
+
+    if (st->mem.data)
+        fs->length = st->mem.size;
+    else if (st->chunk.size)
+        fs->length = st->chunk.size;
+    else {
+        fseek(st->chunk.cfile, 0, SEEK_END);
+        end = ftell(st->chunk.cfile);
+        fs->length = (end > (long) st->chunk.offset) ?
+                     (uint32_t) (end - st->chunk.offset) : 0;
+        stream_seekBytes(st, 0);
+    }
+
+    fs->dec = FLAC__stream_decoder_new();
+    if (! fs->dec) {
+        mem_free(fs);
+        st->in.flac = NULL;
+        return "FLAC decoder alloc failed";
+    }
+    if (FLAC__stream_decoder_init_stream(fs->dec, flacStreamRead,
+                flacStreamSeek, flacStreamTell, flacStreamLength,
+                flacStreamEof, flacStreamWrite, flacStreamMetadata,
+                flacError, fs) != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        error = "FLAC decoder init failed";
+        goto fail;
+    }
+    if (! FLAC__stream_decoder_process_until_end_of_metadata(fs->dec) ||
+        ! st->rate) {
+        error = fs->error ? fs->error : "FLAC metadata invalid";
+        goto fail;
+    }
+    if (fs->error) {
+        error = fs->error;
+        goto fail;
+    }
+    return NULL;
+
+fail:
+    flac_close(st);
+    return error;
+}
+
+static long flac_read(StreamOV* st, float* dst, int frames, int chan)
+{
+    FlacStream* fs = st->in.flac;
+    uint32_t n;
+    long count = 0;
+
+    while (count < frames) {
+        if (fs->pcmPos < fs->pcmLen) {
+            n = fs->pcmLen - fs->pcmPos;
+            if (n > (uint32_t) (frames - count))
+                n = frames - count;
+            memcpy(dst, fs->pcm + fs->pcmPos * st->channels,
+                   n * st->channels * sizeof(float));
+            if (chan > st->channels)
+                stream_expandMono(dst, n);
+            fs->pcmPos += n;
+            dst += n * chan;
+            count += n;
+            continue;
+        }
+
+        if (FLAC__stream_decoder_get_state(fs->dec) ==
+                FLAC__STREAM_DECODER_END_OF_STREAM)
+            break;
+        if (! FLAC__stream_decoder_process_single(fs->dec))
+            return count ? count : -1;
+    }
+    return count;
+}
+
+static void flac_seek(StreamOV* st, double sec)
+{
+    FlacStream* fs = st->in.flac;
+    uint64_t target = (uint64_t) (sec * st->rate);
+
+    fs->pcmPos = fs->pcmLen = 0;
+    if (fs->frames && target >= fs->frames)
+        target = fs->frames - 1;
+    // A failed seek leaves the decoder in need of a flush.
+    if (! FLAC__stream_decoder_seek_absolute(fs->dec, target))
+        FLAC__stream_decoder_flush(fs->dec);
+}
+
+static void flac_rewind(StreamOV* st)
+{
+    flac_seek(st, 0.0);
+}
+
+static uint64_t flac_pcmTotal(StreamOV* st)
+{
+    return st->in.flac->frames;
+}
+#endif
+
+#ifdef USE_FLAC
+static const StreamDecoder streamFlac = {
+    flac_open, flac_read, flac_seek, flac_rewind, flac_pcmTotal, flac_close
+};
+#endif
+
+//----------------------------------------------------------------------------
+
+/*
+  Open a decoder on st->chunk (which must be positioned at the data start)
+  or st->mem if st->mem.data is set.
+
+  Return error message or NULL if successful.
+*/
+static const char* stream_open(StreamOV* st)
+{
+    const char* error;
+    uint32_t id = 0;
+
+    if (stream_readBytes(st, &id, 4) != 4 || stream_seekBytes(st, 0))
+        return "Stream read failed";
+
+    if (id == ID_OGGS)
+        st->dec = &streamVorbis;
+    else if (id == ID_RIFF)
+        st->dec = &streamWav;
+#ifdef USE_FLAC
+    else if (id == ID_FLAC)
+        st->dec = &streamFlac;
+#endif
+    else
+        return "Stream format is unsupported";
+
+    if ((error = st->dec->open(st)))
+        st->dec = NULL;
+    return error;
+}
@@ -29,6 +29,7 @@
 */
 
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include "internal.h"
@@ -71,6 +72,8 @@ int endCapture = 0;
 #define REPORT_MIX(msg, ...)
 #endif
 
+#include "alloc.c"
+
 typedef struct {
 #ifdef GLV_ASSET_H
     struct AssetFile asset;
@@ -83,14 +86,28 @@ typedef struct {
 }
 FileChunk;
 
+// Encoded buffers hold the data size (uint32_t) followed by the file data
+// at ENCODED_HEADER bytes.
+#define ENCODED_HEADER  8
+#define ENCODED_SIZE(buf)   *((const uint32_t*) (buf)->sample.ptr)
+
+// Encoded buffer data read by a stream decoder.
+typedef struct {
+    const uint8_t* data;        // NULL when not in use.
+    const FaunBuffer* buf;      // Buffer which holds data.
+    uint32_t size;
+    uint32_t pos;
+}
+MemChunk;
+
 typedef struct {
     uint8_t  op;
     uint8_t  select;
     uint16_t ext;
     union {
-        uint16_t u16[8];
-        uint32_t u32[4];
-        float f[4];
+        uint16_t u16[10];
+        uint32_t u32[5];
+        float f[5];
     } arg;
 }
 CommandA;
@@ -113,10 +130,12 @@ enum FaunCmd {
     CMD_PROGRAM_BEG,
     CMD_SET_BUFFER,
     CMD_BUFFERS_FREE,
+    CMD_ARENA_FREE,
     CMD_PLAY_SOURCE,
     CMD_PLAY_SOURCE_VOL,
     CMD_OPEN_STREAM_SIZE,
     CMD_OPEN_STREAM,
+    CMD_OPEN_STREAM_MEM,
     CMD_PLAY_STREAM_PART,
     CMD_VOLUME_VARY,
 
@@ -129,11 +148,17 @@ enum FaunCmd {
     CMD_PARAM_VOLUME_APPLY,
     CMD_PARAM_FADE_PERIOD,
     CMD_PARAM_END_TIME,
+    CMD_PARAM_BUS,
+    CMD_PARAM_PLAYBACK_RATE,
+    CMD_PARAM_PRIORITY,
+
+    CMD_BUS_VOLUME,
+    CMD_BUS_CONTROL,
 
     CMD_COUNT
 };
 
-#define MSG_SIZE    20
+#define MSG_SIZE    24
 #define PROG_CHEAD  3
 
 typedef struct {
@@ -153,7 +178,7 @@ enum SourceState {
 };
 
 #define NUL_PLAY_ID     0
-#define QACTIVE_NONE    0xffff
+#define QACTIVE_NONE    0xff
 #define END_POS_NONE    0x7fffffff
 #define SOURCE_QUEUE_SIZE   4
 #define BID_PACKED      0x3ff
@@ -163,13 +188,19 @@ enum SourceState {
 #define PLAY_TARGET_VOL 0x4000
 #define END_AFTER_FADE  0x8000
 
+/*
+  Source state is split into two parallel arrays.  FaunSource holds what the
+  collect, mix & advance phases of audioThread read on every update and is
+  kept within one 64 byte cache line.  SourceParam holds the play parameters
+  and buffer queue which are only touched by commands and buffer switches.
+*/
 typedef struct {
-    uint16_t state;         // SourceState
-    uint16_t bufUsed;       // Number of buffers in queue.
-    uint16_t qtail;         // Queue index of append position.
-    uint16_t qhead;
-    uint16_t qactive;       // Queue index of currently playing buffer.
+    uint8_t  state;         // SourceState
+    uint8_t  qactive;       // Queue index of currently playing buffer.
+    uint8_t  qtail;         // Queue index of append position.
+    uint8_t  bus;           // Submix bus index.
     uint16_t mode;
+    uint16_t playFrac;      // Fraction of a frame past playPos (1/65536).
 
     // These are ordered to match fadeTriplet.
     float    gainL;         // Current volume.
@@ -179,31 +210,85 @@ typedef struct {
     float    targetL;       // Target volume.
     float    targetR;
 
-    float    playVolume;    // FAUN_VOLUME, used when play begins.
-    float    fadePeriod;    // FAUN_FADE_PERIOD
     uint32_t serialNo;
     uint32_t playPos;       // Frame position in current buffer.
     uint32_t framesOut;     // Total frames played.
     uint32_t endPos;        // User specified end frame. FAUN_END_TIME
     uint32_t fadePos;       // Frame to begin fade out.
-    FaunBuffer* bufferQueue[SOURCE_QUEUE_SIZE];
+    uint32_t step;          // Buffer frames per mix frame (16.16 fixed).
+    FaunBuffer* buffer;     // Same as bufferQueue[qactive].
 }
 FaunSource;
 
+typedef struct {
+    float    playVolume;    // FAUN_VOLUME, used when play begins.
+    float    fadePeriod;    // FAUN_FADE_PERIOD
+    float    playRate;      // FAUN_PLAYBACK_RATE
+    uint16_t bufUsed;       // Number of buffers in queue.
+    uint16_t qhead;
+    FaunBuffer* bufferQueue[SOURCE_QUEUE_SIZE];
+}
+SourceParam;
+
+/*
+  Submix buses accumulate the sources routed to them and are then mixed
+  into the main bus (bus 0, the voice buffer) with the bus gain.
+*/
+typedef struct {
+    // These are ordered to match fadeTriplet.
+    float    gainL;
+    float    gainR;
+    float    fadeL;
+    float    fadeR;
+    float    targetL;
+    float    targetR;
+}
+FaunBus;
+
 
-static const uint8_t faun_formatSize[FAUN_FORMAT_COUNT] = { 1, 2, 3, 4 };
+// The size of FAUN_ADPCM is given by adpcm_size().
+static const uint8_t faun_formatSize[FAUN_FORMAT_COUNT] = { 1, 2, 3, 4, 0 };
 static FILE* _errStream;
+static FaunVoice _voice;
+
 
+static FaunSource*  _asource = NULL;
+static SourceParam* _aparam = NULL;
 
-static void faun_sourceInit(FaunSource* src, int si)
+#define SOURCE_PARAM(src)   (_aparam + ((src) - _asource))
+
+#define STEP_UNITY      0x10000
+#define STEP_MAX        (4 * STEP_UNITY)
+#define PLAY_RATE_MIN   0.05f
+#define PLAY_RATE_MAX   4.0f
+
+
+/*
+  Return the number of buffer frames played per mix frame (16.16 fixed
+  point) for a buffer and playback rate.
+*/
+static uint32_t faun_step(const FaunBuffer* buf, float rate)
+{
+    uint32_t step = (uint32_t) ((double) buf->rate * rate * STEP_UNITY /
+                                _voice.mix.rate + 0.5);
+    if (step < 1)
+        return 1;
+    return (step > STEP_MAX) ? STEP_MAX : step;
+}
+
+
+static void faun_sourceInit(FaunSource* src, SourceParam* par, int si)
 {
     memset(src, 0, sizeof(FaunSource));
+    memset(par, 0, sizeof(SourceParam));
     src->qactive = QACTIVE_NONE;
     src->gainL = src->gainR = 1.0f;
     //src->fadeL = src->fadeR = 0.0f;
     src->targetL = src->targetR =
-    src->playVolume = 1.0f;
-    src->fadePeriod = 1.5f;
+    par->playVolume =
+    par->playRate = 1.0f;
+    par->fadePeriod = 1.5f;
+    src->step = STEP_UNITY;
     src->serialNo = si;
     src->endPos =
     src->fadePos = END_POS_NONE;
@@ -212,28 +297,35 @@ static void faun_sourceInit(FaunSource* src, int si)
 
 static void faun_setBuffer(FaunSource* src, FaunBuffer* buf)
 {
-    src->bufUsed = src->qtail = 1;
-    src->qhead = src->qactive = 0;
-    src->bufferQueue[0] = buf;
+    SourceParam* par = SOURCE_PARAM(src);
+    par->bufUsed = src->qtail = 1;
+    par->qhead = src->qactive = 0;
+    par->bufferQueue[0] = src->buffer = buf;
+    src->step = faun_step(buf, par->playRate);
 }
 
 
 static void faun_sourceResetQueue(FaunSource* src)
 {
-    src->bufUsed = src->qtail = src->qhead = 0;
+    SourceParam* par = SOURCE_PARAM(src);
+    par->bufUsed = src->qtail = par->qhead = 0;
     src->qactive = QACTIVE_NONE;
 }
 
 
 static void faun_queueBuffer(FaunSource* src, FaunBuffer* buf)
 {
+    SourceParam* par = SOURCE_PARAM(src);
     int i;
-    if (src->bufUsed < SOURCE_QUEUE_SIZE) {
-        src->bufUsed++;
+    if (par->bufUsed < SOURCE_QUEUE_SIZE) {
+        par->bufUsed++;
         i = src->qtail;
-        src->bufferQueue[i] = buf;
-        if (src->qactive == QACTIVE_NONE)
+        par->bufferQueue[i] = buf;
+        if (src->qactive == QACTIVE_NONE) {
             src->qactive = i;
+            src->buffer = buf;
+            src->step = faun_step(buf, par->playRate);
+        }
         if (++i == SOURCE_QUEUE_SIZE)
             i = 0;
         src->qtail = i;
@@ -249,15 +341,16 @@ static void faun_queueBuffer(FaunSource* src, FaunBuffer* buf)
  */
 static FaunBuffer* faun_processedBuffer(FaunSource* src)
 {
+    SourceParam* par = SOURCE_PARAM(src);
     FaunBuffer* ptr;
     int i;
-    if (src->bufUsed && src->qactive != src->qhead) {
-        i = src->qhead;
-        ptr = src->bufferQueue[i];
+    if (par->bufUsed && src->qactive != par->qhead) {
+        i = par->qhead;
+        ptr = par->bufferQueue[i];
         if (++i == SOURCE_QUEUE_SIZE)
             i = 0;
-        src->qhead = i;
-        src->bufUsed--;
+        par->qhead = i;
+        par->bufUsed--;
         return ptr;
     }
     return NULL;
@@ -267,26 +360,47 @@ static FaunBuffer* faun_processedBuffer(FaunSource* src)
 void faun_reserve(FaunBuffer* buf, int frames)
 {
     if (buf->avail < (uint32_t) frames) {
-        buf->sample.ptr = realloc(buf->sample.ptr,
-                                  frames * faun_formatSize[buf->format] *
-                                           faun_channelCount(buf->chanLayout));
-        buf->avail = frames;
+        void* mem = sample_realloc(buf->sample.ptr,
+                                   frames * faun_formatSize[buf->format] *
+                                         faun_channelCount(buf->chanLayout));
+        if (mem) {
+            buf->sample.ptr = mem;
+            buf->avail = frames;
+        }
     }
 }
 
 
-static void faun_allocBufferSamples(FaunBuffer* buf, int fmt, int chan,
-                                    int rate, int frames)
+/*
+  Set the voice mix rate and size the mix buffer for one update.
+  This is used by sysaudio_allocVoice() when voice->mix.rate is zero.
+*/
+void faun_setMixRate(FaunVoice* voice, int rate)
+{
+    int frames = rate / voice->updateHz;
+    voice->mix.rate = rate;
+    faun_reserve(&voice->mix, frames);
+    voice->mix.used = frames;
+}
+
+
+/*
+  Return zero if memory could not be allocated, in which case the buffer
+  has no samples.
+*/
+static int faun_allocBufferSamples(FaunBuffer* buf, int fmt, int chan,
+                                   int rate, int frames)
 {
-    free(buf->sample.ptr);
-    buf->sample.ptr = malloc(frames * faun_formatSize[fmt] *
-                                      faun_channelCount(chan));
-    buf->avail = frames;
+    sample_free(buf->sample.ptr);
+    buf->sample.ptr = sample_alloc(frames * faun_formatSize[fmt] *
+                                            faun_channelCount(chan));
+    buf->avail = buf->sample.ptr ? frames : 0;
     buf->used  = 0;
 
     buf->rate = rate;
     buf->format = fmt;
     buf->chanLayout = chan;
+    return buf->sample.ptr != NULL;
 }
 
 
@@ -294,30 +408,487 @@ static void faun_freeBufferSamples(int n, FaunBuffer* buf)
 {
     int i;
     for (i = 0; i < n; ++i) {
-        free(buf->sample.ptr);
+        sample_free(buf->sample.ptr);
         buf->sample.ptr = NULL;
         ++buf;
     }
 }
 
 
+//----------------------------------------------------------------------------
+
+#define SIMUL_MIX
+
+#ifdef SIMUL_MIX
+static void _mix1Stereo(float* restrict output, float* end,
+                        const float** input,
+                        const float* gainL, const float* gainR, int init)
+{
+    const float* restrict in0 = input[0];
+    const float gL = gainL[0];
+    const float gR = gainR[0];
+    if (init) {
+        while (output != end) {
+            *output++ = *in0++ * gL;
+            *output++ = *in0++ * gR;
+        }
+    } else {
+        while (output != end) {
+            *output += *in0++ * gL;
+            output++;
+            *output += *in0++ * gR;
+            output++;
+        }
+    }
+}
+
+static void _mix2Stereo(float* restrict output, float* end,
+                        const float** input,
+                        const float* gainL, const float* gainR, int init)
+{
+    const float* restrict in0 = input[0];
+    const float* restrict in1 = input[1];
+    if (init) {
+        while (output != end) {
+            *output++ = (*in0++ * gainL[0]) + (*in1++ * gainL[1]);
+            *output++ = (*in0++ * gainR[0]) + (*in1++ * gainR[1]);
+        }
+    } else {
+        while (output != end) {
+            *output += (*in0++ * gainL[0]) + (*in1++ * gainL[1]);
+            output++;
+            *output += (*in0++ * gainR[0]) + (*in1++ * gainR[1]);
+            output++;
+        }
+    }
+}
+
+static void _mix4Stereo(float* restrict output, float* end,
+                        const float** input,
+                        const float* gainL, const float* gainR, int init)
+{
+    const float* restrict in0 = input[0];
+    const float* restrict in1 = input[1];
+    const float* restrict in2 = input[2];
+    const float* restrict in3 = input[3];
+    if (init) {
+        while (output != end) {
+            *output++ = (*in0++ * gainL[0]) + (*in1++ * gainL[1]) +
+                        (*in2++ * gainL[2]) + (*in3++ * gainL[3]);
+            *output++ = (*in0++ * gainR[0]) + (*in1++ * gainR[1]) +
+                        (*in2++ * gainR[2]) + (*in3++ * gainR[3]);
+        }
+    } else {
+        while (output != end) {
+            *output += (*in0++ * gainL[0]) + (*in1++ * gainL[1]) +
+                       (*in2++ * gainL[2]) + (*in3++ * gainL[3]);
+            output++;
+            *output += (*in0++ * gainR[0]) + (*in1++ * gainR[1]) +
+                       (*in2++ * gainR[2]) + (*in3++ * gainR[3]);
+            output++;
+        }
+    }
+}
+
+/*
+  Mix eight inputs in one pass.  The sums of each group of four are added
+  separately so the result is the same as two _mix4Stereo passes.
+*/
+static void _mix8Stereo(float* restrict output, float* end,
+                        const float** input,
+                        const float* gainL, const float* gainR, int init)
+{
+    const float* restrict in0 = input[0];
+    const float* restrict in1 = input[1];
+    const float* restrict in2 = input[2];
+    const float* restrict in3 = input[3];
+    const float* restrict in4 = input[4];
+    const float* restrict in5 = input[5];
+    const float* restrict in6 = input[6];
+    const float* restrict in7 = input[7];
+    float sumA, sumB;
+    int chan;
+
+    while (output != end) {
+        for (chan = 0; chan < 2; ++chan) {
+            const float* gain = chan ? gainR : gainL;
+            sumA = (*in0++ * gain[0]) + (*in1++ * gain[1]) +
+                   (*in2++ * gain[2]) + (*in3++ * gain[3]);
+            sumB = (*in4++ * gain[4]) + (*in5++ * gain[5]) +
+                   (*in6++ * gain[6]) + (*in7++ * gain[7]);
+            if (! init)
+                sumA = *output + sumA;
+            *output++ = sumA + sumB;
+        }
+    }
+}
+
+/*
+  Mix a stereo input with a gain for each sample.
+*/
+static void _mixRampStereo(float* restrict output, float* end,
+                           const float* restrict input,
+                           const float* restrict ramp)
+{
+    while (output != end)
+        *output++ += *input++ * *ramp++;
+}
+
+/*
+  Mix a mono input into stereo output, panned by the left & right gains.
+*/
+static void _mixMonoStereo(float* restrict output, float* end,
+                           const float* restrict input,
+                           float gainL, float gainR, int init)
+{
+    if (init) {
+        for (; output != end; output += 2, ++input) {
+            output[0] = *input * gainL;
+            output[1] = *input * gainR;
+        }
+    } else {
+        for (; output != end; output += 2, ++input) {
+            output[0] += *input * gainL;
+            output[1] += *input * gainR;
+        }
+    }
+}
+
+/*
+  Linearly interpolate stereo frames at a fixed step to change the rate.
+
+  \param frames  Number of output frames.
+  \param in      Input frames.  The frame after the last one stepped to is
+                 also read.
+  \param frac    Position between the first two input frames (1/65536).
+  \param step    Input frames per output frame (16.16 fixed).
+*/
+static void _interpStereo(float* restrict out, uint32_t frames,
+                          const float* restrict in, uint32_t frac,
+                          uint32_t step)
+{
+    float* end = out + frames*2;
+    float t;
+
+    for (; out != end; out += 2) {
+        t = (float) frac * (1.0f / 65536.0f);
+        out[0] = in[0] + (in[2] - in[0]) * t;
+        out[1] = in[1] + (in[3] - in[1]) * t;
+        frac += step;
+        in += (frac >> 16) * 2;
+        frac &= 0xffff;
+    }
+}
+
+#define DITHER_LANES    4
+
+#ifdef FAUN_FIXED
+// Convert a gain (0.0 - 1.0) to Q15.
+#define GAIN_Q15(g)     ((int32_t) ((g) * 32768.0f + 0.5f))
+
+// Apply a Q15 gain to a sample.  The product is 64-bit as source gains
+// can be above 2.0, which would overflow 32 bits.
+#define MUL_Q15(s,g)    ((int32_t) (((int64_t) (s) * (g)) >> 15))
+
+/*
+  Mix one input with a per-sample gain ramp into 32-bit accumulators.
+  Only fading sources use this, so the per-sample gain conversion does not
+  cost anything while nothing is fading.
+*/
+static void _mixRampFixed(int32_t* restrict output, int32_t* end,
+                          const int16_t* restrict input,
+                          const float* restrict ramp)
+{
+    while (output != end)
+        *output++ += MUL_Q15(*input++, GAIN_Q15(*ramp++));
+}
+
+static void _interpFixed(int16_t* restrict out, uint32_t frames,
+                         const int16_t* restrict in, uint32_t frac,
+                         uint32_t step)
+{
+    int16_t* end = out + frames*2;
+    int32_t t;
+
+    for (; out != end; out += 2) {
+        t = (int32_t) (frac >> 1);
+        out[0] = in[0] + (((in[2] - in[0]) * t) >> 15);
+        out[1] = in[1] + (((in[3] - in[1]) * t) >> 15);
+        frac += step;
+        in += (frac >> 16) * 2;
+        frac &= 0xffff;
+    }
+}
+
+#define MIX_RAMP    _mixRampFixed
+#define MIX_INTERP  _interpFixed
+#else
+#define MIX_RAMP    _mixk.ramp
+#define MIX_INTERP  _mixk.interp
+#endif
+
+/*
+  Convert samples to 16-bit with clipping and TPDF dither.
+
+  The dither is the sum of the two 16-bit halves of a xorshift value.
+  Consecutive samples use one of DITHER_LANES generators in turn so that
+  the SIMD versions produce the same output.
+*/
+static void _outputS16(int16_t* dst, const float* src, uint32_t count,
+                       uint32_t* seed)
+{
+    const float* end = src + count;
+    uint32_t x;
+    float v;
+    int lane = 0;
+
+    while (src != end) {
+        x = seed[lane];
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        seed[lane] = x;
+        lane = (lane + 1) & (DITHER_LANES - 1);
+
+        v = (*src++ * 32767.0f) +
+            ((float) ((int) (x & 0xffff) + (int) (x >> 16) - 65535) *
+             (1.0f / 65536.0f));
+        if (v > 32767.0f)
+            v = 32767.0f;
+        else if (v < -32768.0f)
+            v = -32768.0f;
+        *dst++ = (int16_t) lrintf(v);
+    }
+}
+
+/*
+  Convert 16-bit samples to float.
+*/
+static void _unpackS16(float* dst, const int16_t* src, uint32_t count)
+{
+    const int16_t* end = src + count;
+    while (src != end)
+        *dst++ = *src++ * (1.0f / 32767.0f);
+}
+
+/*
+  Convert 16-bit samples to float for the loaders.  This divides rather
+  than multiplying by the reciprocal as _unpackS16 does, which is what the
+  loaders have always done.
+*/
+static void _convS16(float* dst, const int16_t* src, uint32_t count)
+{
+    const int16_t* end = src + count;
+    while (src != end)
+        *dst++ = *src++ / 32767.0f;
+}
+
+/*
+  Convert 32-bit integer samples from a decoder to float.  The samples have
+  shift more bits of precision than 16-bit ones and none of these are
+  discarded.  For 16-bit samples the result is the same as _convS16().
+*/
+#define CONV_S32_SCALE(shift)   (32767.0f * (float) (1 << (shift)))
+
+static void _convS32(float* dst, const int32_t* src, uint32_t count,
+                     int shift)
+{
+    const int32_t* end = src + count;
+    const float scale = CONV_S32_SCALE(shift);
+    while (src != end)
+        *dst++ = (float) *src++ / scale;
+}
+
+/*
+  Interleave two channels.  Mono input is made stereo by passing the same
+  channel as both l & r.
+*/
+static void _interleave(float* dst, const float* l, const float* r,
+                        uint32_t frames)
+{
+    const float* end = l + frames;
+    while (l != end) {
+        *dst++ = *l++;
+        *dst++ = *r++;
+    }
+}
+
+/*
+  Interleave two channels of 32-bit integer samples, converting them as
+  _convS32() does.
+*/
+static void _interleaveS32(float* dst, const int32_t* l, const int32_t* r,
+                           uint32_t frames, int shift)
+{
+    const int32_t* end = l + frames;
+    const float scale = CONV_S32_SCALE(shift);
+    while (l != end) {
+        *dst++ = (float) *l++ / scale;
+        *dst++ = (float) *r++ / scale;
+    }
+}
+
+/*
+  Return the largest absolute sample value.
+*/
+static float _peak(const float* src, uint32_t count)
+{
+    const float* end = src + count;
+    float a, peak = 0.0f;
+    while (src != end) {
+        a = fabsf(*src++);
+        if (a > peak)
+            peak = a;
+    }
+    return peak;
+}
+
+/*
+  Set the gain needed to keep each stereo frame within the threshold.
+  The gain is stored for both samples of the frame.
+*/
+static void _limitGain(float* gain, const float* src, uint32_t count,
+                       float threshold)
+{
+    const float* end = src + count;
+    float a, b;
+    while (src != end) {
+        a = fabsf(src[0]);
+        b = fabsf(src[1]);
+        src += 2;
+        if (b > a)
+            a = b;
+        a = (a > threshold) ? threshold / a : 1.0f;
+        gain[0] = gain[1] = a;
+        gain += 2;
+    }
+}
+
+/*
+  Compute one stereo frame of a FIR filter.  Each coefficient is stored
+  twice to match the interleaved input.  Eight sums are kept so that the
+  SIMD versions produce the same results when taps is a multiple of 4.
+
+  \param taps  Number of input frames.
+*/
+static void _firStereo(float* out, const float* in, const float* coef,
+                       uint32_t taps)
+{
+    const float* end = in + (taps & ~3)*2;
+    float s[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    int i;
+
+    for (; in != end; in += 8, coef += 8) {
+        for (i = 0; i < 8; ++i)
+            s[i] += in[i] * coef[i];
+    }
+    for (end += (taps & 3)*2; in != end; in += 2, coef += 2) {
+        s[0] += in[0] * coef[0];
+        s[1] += in[1] * coef[1];
+    }
+    out[0] = (s[0] + s[4]) + (s[2] + s[6]);
+    out[1] = (s[1] + s[5]) + (s[3] + s[7]);
+}
+
+#include "mix_simd.c"
+#ifndef FAUN_FIXED
+#include "limiter.c"
+#endif
+#endif
+
+#include "resample.c"
+
 #define STREAM_BUFFERS  4
 #define SEGMENT_SET(st) st->sampleLimit
+#define RESAMPLE_CHUNK  1024
+
+// WAVE sample data read by a stream decoder.
+typedef struct {
+    uint32_t dataPos;       // Offset of sample data from the stream start.
+    uint32_t dataSize;
+    uint32_t pos;           // Bytes of sample data read.
+    uint16_t format;
+    uint16_t channels;
+    uint16_t frameSize;
+}
+WavStream;
+
+typedef struct StreamDecoder StreamDecoder;
+typedef struct FlacStream FlacStream;
+
+/*
+  Lock-free ring of stream buffers with a single producer & consumer.
+  The indices run freely and are masked when used.
+*/
+typedef struct {
+    _Atomic uint32_t head;      // Advanced by the consumer.
+    _Atomic uint32_t tail;      // Advanced by the producer.
+    FaunBuffer* buf[STREAM_BUFFERS];
+}
+BufferRing;
 
+/*
+  A stream is decoded by streamThread.  Buffers it has filled are passed
+  to the audio thread through the filled ring and are returned through
+  the played ring once they have been mixed.  The audio thread leaves the
+  rings alone until the StreamOps it has posted for the stream have been
+  run (see stream_post()).  Other than the rings & the atomic members, the
+  decoder state is only touched by streamThread.
+*/
 typedef struct {
     FaunBuffer  buffers[STREAM_BUFFERS];
-    int         bufAvail;
+    BufferRing  filled;         // Decoded buffers for the audio thread.
+    BufferRing  played;         // Mixed buffers for streamThread.
+    _Atomic int ended;          // Set after the last buffer is filled.
+    _Atomic int priority;       // FAUN_PRIORITY
+    _Atomic uint32_t mixFrames; // Frames played, set by the audio thread.
+    uint32_t    fillFrames;     // Frames passed to the audio thread.
     int16_t     feed;
     int16_t     sindex;
+    int16_t     loop;           // FAUN_PLAY_LOOP when started.
+    int16_t     startPending;   // Source begins play once opWait is run.
+    uint32_t    opWait;         // Op count when the last op was posted.
+    const FaunBuffer* memBuf;   // Encoded buffer of the last play op posted.
+    int         started;        // Set by an op if the source can play.
+    uint32_t    fadeFrames;     // Fade out length given by the op.
     double      start;
     uint32_t    sampleCount;    // Number of samples read
     uint32_t    sampleLimit;    // Number of samples to buffer before ending
     FileChunk   chunk;
-    OggVorbis_File vf;
-    vorbis_info* vinfo;
+    MemChunk    mem;
+    const StreamDecoder* dec;   // Open decoder or NULL.
+    uint32_t    rate;           // Decoded sample rate & channel count.
+    int         channels;
+    union {
+        OggVorbis_File vf;
+        WavStream   wav;
+        FlacStream* flac;
+    } in;
+    float*      rsBuf;          // RESAMPLE_CHUNK frames of decoded input.
+    Resampler   rs;
 }
 StreamOV;
 
+/*
+  Stream decoder methods.  The decoder reads st->chunk, or st->mem if
+  st->mem.data is set.
+*/
+struct StreamDecoder {
+    // Begin decoding at the stream start and set st->rate & st->channels.
+    // Return error message or NULL if successful.
+    const char* (*open)(StreamOV* st);
+
+    // Decode up to frames into dst as interleaved samples of chan channels.
+    // Chan is either 2 or st->channels.  Return the number of frames
+    // decoded, zero at the end of the stream, or a negative error code.
+    long (*read)(StreamOV* st, float* dst, int frames, int chan);
+
+    void (*seek)(StreamOV* st, double sec);
+    void (*rewind)(StreamOV* st);
+    uint64_t (*pcmTotal)(StreamOV* st);
+    void (*close)(StreamOV* st);
+};
+
 
 enum AudioState
 {
@@ -326,7 +897,7 @@ enum AudioState
     AUDIO_THREAD_UP
 };
 
-enum ReadOggStatus {
+enum StreamReadStatus {
     RSTAT_ERROR = 1,
     RSTAT_EOF   = 2,
     RSTAT_DATA  = 4
@@ -334,7 +905,7 @@ enum ReadOggStatus {
 
 #define BUFFER_MAX  256
 #define SOURCE_MAX  32
-#define STREAM_MAX  6
+#define STREAM_MAX  16
 #define PEXEC_MAX   16
 
 static int _audioUp = AUDIO_DOWN;
@@ -343,21 +914,106 @@ static int _sourceLimit;
 static int _streamLimit;
 static int _pexecLimit;
 static uint32_t _playSerialNo;
-static FaunVoice   _voice;
 static FaunBuffer* _abuffer = NULL;
-static FaunSource* _asource = NULL;
 static StreamOV*  _stream = NULL;
 static FaunProgram* _pexec = NULL;
+static FaunBus _bus[FAUN_BUS_MAX];
 static _Atomic uint32_t* _playbackId = NULL;
 static atomic_flag _pidLock;
+static uint16_t _limitPercent = 0;
+static uint32_t _mixRate = 0;
+
+#ifdef FAUN_FIXED
+// Buffers hold 16-bit samples which are mixed using Q15 gains into 32-bit
+// accumulators.  This avoids floating point math in the mixer for targets
+// with a slow (or no) FPU.
+typedef int16_t FaunSample;
+typedef int32_t MixSample;
+#define FAUN_MIX_FORMAT FAUN_S16
+#define BUFFER_PACKED(buf)  ((buf)->format == FAUN_ADPCM)
+static uint16_t _outFormat = FAUN_S16;
+#else
+typedef float FaunSample;
+typedef float MixSample;
+#define FAUN_MIX_FORMAT FAUN_F32
+#define BUFFER_PACKED(buf)  ((buf)->format == FAUN_S16 || \
+                             (buf)->format == FAUN_ADPCM)
+static uint16_t _outFormat = FAUN_F32;
+#endif
 
-//----------------------------------------------------------------------------
+// Format in which loaded buffers are stored.  Packed buffers are unpacked
+// to FaunSample by source_span() as they are mixed.
+static uint16_t _bufFormat = FAUN_MIX_FORMAT;
 
-#include "wav_read.c"
+// Number of faun_loadBufferAsync() workers (FAUN_LOAD_THREADS).
+#define LOAD_THREAD_MAX 16
+static int _loadThreads = 0;
+static void load_stopThreads(void);
 
-static void _allocBufferVoice(FaunBuffer*, int);
+// Microseconds of stream decoding per update (FAUN_STREAM_BUDGET).
+static atomic_int _streamBudget = 0;
+static int limitU(int, int);
 
-#ifdef USE_FLAC
+#define STREAM_PRIORITY_MAX 255
+#define STREAM_URGENT       (STREAM_PRIORITY_MAX + 1)
+
+//----------------------------------------------------------------------------
+
+// Range of sample rates accepted by the loaders.
+#define LOAD_RATE_MIN   4000
+#define LOAD_RATE_MAX   192000
+
+#include "adpcm.c"
+#include "bank.c"
+
+/*
+  Convert float samples to 16-bit in place, with rounding and clipping.
+  The scale matches that used by convS16_F32() so 16-bit sources are
+  restored exactly.
+*/
+static void faun_storeS16(void* samples, uint32_t count)
+{
+    const float* src = (const float*) samples;
+    const float* end = src + count;
+    int16_t* dst = (int16_t*) samples;
+    float v;
+
+    while (src != end) {
+        v = *src++ * 32767.0f;
+        if (v > 32767.0f)
+            v = 32767.0f;
+        else if (v < -32768.0f)
+            v = -32768.0f;
+        *dst++ = (int16_t) lrintf(v);
+    }
+}
+
+#ifdef FAUN_FIXED
+/*
+  Saturate 32-bit mix accumulators to 16-bit samples.
+  The dst & src may be the same memory.
+*/
+static void faun_saturateS16(int16_t* dst, const int32_t* src, uint32_t count)
+{
+    const int32_t* end = src + count;
+    int32_t v;
+
+    while (src != end) {
+        v = *src++;
+        if (v > 32767)
+            v = 32767;
+        else if (v < -32768)
+            v = -32768;
+        *dst++ = (int16_t) v;
+    }
+}
+#endif
+
+#include "wav_read.c"
+
+static int _allocBufferLoad(FaunBuffer*, int, int, int);
+
+#ifdef USE_FLAC
 #include "FlacReader.c"
 #endif
 
@@ -371,32 +1027,44 @@ static void _allocBufferVoice(FaunBuffer*, int);
 #define well512_genU32  faun_random
 #include "well512.c"
 
-Well512 _rng;
+// Each faun_generateSfx call uses its own generator state so that load
+// threads can synthesize concurrently.
+static _Thread_local Well512* _rng;
 
 int sfx_random(int range) {
-    return faun_random(&_rng) % range;
+    return faun_random(_rng) % range;
 }
 
-static void convertMono(float*, float*, float**);
-
-static void faun_generateSfx(FaunBuffer* buf, const SfxParams* sp)
+/*
+  Return error message or NULL if successful.
+*/
+static const char* faun_generateSfx(FaunBuffer* buf, const SfxParams* sp)
 {
-    SfxSynth* synth;
-    float* dst;
-    float* src;
+    SfxSynth synth;
+    Well512 rng;
     uint32_t frames;
 
-    synth = sfx_allocSynth(SFX_F32, 44100, 6);
-    faun_randomSeed(&_rng, sp->randSeed);
-    frames = sfx_generateWave(synth, sp);
-
-    _allocBufferVoice(buf, frames);
-    dst = buf->sample.f32;
-    src = synth->samples.f;
-    convertMono(dst, dst + frames*2, &src);
-    buf->used = frames;
+    // The synth is set up here (rather than by sfx_allocSynth) so that the
+    // wave memory comes from the Faun allocator.
+    synth.sampleFormat = SFX_F32;
+    synth.sampleRate   = 44100;
+    synth.maxDuration  = 6;
+    synth.samples.f    = (float*) mem_alloc(44100 * 6 * sizeof(float));
+    if (! synth.samples.f)
+        return "No memory for rFX synth";
+
+    faun_randomSeed(&rng, sp->randSeed);
+    _rng = &rng;
+    frames = sfx_generateWave(&synth, sp);
+    _rng = NULL;
+
+    if (_allocBufferLoad(buf, FAUN_CHAN_1, 44100, frames)) {
+        memcpy(buf->sample.f32, synth.samples.f, frames * sizeof(float));
+        buf->used = frames;
+    }
 
-    free(synth);
+    mem_free(synth.samples.f);
+    return buf->sample.ptr ? NULL : "No memory for rFX samples";
 }
 #endif
 
@@ -452,111 +1120,314 @@ static ov_callbacks chunkMethodsNoClose = {
     chunk_fread, chunk_fseek, NULL, chunk_ftell
 };
 
-static int _readOgg(StreamOV* st, FaunBuffer* buffer);
+static size_t mem_fread(void* buf, size_t size, size_t nmemb, void* fh)
+{
+    MemChunk* mc = (MemChunk*) fh;
+    size_t avail = mc->size - mc->pos;
+    size_t n = size * nmemb;
+
+    if (! size)
+        return 0;
+    if (n > avail)
+        n = avail - (avail % size);
+    memcpy(buf, mc->data + mc->pos, n);
+    mc->pos += n;
+    return n / size;
+}
+
+static int mem_fseek(void* fh, ogg_int64_t offset, int whence)
+{
+    MemChunk* mc = (MemChunk*) fh;
+    if (whence == SEEK_CUR)
+        offset += mc->pos;
+    else if (whence == SEEK_END)
+        offset += mc->size;
+    if (offset < 0 || offset > mc->size)
+        return -1;
+    mc->pos = (uint32_t) offset;
+    return 0;
+}
+
+static long mem_ftell(void* fh)
+{
+    return ((MemChunk*) fh)->pos;
+}
+
+static ov_callbacks memMethods = {
+    mem_fread, mem_fseek, NULL, mem_ftell
+};
+
+static const StreamDecoder streamVorbis;
+static int stream_read(StreamOV* st, FaunBuffer* buffer);
 
 //----------------------------------------------------------------------------
 
-// Allocate a buffer with attributes that match the voice mixing buffer.
-static void _allocBufferVoice(FaunBuffer* buf, int frames)
+// Allocate a float buffer for the loaders at the source rate.  Mono
+// sources are kept as one channel and any others are reduced to stereo.
+// Samples above the mix rate are converted to it by _cmdSetBuffer().
+// Return zero if memory could not be allocated.
+static int _allocBufferLoad(FaunBuffer* buf, int channels, int rate,
+                            int frames)
+{
+    return faun_allocBufferSamples(buf, FAUN_F32,
+                                (channels == 1) ? FAUN_CHAN_1 : FAUN_CHAN_2,
+                                rate, frames);
+}
+
+/*
+  Convert buffer samples to another rate.  The buffer is left unchanged
+  if this fails.
+
+  Return zero if memory could not be allocated.
+*/
+static int faun_convertRate(FaunBuffer* buf, int rate)
 {
-    faun_allocBufferSamples(buf, FAUN_F32, FAUN_CHAN_2, _voice.mix.rate,
-                            frames);
+    FaunBuffer out;
+    Resampler rs;
+    float* in = buf->sample.f32;
+    float* it;
+    float* end;
+    uint32_t n;
+    int mono = (buf->chanLayout == FAUN_CHAN_1);
+
+    if (! resample_init(&rs, buf->rate, rate))
+        return 0;
+
+    // The resampler is stereo so mono samples are duplicated for it.
+    if (mono) {
+        in = (float*) mem_alloc(buf->used * 2 * sizeof(float));
+        if (! in)
+            goto fail;
+        end = buf->sample.f32 + buf->used;
+        for (it = buf->sample.f32, n = 0; it != end; ++it, n += 2)
+            in[n] = in[n+1] = *it;
+    }
+
+    out.sample.ptr = NULL;
+    faun_allocBufferSamples(&out, FAUN_F32, FAUN_CHAN_2, rate,
+                            resample_outputLimit(&rs, buf->used));
+    if (! out.sample.ptr) {
+        if (mono)
+            mem_free(in);
+        goto fail;
+    }
+    n = resample_run(&rs, out.sample.f32, in, buf->used);
+    n += resample_flush(&rs, out.sample.f32 + n*2);
+    out.used = n;
+    resample_free(&rs);
+
+    if (mono) {
+        mem_free(in);
+        out.chanLayout = FAUN_CHAN_1;
+        end = out.sample.f32 + n*2;
+        for (it = in = out.sample.f32; it != end; it += 2)
+            *in++ = *it;
+    }
+
+    sample_free(buf->sample.ptr);
+    *buf = out;
+    return 1;
+
+fail:
+    resample_free(&rs);
+    return 0;
 }
 
-static void convS16_F32(float* dst, const int16_t* src, int frames, int rate,
+/*
+  Convert samples to the buffer format of _allocBufferLoad().
+*/
+static void convS16_F32(float* dst, const int16_t* src, int frames,
                         int channels)
 {
     const int16_t* end = src + frames * channels;
-    float ls, rs;
-
-    if (channels == 1) {
-        if (rate == 22050) {
-            for (; src != end; ++src) {
-                ls = *src / 32767.0f;
-                *dst++ = ls;
-                *dst++ = ls;
-                *dst++ = ls;
-                *dst++ = ls;
-            }
-        } else {
-            for (; src != end; ++src) {
-                ls = *src / 32767.0f;
-                *dst++ = ls;
-                *dst++ = ls;
-            }
-        }
-    } else if (channels >= 2) {
-        if (rate == 22050) {
-            for (; src != end; src += channels) {
-                ls = src[0] / 32767.0f;
-                rs = src[1] / 32767.0f;
-                *dst++ = ls;
-                *dst++ = rs;
-                *dst++ = ls;
-                *dst++ = rs;
-            }
-        } else {
-            for (; src != end; src += channels) {
-                *dst++ = src[0] / 32767.0f;
-                *dst++ = src[1] / 32767.0f;
-            }
+
+    if (channels <= 2) {
+        _mixk.convS16(dst, src, frames * channels);
+    } else {
+        for (; src != end; src += channels) {
+            *dst++ = src[0] / 32767.0f;
+            *dst++ = src[1] / 32767.0f;
         }
     }
 }
 
 #ifdef USE_LOAD_MEM
-static void convF32_F32(float* dst, const float* src, int frames, int rate,
+static void convF32_F32(float* dst, const float* src, int frames,
                         int channels)
 {
     const float* end = src + frames * channels;
-    float ls, rs;
-
-    if (channels == 1) {
-        if (rate == 22050) {
-            for (; src != end; ++src) {
-                ls = *src;
-                *dst++ = ls;
-                *dst++ = ls;
-                *dst++ = ls;
-                *dst++ = ls;
-            }
-        } else {
-            for (; src != end; ++src) {
-                ls = *src;
-                *dst++ = ls;
-                *dst++ = ls;
-            }
-        }
-    } else if (channels >= 2) {
-        if (rate == 22050) {
-            for (; src != end; src += channels) {
-                ls = src[0];
-                rs = src[1];
-                *dst++ = ls;
-                *dst++ = rs;
-                *dst++ = ls;
-                *dst++ = rs;
-            }
-        } else {
-            for (; src != end; src += channels) {
-                *dst++ = src[0];
-                *dst++ = src[1];
-            }
+
+    if (channels <= 2) {
+        memcpy(dst, src, frames * channels * sizeof(float));
+    } else {
+        for (; src != end; src += channels) {
+            *dst++ = src[0];
+            *dst++ = src[1];
         }
     }
 }
 #endif
 
+/*
+  Return error message if the WAVE data cannot be loaded or NULL if it is
+  supported.
+*/
+static const char* wav_checkFormat(const WavHeader* wh)
+{
+    if (wh->sampleRate < LOAD_RATE_MIN || wh->sampleRate > LOAD_RATE_MAX)
+        return "WAVE sample rate is unsupported";
+#ifdef USE_LOAD_MEM
+    if (wh->format == WAV_IEEE_FLOAT) {
+        if (wh->bitsPerSample != 32)
+            return "WAVE float bits per sample is not 32";
+    } else
+#endif
+    if (wh->bitsPerSample != 16)
+        return "WAVE bits per sample is not 16";
+    return NULL;
+}
+
+/*
+  Convert frames of WAVE sample data (which must be suitably aligned) to
+  the buffer format of _allocBufferLoad().
+*/
+static void wav_convertFrames(float* dst, int format, int channels,
+                              const void* data, uint32_t frames)
+{
+#ifdef USE_LOAD_MEM
+    if (format == WAV_IEEE_FLOAT)
+        convF32_F32(dst, (const float*) data, frames, channels);
+    else
+#else
+    (void) format;
+#endif
+        convS16_F32(dst, (const int16_t*) data, frames, channels);
+}
+
+#define WAV_READ_CHUNK  16384
+
+/*
+  Read WAVE sample data from a file into the buffer.  The data is read &
+  converted in chunks of whole frames rather than through a temporary copy
+  of all of it.
+
+  Return error message or NULL if successful.
+*/
+static const char* wav_readSamples(FaunBuffer* buf, const WavHeader* wh,
+                                   FILE* fp)
+{
+    uint32_t chunk[WAV_READ_CHUNK / sizeof(uint32_t)];
+    uint32_t frameSize = wh->channels * (wh->bitsPerSample / 8);
+    uint32_t frames = wav_sampleCount(wh);
+    uint32_t chunkFrames, n;
+    float* dst;
+    int chan;
+
+    if (! frameSize || frameSize > sizeof(chunk))
+        return "WAVE channel count is unsupported";
+    chunkFrames = sizeof(chunk) / frameSize;
+
+    if (! _allocBufferLoad(buf, wh->channels, wh->sampleRate, frames))
+        return "No memory for WAVE samples";
+    chan = faun_channelCount(buf->chanLayout);
+
+    for (dst = buf->sample.f32; frames; frames -= n) {
+        n = (frames < chunkFrames) ? frames : chunkFrames;
+        if (fread(chunk, frameSize, n, fp) != n)
+            return "WAVE fread failed";
+        wav_convertFrames(dst, wh->format, wh->channels, chunk, n);
+        dst += n * chan;
+    }
+    buf->used = buf->avail;
+    return NULL;
+}
+
+/*
+  Make an encoded buffer from sample memory holding size bytes of Ogg
+  Vorbis data at ENCODED_HEADER.  The data is checked by opening a decoder
+  on it, which also provides the buffer attributes.  The memory is freed
+  if the data cannot be opened.
+
+  Return error message or NULL if successful.
+*/
+static const char* faun_setEncoded(FaunBuffer* buf, uint8_t* mem,
+                                   uint32_t size)
+{
+    OggVorbis_File vf;
+    vorbis_info* vinfo;
+    MemChunk mc;
+
+    *((uint32_t*) mem) = size;
+
+    mc.data = mem + ENCODED_HEADER;
+    mc.size = size;
+    mc.pos  = 0;
+    if (ov_open_callbacks(&mc, &vf, NULL, 0, memMethods) < 0) {
+        sample_free(mem);
+        return "Ogg open failed";
+    }
+    vinfo = ov_info(&vf, -1);
+    if (vinfo->rate < LOAD_RATE_MIN || vinfo->rate > LOAD_RATE_MAX) {
+        ov_clear(&vf);
+        sample_free(mem);
+        return "Ogg sample rate is unsupported";
+    }
+
+    sample_free(buf->sample.ptr);
+    buf->sample.ptr = mem;
+    buf->used = buf->avail = (uint32_t) ov_pcm_total(&vf, -1);
+    buf->rate = vinfo->rate;
+    buf->format = FAUN_VORBIS;
+    buf->chanLayout = (vinfo->channels == 1) ? FAUN_CHAN_1 : FAUN_CHAN_2;
+
+    ov_clear(&vf);
+    return NULL;
+}
+
+/*
+  Read Ogg Vorbis file data into an encoded buffer.
+
+  \param fp    File positioned at the start of the data.
+  \param size  Bytes of data, or zero to read to the file end.
+
+  Return error message or NULL if successful.
+*/
+static const char* faun_readEncoded(FaunBuffer* buf, FILE* fp, uint32_t size)
+{
+    uint8_t* mem;
+    long start = ftell(fp);
+
+    if (! size) {
+        fseek(fp, 0, SEEK_END);
+        size = (uint32_t) (ftell(fp) - start);
+        fseek(fp, start, SEEK_SET);
+    }
+
+    mem = (uint8_t*) sample_alloc(ENCODED_HEADER + size);
+    if (! mem)
+        return "No memory for encoded buffer";
+    if (fread(mem + ENCODED_HEADER, 1, size, fp) != size) {
+        sample_free(mem);
+        return "Ogg fread failed";
+    }
+    return faun_setEncoded(buf, mem, size);
+}
+
+#include "parallel.c"
+
 /*
   Read buffer sample data from a file.
 
   The existing buf->sample data is freed first, so the sample.ptr must
   be valid or NULL.
 
+  \param fmt   Storage format (_bufFormat).  Ogg Vorbis data is kept
+               encoded if this is FAUN_VORBIS.
+
   Return error message or NULL if successful.
 */
 static const char* faun_readBuffer(FaunBuffer* buf, FILE* fp,
-                                   uint32_t offset, uint32_t size)
+                                   uint32_t offset, uint32_t size, int fmt)
 {
     WavHeader wh;
     const char* error = NULL;
@@ -569,78 +1440,71 @@ static const char* faun_readBuffer(FaunBuffer* buf, FILE* fp,
 
     err = wav_readHeader(fp, &wh);
     if (err == 0) {
-        void* readBuf;
-        size_t n;
-        uint32_t wavFrames;
-
         //wav_dumpHeader(stdout, &wh, NULL, "  ");
 
-        if (wh.sampleRate != 44100 && wh.sampleRate != 22050)
-            return "WAVE sample rate is unsupported";
-#ifdef USE_LOAD_MEM
-        if (wh.format == WAV_IEEE_FLOAT) {
-            if (wh.bitsPerSample != 32)
-                return "WAVE float bits per sample is not 32";
-        } else
-#endif
-        if (wh.bitsPerSample != 16)
-            return "WAVE bits per sample is not 16";
-
-        frames = wavFrames = wav_sampleCount(&wh);
-        if (wh.sampleRate == 22050)
-            frames *= 2;
-        _allocBufferVoice(buf, frames);
-
-        readBuf = malloc(wh.dataSize);
-        n = fread(readBuf, 1, wh.dataSize, fp);
-        if (n != wh.dataSize) {
-            error = "WAVE fread failed";
-        } else {
-            buf->used = frames;
-#ifdef USE_LOAD_MEM
-            if (wh.format == WAV_IEEE_FLOAT)
-                convF32_F32(buf->sample.f32, (float*) readBuf, wavFrames,
-                            wh.sampleRate, wh.channels);
-            else
-#endif
-                convS16_F32(buf->sample.f32, (int16_t*) readBuf, wavFrames,
-                            wh.sampleRate, wh.channels);
-        }
-        free(readBuf);
+        error = wav_checkFormat(&wh);
+        if (! error)
+            error = wav_readSamples(buf, &wh, fp);
     }
     else if (err == WAV_ERROR_ID)
     {
-      if (wh.idRIFF == ID_OGGS)
+      if (wh.idRIFF == ID_OGGS && fmt == FAUN_VORBIS)
+      {
+        fseek(fp, -wavReadLen, SEEK_CUR);
+        error = faun_readEncoded(buf, fp, size);
+      }
+      else if (wh.idRIFF == ID_OGGS)
       {
         StreamOV os;
+        vorbis_info* vinfo;
         int status;
+        int rate;
+        int pieces;
+        long start = ftell(fp) - wavReadLen;
 
-        // Minimal version of stream_init() to use _readOgg().
+        // Minimal version of stream_init() to use stream_read().
         os.sampleCount = 0;
+        os.rs.coef = NULL;
+        os.rsBuf = NULL;
 
         os.chunk.cfile  = fp;
         os.chunk.offset = offset;
         os.chunk.size   = size;
 
-        if (ov_open_callbacks(&os.chunk, &os.vf, (char*) &wh, wavReadLen,
+        if (ov_open_callbacks(&os.chunk, &os.in.vf, (char*) &wh, wavReadLen,
                               chunkMethodsNoClose) < 0)
         {
             error = "Ogg open failed";
         }
         else
         {
-            os.vinfo = ov_info(&os.vf, -1);
-            frames = ov_pcm_total(&os.vf, -1);
-            if (os.vinfo->rate == 22050)
-                frames *= 2;
+            vinfo = ov_info(&os.in.vf, -1);
+            frames = ov_pcm_total(&os.in.vf, -1);
+            rate = vinfo->rate;
+            if (rate < LOAD_RATE_MIN || rate > LOAD_RATE_MAX) {
+                ov_clear(&os.in.vf);
+                return "Ogg sample rate is unsupported";
+            }
+            os.dec = &streamVorbis;
+            os.channels = (vinfo->channels > 1) ? 2 : 1;
             //printf("FAUN ogg frame:%d chan:%d rate:%ld\n",
-            //       frames, os.vinfo->channels, os.vinfo->rate);
-            _allocBufferVoice(buf, frames);
-            status = _readOgg(&os, buf);
-            if (status != RSTAT_DATA)
-                error = "Ogg read failed";
+            //       frames, vinfo->channels, vinfo->rate);
+
+            // Decode at the Ogg rate; _cmdSetBuffer() converts it.
+            pieces = split_count(frames);
+            if (! _allocBufferLoad(buf, vinfo->channels, rate, frames)) {
+                ov_clear(&os.in.vf);
+                error = "No memory for Ogg samples";
+            } else if (pieces > 1) {
+                ov_clear(&os.in.vf);
+                error = split_ogg(buf, fp, start, size, pieces);
+            } else {
+                status = stream_read(&os, buf);
+                if (status != RSTAT_DATA)
+                    error = "Ogg read failed";
 
-            ov_clear(&os.vf);
+                ov_clear(&os.in.vf);
+            }
         }
       }
       else if (wh.idRIFF == ID_FLAC)
@@ -648,10 +1512,11 @@ static const char* faun_readBuffer(FaunBuffer* buf, FILE* fp,
 #ifndef USE_FLAC
         error = "Faun built without FLAC support";
 #elif USE_FLAC == 2
-        error = foxenFlacDecode(fp, size, buf, &wh, wavReadLen);
+        if (! split_flac(buf, fp, size, wavReadLen))
+            error = foxenFlacDecode(fp, size, buf, &wh, wavReadLen);
 #else
         fseek(fp, -wavReadLen, SEEK_CUR);
-        error = libFlacDecode(fp, size, buf);
+        error = libFlacDecode(fp, NULL, size, buf);
 #endif
       }
 #ifdef USE_SFX_GEN
@@ -664,7 +1529,7 @@ static const char* faun_readBuffer(FaunBuffer* buf, FILE* fp,
         else {
             fseek(fp, offset + 8, SEEK_SET);
             if (fread(&sfx, 1, sizeof(SfxParams), fp) == sizeof(SfxParams))
-                faun_generateSfx(buf, &sfx);
+                error = faun_generateSfx(buf, &sfx);
             else
                 error = "rFX fread failed";
         }
@@ -673,14 +1538,177 @@ static const char* faun_readBuffer(FaunBuffer* buf, FILE* fp,
     }
 
 #if 0
-    fp = wav_open("/tmp/out.wav", 44100, 16, 2);
-    wav_write(fp, buf->sample.f32, buf->used*2);
+    fp = wav_open("/tmp/out.wav", buf->rate, 16,
+                  faun_channelCount(buf->chanLayout));
+    wav_write(fp, buf->sample.f32,
+              buf->used * faun_channelCount(buf->chanLayout));
     wav_close(fp);
 #endif
 
     return error;
 }
 
+#ifdef USE_LOAD_MEM
+#define WAV_LE16(p)     ((p)[0] | ((p)[1] << 8))
+#define WAV_LE32(p)     (WAV_LE16(p) | ((uint32_t) WAV_LE16((p)+2) << 16))
+
+/*
+  Read a WAVE header from memory.  The chunks are located the same way as
+  wav_readHeader() does in a file.
+
+  Return zero and set pcm to the sample data on success, otherwise a
+  WAV_ERROR code.
+*/
+static int wav_parseMem(WavHeader* wh, const uint8_t* data, uint32_t size,
+                        const uint8_t** pcm)
+{
+    const uint8_t* end = data + size;
+    const uint8_t* it;
+    const uint8_t* fmt = NULL;
+    uint32_t len;
+
+    if (size < 12)
+        return WAV_ERROR_READ;
+    if (memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4))
+        return WAV_ERROR_ID;
+
+    for (it = data + 12; end - it >= 8; it += 8 + len) {
+        len = WAV_LE32(it + 4);
+        if (len > (uint32_t) (end - it) - 8)
+            return WAV_ERROR_READ;
+
+        if (memcmp(it, "fmt ", 4) == 0) {
+            if (len < 16)
+                return WAV_ERROR_READ;
+            fmt = it + 8;
+        } else if (memcmp(it, "data", 4) == 0) {
+            if (! fmt)
+                return WAV_ERROR_CHUNK;
+            wh->format        = WAV_LE16(fmt);
+            wh->channels      = WAV_LE16(fmt + 2);
+            wh->sampleRate    = WAV_LE32(fmt + 4);
+            wh->bitsPerSample = WAV_LE16(fmt + 14);
+            wh->dataSize = len;
+            *pcm = it + 8;
+            return 0;
+        }
+    }
+    return WAV_ERROR_CHUNK;
+}
+
+
+/*
+  Read buffer sample data from memory holding the contents of an audio
+  file.  This is the same as faun_readBuffer() except that the decoders
+  read the memory directly rather than through a FILE.
+
+  Return error message or NULL if successful.
+*/
+static const char* faun_readBufferMem(FaunBuffer* buf, const uint8_t* data,
+                                      uint32_t size, int fmt)
+{
+    const char* error = NULL;
+    uint32_t frames;
+    uint32_t id = 0;
+
+    if (size >= 4)
+        memcpy(&id, data, 4);
+
+    if (id == ID_RIFF)
+    {
+        WavHeader wh;
+        const uint8_t* pcm;
+        void* copy = NULL;
+
+        if (wav_parseMem(&wh, data, size, &pcm))
+            return "WAVE header is invalid";
+        if ((error = wav_checkFormat(&wh)))
+            return error;
+
+        // The samples are converted in place unless they are misaligned.
+        if ((uintptr_t) pcm & 3) {
+            copy = mem_alloc(wh.dataSize);
+            if (! copy)
+                return "No memory for WAVE data";
+            memcpy(copy, pcm, wh.dataSize);
+            pcm = (const uint8_t*) copy;
+        }
+        frames = wav_sampleCount(&wh);
+        if (_allocBufferLoad(buf, wh.channels, wh.sampleRate, frames)) {
+            wav_convertFrames(buf->sample.f32, wh.format, wh.channels, pcm,
+                              frames);
+            buf->used = frames;
+        } else
+            error = "No memory for WAVE samples";
+        mem_free(copy);
+    }
+    else if (id == ID_OGGS && fmt == FAUN_VORBIS)
+    {
+        uint8_t* mem = (uint8_t*) sample_alloc(ENCODED_HEADER + size);
+        if (! mem)
+            return "No memory for encoded buffer";
+        memcpy(mem + ENCODED_HEADER, data, size);
+        error = faun_setEncoded(buf, mem, size);
+    }
+    else if (id == ID_OGGS)
+    {
+        OggVorbis_File vf;
+        vorbis_info* vinfo;
+        MemChunk mc;
+        int pieces;
+
+        mc.data = data;
+        mc.size = size;
+        mc.pos  = 0;
+        if (ov_open_callbacks(&mc, &vf, NULL, 0, memMethods) < 0)
+            return "Ogg open failed";
+        vinfo = ov_info(&vf, -1);
+        frames = ov_pcm_total(&vf, -1);
+        if (vinfo->rate < LOAD_RATE_MIN || vinfo->rate > LOAD_RATE_MAX) {
+            ov_clear(&vf);
+            return "Ogg sample rate is unsupported";
+        }
+
+        // Decode at the Ogg rate; _cmdSetBuffer() converts it.
+        if (! _allocBufferLoad(buf, vinfo->channels, vinfo->rate, frames)) {
+            ov_clear(&vf);
+            return "No memory for Ogg samples";
+        }
+        ov_clear(&vf);
+
+        pieces = split_count(frames);
+        error = split_oggMem(buf, data, size, (pieces > 1) ? pieces : 1);
+    }
+    else if (id == ID_FLAC)
+    {
+#ifndef USE_FLAC
+        error = "Faun built without FLAC support";
+#elif USE_FLAC == 2
+        if (! split_flacMem(buf, data, size))
+            error = foxenFlacDecodeMem(data, size, buf);
+#else
+        error = libFlacDecode(NULL, data, size, buf);
+#endif
+    }
+#ifdef USE_SFX_GEN
+    else if (id == ID_RFX_)
+    {
+        SfxParams sfx;
+        if (size < 8 + sizeof(SfxParams))
+            error = "rFX data is truncated";
+        else if (WAV_LE16(data + 4) != 200)
+            error = "rFX file version not supported";
+        else {
+            memcpy(&sfx, data + 8, sizeof(SfxParams));
+            error = faun_generateSfx(buf, &sfx);
+        }
+    }
+#endif
+
+    return error;
+}
+#endif
+
 static void faun_deactivate(FaunSource* src, int si)
 {
     src->qactive = QACTIVE_NONE;
@@ -693,18 +1721,22 @@ static void faun_deactivate(FaunSource* src, int si)
     atomic_flag_clear(&_pidLock);
 }
 
+static void stream_stop(StreamOV*);
+static void stream_detachBuffer(const FaunBuffer*);
+
 // Abort all sources playing a freed buffer.
 static void faun_detachBuffers()
 {
     FaunSource* src;
     int i;
+
     for (i = 0; i < _sourceLimit; ++i) {
         src = _asource + i;
         if (src->qactive != QACTIVE_NONE) {
             // Only the current buffer is checked; any queued buffers
             // will be skipped during the "Advance play positions" phase.
 
-            if (! src->bufferQueue[src->qactive]->sample.ptr) {
+            if (! src->buffer->sample.ptr) {
                 faun_deactivate(src, i);
             }
         }
@@ -712,13 +1744,78 @@ static void faun_detachBuffers()
 }
 
 
+// Drop the samples of all buffers in an arena (given by its tag).
+static void faun_dropArenaBuffers(uint32_t tag)
+{
+    FaunBuffer* buf = _abuffer;
+    FaunBuffer* end = buf + _bufferLimit;
+
+    for (; buf != end; ++buf) {
+        if (buf->sample.ptr && SAMPLE_HEADER(buf->sample.ptr)->arena == tag) {
+            if (buf->format == FAUN_VORBIS)
+                stream_detachBuffer(buf);
+            buf->sample.ptr = NULL;
+            buf->used = buf->avail = 0;
+        }
+    }
+    faun_detachBuffers();
+}
+
+
 //----------------------------------------------------------------------------
 
+#include "decoder.c"
+
+static void ring_reset(BufferRing* ring)
+{
+    ring->head = ring->tail = 0;
+}
+
+// Return zero if the ring is full.
+static int ring_push(BufferRing* ring, FaunBuffer* buf)
+{
+    uint32_t tail = ring->tail;
+    if (tail - ring->head == STREAM_BUFFERS)
+        return 0;
+    ring->buf[tail & (STREAM_BUFFERS-1)] = buf;
+    ring->tail = tail + 1;      // Publish buf to the consumer.
+    return 1;
+}
+
+#define RING_EMPTY(ring)    ((ring)->head == (ring)->tail)
+
+// Return NULL if the ring is empty.
+static FaunBuffer* ring_pop(BufferRing* ring)
+{
+    uint32_t head = ring->head;
+    FaunBuffer* buf;
+    if (head == ring->tail)
+        return NULL;
+    buf = ring->buf[head & (STREAM_BUFFERS-1)];
+    ring->head = head + 1;      // Release the slot to the producer.
+    return buf;
+}
+
 static void stream_init(StreamOV* st, int id)
 {
     memset(&st->buffers, 0, sizeof(FaunBuffer) * STREAM_BUFFERS);
+    ring_reset(&st->filled);
+    ring_reset(&st->played);
+    st->ended = 0;
+    st->priority = 0;
+    st->mixFrames = st->fillFrames = 0;
     st->feed = 0;
     st->sindex = id;
+    st->loop = 0;
+    st->startPending = 0;
+    st->opWait = 0;
+    st->memBuf = NULL;
+    st->started = 0;
+    st->rs.coef = NULL;
+    st->rsBuf = NULL;
+    st->mem.data = NULL;
+    st->mem.buf = NULL;
+    st->dec = NULL;
 
 #ifdef GLV_ASSET_H
     memset(&st->asset, 0, sizeof(struct AssetFile));
@@ -730,114 +1827,70 @@ static void stream_init(StreamOV* st, int id)
 static void stream_free(StreamOV* st)
 {
     faun_freeBufferSamples(STREAM_BUFFERS, st->buffers);
+    resample_free(&st->rs);
+    mem_free(st->rsBuf);
+    st->rsBuf = NULL;
 }
 
+// True when a decoder is open on a file or memory.
+#define STREAM_OPEN(st)     (st->dec != NULL)
+
 static void stream_closeFile(StreamOV* st)
 {
-    ov_clear(&st->vf);      // Closes st->chunk.cfile for us.
-    st->chunk.cfile = NULL;
+    st->dec->close(st);     // The Vorbis decoder closes st->chunk.cfile.
+    st->dec = NULL;
+    if (st->chunk.cfile) {
+        fclose(st->chunk.cfile);
+        st->chunk.cfile = NULL;
+    }
+    st->mem.data = NULL;
 #ifdef _ANDROID_
     glv_assetClose(&st->asset);
 #endif
 }
 
 
-static void convertStereoHR(float* dst, float* end, float** src)
-{
-    const float* ls = src[0];
-    const float* rs = src[1];
-    float L, R;
-    while (dst != end) {
-        L = *ls++;
-        R = *rs++;
-        *dst++ = L;
-        *dst++ = R;
-        *dst++ = L;
-        *dst++ = R;
-    }
-}
-
-// Interleave the separate channel data.
-static void convertStereo(float* dst, float* end, float** src)
-{
-    const float* ls = src[0];
-    const float* rs = src[1];
-    while (dst != end) {
-        *dst++ = *ls++;
-        *dst++ = *rs++;
-    }
-}
-
-static void convertMonoHR(float* dst, float* end, float** src)
-{
-    const float* c0 = src[0];
-    float L, R;
-    while (dst != end) {
-        L = *c0;
-        R = *c0++;
-        *dst++ = L;
-        *dst++ = R;
-        *dst++ = L;
-        *dst++ = R;
-    }
-}
-
-static void convertMono(float* dst, float* end, float** src)
-{
-    const float* c0 = src[0];
-    float C;
-    while (dst != end) {
-        C = *c0++;
-        *dst++ = C;
-        *dst++ = C;
-    }
-}
-
-typedef void (*StreamConvertFunc)(float*, float*, float**);
-
-
 /*
   Decode some audio, copy it into a buffer, and update sampleCount.
-  Returns a mask of ReadOggStatus bits.
+  Returns a mask of StreamReadStatus bits.
 */
-static int _readOgg(StreamOV* st, FaunBuffer* buffer)
+static int stream_read(StreamOV* st, FaunBuffer* buffer)
 {
-    float** oggPcm;
     float* dst;
-    StreamConvertFunc convert;
     int status;
-    int bitstream;
     int count;
     int readFrames = buffer->avail;
     int readSamples;
     long amt = 0;
-    int halfRate = (st->vinfo->rate == (int) buffer->rate/2);
-
-    if (st->vinfo->channels > 1)
-        convert = halfRate ? convertStereoHR : convertStereo;
-    else
-        convert = halfRate ? convertMonoHR : convertMono;
+    int resample = (st->rs.coef != NULL);
+    int chan = faun_channelCount(buffer->chanLayout);
 
-    for (count = 0; count < readFrames; count += amt)
+    for (count = 0; count < readFrames; )
     {
-        // Decode one vorbis packet.  Samples are decoded internally to float
-        // so ov_read_float is faster than ov_read.
+        // The resampler input is always stereo.
         readSamples = readFrames - count;
-        if (halfRate)
-            readSamples /= 2;
-        amt = ov_read_float(&st->vf, &oggPcm, readSamples, &bitstream);
-        if (amt < 1)
-            break;
-        if (halfRate)
-            amt *= 2;
-
-        dst = buffer->sample.f32 + count*2;
-        convert(dst, dst + amt*2, oggPcm);
-    }
-
+        dst = buffer->sample.f32 + count*chan;
+        if (resample) {
+            readSamples = resample_inputLimit(&st->rs, readSamples);
+            if (readSamples < 1)
+                break;
+            if (readSamples > RESAMPLE_CHUNK)
+                readSamples = RESAMPLE_CHUNK;
+            amt = st->dec->read(st, st->rsBuf, readSamples, 2);
+            if (amt < 1)
+                break;
+            count += resample_run(&st->rs, dst, st->rsBuf, amt);
+        } else {
+            amt = st->dec->read(st, dst, readSamples, chan);
+            if (amt < 1)
+                break;
+            count += amt;
+        }
+    }
+
     if( amt < 0 )
     {
-        fprintf(_errStream, "ov_read error %ld\n", amt);
+        fprintf(_errStream, "Faun stream read error %ld\n", amt);
         status = RSTAT_ERROR;
     }
     else
@@ -848,51 +1901,92 @@ static int _readOgg(StreamOV* st, FaunBuffer* buffer)
     {
         status |= RSTAT_DATA;
         st->sampleCount += count;
-        REPORT_BUF("FAUN readOgg buf used: %d (%d)\n", count, st->sampleCount);
+        REPORT_BUF("FAUN stream_read buf used: %d (%d)\n",
+                   count, st->sampleCount);
         //wav_write(wfp, buffer->sample.f32, count*2);
     }
     return status;
 }
 
 
-static int stream_fillBuffers(StreamOV*);
+static int stream_fillBuffers(StreamOV*, int);
+
+/*
+  Begin feeding an open stream to its source.  Only the first buffer is
+  decoded here so that the audio thread can begin play (see stream_begin())
+  as soon as this StreamOp is finished; streamThread then fills the rest.
 
-static void stream_start(StreamOV* st)
+  \param mode  FaunPlayMode of the source.
+*/
+static void stream_start(StreamOV* st, int mode)
 {
-    FaunSource* src = _asource + st->sindex;
     FaunBuffer* buf = st->buffers;
+    int rate = _voice.mix.rate;
     int i;
 
+    if (! STREAM_OPEN(st))
+        return;
+
+    // Decoded audio which is not at the mix rate is converted by
+    // stream_read().
+    resample_free(&st->rs);
+    if (st->rate != (uint32_t) rate) {
+        if (! st->rsBuf)
+            st->rsBuf = (float*) mem_alloc(RESAMPLE_CHUNK * 2 *
+                                           sizeof(float));
+        if (! st->rsBuf || ! resample_init(&st->rs, st->rate, rate)) {
+            fprintf(_errStream, "Faun stream %d: No memory for resampler\n",
+                    st->sindex);
+            stream_stop(st);
+            return;
+        }
+    }
+
     if (! buf->sample.ptr)
     {
         // Allocate on first use; match attributes of voice mixing buffer.
         // Size each buffer to hold 1/4 second of data (multiple of 8 samples).
+        // With FAUN_FIXED the decoded samples are converted in place to
+        // 16-bit by stream_fillBuffers().
 
-        int rate = _voice.mix.rate;
         int frameCount = ((rate / 4) + 7) & ~7;
-        for (i = 0; i < STREAM_BUFFERS; ++i)
-            faun_allocBufferSamples(buf + i, FAUN_F32, FAUN_CHAN_2,
-                                    rate, frameCount);
+        for (i = 0; i < STREAM_BUFFERS; ++i) {
+            if (! faun_allocBufferSamples(buf + i, FAUN_F32, FAUN_CHAN_2,
+                                          rate, frameCount)) {
+                fprintf(_errStream, "Faun stream %d: No memory for buffers\n",
+                        st->sindex);
+                faun_freeBufferSamples(STREAM_BUFFERS, st->buffers);
+                stream_stop(st);
+                return;
+            }
+        }
     }
 
-    faun_sourceResetQueue(src);
+    ring_reset(&st->filled);
+    ring_reset(&st->played);
 
     for (i = 0; i < STREAM_BUFFERS; ++buf, ++i)
     {
         buf->used = 0;
-        src->bufferQueue[i] = buf;
+        ring_push(&st->played, buf);
+    }
+
+    // A stream segment is replayed from its start.
+    if (SEGMENT_SET(st)) {
+        st->dec->seek(st, st->start);
+        st->sampleCount = 0;
     }
 
-    src->bufUsed = STREAM_BUFFERS;    // Prime faun_processedBuffer().
+    st->ended = 0;
+    st->mixFrames = st->fillFrames = 0;
+    st->loop = mode & FAUN_PLAY_LOOP;
     st->feed = 1;
 
-    stream_fillBuffers(st);
+    stream_fillBuffers(st, 1);
 
     if (st->sampleCount)
     {
-        src->state = SS_PLAYING;
-        src->playPos =
-        src->framesOut = 0;
+        st->started = 1;
         REPORT_STREAM(st,"start");
     }
 }
@@ -901,10 +1995,10 @@ static void stream_start(StreamOV* st)
 static void stream_stop(StreamOV* st)
 {
     REPORT_STREAM(st,"stop");
-    _asource[st->sindex].state = SS_STOPPED;
+    st->started = 0;
     st->feed = 0;
 
-    if( st->chunk.cfile )
+    if (STREAM_OPEN(st))
         stream_closeFile( st );
 }
 
@@ -937,7 +2031,7 @@ static inline void source_setGain(FaunSource* src, float volL, float volR)
 }
 
 
-#define FADE_DELTA(vol,period)  ((vol / period) / 44100.0f)
+#define FADE_DELTA(vol,period)  ((vol / period) / (float) _voice.mix.rate)
 #define GAIN_SILENCE_THRESHOLD  0.001f
 
 /*
@@ -945,8 +2039,9 @@ static inline void source_setGain(FaunSource* src, float volL, float volR)
 */
 static void source_setFadeDeltas(FaunSource* src)
 {
-    if (src->fadePeriod) {
-        float inc = FADE_DELTA(1.0f, src->fadePeriod);
+    float period = SOURCE_PARAM(src)->fadePeriod;
+    if (period) {
+        float inc = FADE_DELTA(1.0f, period);
 #if 1
         src->fadeL = inc * (src->targetL - src->gainL);
         src->fadeR = inc * (src->targetR - src->gainR);
@@ -962,17 +2057,18 @@ static void source_setFadeDeltas(FaunSource* src)
 
 #if 0
     printf("KR fadeDeltas hz:%d per:%f %f,%f\n",
-           _voice.updateHz, src->fadePeriod, src->fadeL, src->fadeR);
+           _voice.updateHz, period, src->fadeL, src->fadeR);
 #endif
 }
 
 
 /*
-  Set fadePos to (totalFrames - (fadePeriod * 44100)).
+  Set fadePos to (totalFrames - (fadePeriod * mix rate)).
 */
 static void source_initFadeOut(FaunSource* src, uint32_t totalFrames)
 {
-    uint32_t ff = (uint32_t) (src->fadePeriod * 44100.0f);
+    uint32_t ff = (uint32_t) (SOURCE_PARAM(src)->fadePeriod *
+                              (float) _voice.mix.rate);
     // Avoiding overlap with any fade-in.
     if (totalFrames > 2*ff)
         src->fadePos = totalFrames - ff;
@@ -981,7 +2077,7 @@ static void source_initFadeOut(FaunSource* src, uint32_t totalFrames)
 
 static inline void source_fadeOut(FaunSource* src)
 {
-    float inc = -FADE_DELTA(1.0f, src->fadePeriod);
+    float inc = -FADE_DELTA(1.0f, SOURCE_PARAM(src)->fadePeriod);
     src->fadeL = inc * src->gainL;
     src->fadeR = inc * src->gainR;
     src->targetL = src->targetR = 0.0f;
@@ -992,29 +2088,97 @@ static inline void source_fadeOut(FaunSource* src)
 
 static void source_setMode(FaunSource* src, int mode)
 {
+    float vol = SOURCE_PARAM(src)->playVolume;
     src->mode = mode;
 
     if (mode & FAUN_PLAY_FADE_IN) {
         src->gainL = src->gainR = 0.0f;
-        src->targetL = src->targetR = src->playVolume;
+        src->targetL = src->targetR = vol;
         source_setFadeDeltas(src);
     } else if (mode & PLAY_TARGET_VOL) {
         // Reset after any previous fade out.
         source_setGain(src, src->targetL, src->targetR);
     } else {
-        source_setGain(src, src->playVolume, src->playVolume);
+        source_setGain(src, vol, vol);
     }
     src->endPos =
     src->fadePos = END_POS_NONE;
 }
 
 
+// True if the source is a stream waiting to begin play (see stream_begin()).
+#define STREAM_PENDING(src) \
+    (src - _asource >= _sourceLimit && \
+     _stream[src - _asource - _sourceLimit].startPending)
+
+/*
+  Apply a CMD_CON_* operation to a source.
+*/
+static void source_control(FaunSource* src, int op)
+{
+    if (op == CMD_CON_FADE_OUT)
+        source_fadeOut(src);
+    else if (src->qactive != QACTIVE_NONE || STREAM_PENDING(src))
+        src->state = (op == CMD_CON_STOP) ? SS_STOPPED : SS_PLAYING;
+}
+
+
+/*
+  Set the playback rate of a buffer source.  Streams always play at their
+  normal rate.
+*/
+static void source_setRate(int si, float rate)
+{
+    FaunSource* src = _asource + si;
+
+    if (si >= _sourceLimit)
+        return;
+    if (rate < PLAY_RATE_MIN)
+        rate = PLAY_RATE_MIN;
+    else if (rate > PLAY_RATE_MAX)
+        rate = PLAY_RATE_MAX;
+    _aparam[si].playRate = rate;
+    if (src->qactive != QACTIVE_NONE)
+        src->step = faun_step(src->buffer, rate);
+}
+
+
+static void bus_setVolume(FaunBus* bus, float vol, float period)
+{
+    bus->targetL = bus->targetR = vol;
+    if (period > 0.0f) {
+        float inc = FADE_DELTA(1.0f, period);
+        bus->fadeL = inc * (vol - bus->gainL);
+        bus->fadeR = inc * (vol - bus->gainR);
+    } else {
+        bus->gainL = bus->gainR = vol;
+        bus->fadeL = bus->fadeR = 0.0f;
+    }
+}
+
+
+static void cmd_playStreamMem(int, const uint8_t*, uint32_t,
+                              const FaunBuffer*, int, uint32_t);
+
 static void cmd_playSource(int si, uint32_t bufIds, int mode, uint32_t pid)
 {
     FaunSource* src = _asource + si;
     FaunBuffer* buf = _abuffer + (bufIds & BID_PACKED);
     uint32_t ftotal;
 
+    if (buf->format == FAUN_VORBIS) {
+        if (si >= _sourceLimit) {
+            cmd_playStreamMem(si, buf->sample.u8 + ENCODED_HEADER,
+                              ENCODED_SIZE(buf), buf, mode, pid);
+            return;
+        }
+        fprintf(_errStream, "Faun compressed buffer needs a stream"
+                            " (source %d)\n", si);
+        src->serialNo = pid;
+        faun_deactivate(src, si);
+        return;
+    }
+
     src->serialNo = pid;
     assert(si == (int) FAUN_PID_SOURCE(pid));
 
@@ -1022,16 +2186,22 @@ static void cmd_playSource(int si, uint32_t bufIds, int mode, uint32_t pid)
     faun_setBuffer(src, buf);
     ftotal = buf->used;
     for (bufIds >>= 10; bufIds; bufIds >>= 10) {
-         buf = _abuffer + ((bufIds-1) & BID_PACKED);
-        faun_queueBuffer(src, buf);
-        ftotal += buf->used;
+        buf = _abuffer + ((bufIds-1) & BID_PACKED);
+        if (buf->format != FAUN_VORBIS) {
+            faun_queueBuffer(src, buf);
+            ftotal += buf->used;
+        }
     }
 
     src->playPos = src->framesOut = 0;
+    src->playFrac = 0;
     source_setMode(src, mode);
 
-    if (mode & FAUN_PLAY_FADE_OUT)
+    if (mode & FAUN_PLAY_FADE_OUT) {
+        // Total in mix frames.
+        ftotal = (uint32_t) (((uint64_t) ftotal * STEP_UNITY) / src->step);
         source_initFadeOut(src, ftotal);
+    }
 
     if (mode & (FAUN_PLAY_ONCE | FAUN_PLAY_LOOP))
         src->state = SS_PLAYING;
@@ -1040,17 +2210,36 @@ static void cmd_playSource(int si, uint32_t bufIds, int mode, uint32_t pid)
 }
 
 
-static void cmd_playStream(int si, const FileChunk* fc, int mode, uint32_t pid)
+/*
+  Begin play of a stream once its decoder is open.
+*/
+static void stream_play(StreamOV* st, int mode)
 {
-    StreamOV* st = _stream + (si - _sourceLimit);
-    assert(si >= _sourceLimit);
+    st->feed = 0;
+    st->sampleCount = 0;
+    st->sampleLimit = 0;
+
+    if (mode & FAUN_PLAY_FADE_OUT)
+        st->fadeFrames = (uint32_t) ((double) st->dec->pcmTotal(st) *
+                                     _voice.mix.rate / st->rate);
+
+    if (mode & (FAUN_PLAY_ONCE | FAUN_PLAY_LOOP))
+        stream_start(st, mode);
+}
+
+
+static void stream_playFile(StreamOV* st, const FileChunk* fc, int mode)
+{
+    const char* error;
+    int si = st->sindex;
     stream_stop( st );
 
     st->chunk = *fc;
+    st->mem.buf = NULL;
     if (fc->offset)
         fseek(fc->cfile, fc->offset, SEEK_SET);
 
-    if (ov_open_callbacks(&st->chunk, &st->vf, NULL, 0, chunkMethods) < 0)
+    if ((error = stream_open(st)))
     {
 #ifdef GLV_ASSET_H
         glv_assetClose(&st->asset);
@@ -1058,73 +2247,89 @@ static void cmd_playStream(int si, const FileChunk* fc, int mode, uint32_t pid)
         fclose(st->chunk.cfile);
         st->chunk.cfile = NULL;
 #endif
-        fprintf(_errStream, "Faun cannot open Ogg (stream %d)\n", si);
+        fprintf(_errStream, "Faun stream %d: %s\n", si, error);
     }
     else
-    {
-        FaunSource* src = _asource + si;
-        src->serialNo = pid;
-        assert(si == (int) FAUN_PID_SOURCE(pid));
+        stream_play(st, mode);
+}
 
-        st->feed = 0;
-        st->sampleCount = 0;
-        st->sampleLimit = 0;
-        st->vinfo = ov_info(&st->vf, -1);
 
-        source_setMode(src, mode);
+/*
+  Play file data in memory on a stream.  The decoder reads the memory,
+  which must not be freed until the stream is stopped.
+
+  \param buf  Encoded buffer which holds the data (see stream_detachBuffer())
+              or NULL if the memory is owned by the user.
+*/
+static void stream_playMem(StreamOV* st, const uint8_t* data, uint32_t size,
+                           const FaunBuffer* buf, int mode)
+{
+    const char* error;
+    int si = st->sindex;
+    stream_stop( st );
 
-        if (mode & FAUN_PLAY_FADE_OUT)
-            source_initFadeOut(src, ov_pcm_total(&st->vf, -1));
+    st->mem.data = data;
+    st->mem.buf  = buf;
+    st->mem.size = size;
+    st->mem.pos  = 0;
 
-        if (mode & (FAUN_PLAY_ONCE | FAUN_PLAY_LOOP))
-            stream_start(st);
+    if ((error = stream_open(st)))
+    {
+        st->mem.data = NULL;
+        fprintf(_errStream, "Faun stream %d: %s\n", si, error);
     }
+    else
+        stream_play(st, mode);
 }
 
 
-static void cmd_playStreamPart(int si, double start, double duration, int mode)
+static void stream_playPart(StreamOV* st, double start, double duration,
+                            int mode)
 {
-    FaunSource* source = _asource + si;
-    StreamOV* st = _stream + (si - _sourceLimit);
-    assert(si >= _sourceLimit);
-
     st->feed = 0;
     st->start = start;
     st->sampleCount = 0;
     st->sampleLimit = (uint32_t) (duration * _voice.mix.rate);
-    //printf("KR rate %d %d\n", st->vinfo->rate, st->sampleLimit);
+    //printf("KR rate %d %d\n", st->rate, st->sampleLimit);
 
-    source_setMode(source, mode);
-
-    source->state = SS_STOPPED;
-
-    ov_time_seek(&st->vf, st->start);
-    stream_start(st);
+    stream_start(st, mode);
 }
 
 
 /**
-  Decode audio from file until all available buffers are filled.
-  Should only be called if st->feed and st->chunk.cfile are both non-zero.
+  Decode audio into the buffers returned through the played ring and pass
+  them to the audio thread through the filled ring.
+  Should only be called if st->feed and STREAM_OPEN(st) are both non-zero.
+
+  \param limit  Maximum number of buffers to fill.
 
   Return number of buffers filled with data.
 */
-static int stream_fillBuffers(StreamOV* st)
+static int stream_fillBuffers(StreamOV* st, int limit)
 {
-    FaunSource* source = _asource + st->sindex;
     FaunBuffer* freeBuf;
+    FaunBuffer part;
     uint32_t excess;
     int fillCount = 0;
-    int status;
+    int status, end, empty;
 
-    while ((freeBuf = faun_processedBuffer(source)))
+    while (fillCount < limit && (freeBuf = ring_pop(&st->played)))
     {
         REPORT_BUF("KR fillBuffer %ld\n", freeBuf - st->buffers);
         ++fillCount;
-read_again:
-        status = _readOgg(st, freeBuf);
-        if( status & RSTAT_DATA )
+        freeBuf->used = 0;
+        end = empty = 0;
+
+        // A looping stream is read again from the start until the buffer
+        // is full, so a short loop cannot run the source queue dry.
+        for (;;)
         {
+            part = *freeBuf;
+            part.sample.f32 += freeBuf->used * 2;
+            part.avail -= freeBuf->used;
+            status = stream_read(st, &part);
+            freeBuf->used += part.used;
+
             if (SEGMENT_SET(st) && st->sampleCount >= st->sampleLimit)
             {
                 status |= RSTAT_EOF;
@@ -1132,295 +2337,1353 @@ read_again:
                 excess = st->sampleCount - st->sampleLimit;
                 REPORT_BUF("    sampleCount: %d sampleLimit: %d\n",
                            st->sampleCount, st->sampleLimit);
-                if (excess >= freeBuf->used)
-                {
-                    freeBuf->used = 0;
-                    status &= ~RSTAT_DATA;
-                    goto drop_buf;
-                }
-                freeBuf->used -= excess;
+                freeBuf->used = (excess < freeBuf->used) ?
+                                freeBuf->used - excess : 0;
             }
-            faun_queueBuffer(source, freeBuf);
-drop_buf:
-            REPORT_BUF("    used: %d\n", freeBuf->used);
-        }
 
-        if( status & RSTAT_ERROR )
-        {
-            stream_closeFile( st );
-            break;
-        }
-        else if( status & RSTAT_EOF )
-        {
-            REPORT_BUF("    end-of-stream\n");
-            if (source->mode & FAUN_PLAY_LOOP)
+            if (status & RSTAT_ERROR)
             {
-                if (SEGMENT_SET(st))
-                {
-                    ov_time_seek(&st->vf, st->start);
-                    st->sampleCount = 0;
-                }
-                else
-                    ov_raw_seek(&st->vf, 0);
-
-                // If the stream ended exactly on a buffer boundary then the
-                // unqueued buffer is still available.
-                if (! (status & RSTAT_DATA))
-                    goto read_again;
+                end = RSTAT_ERROR;
+                break;
             }
-            else if (SEGMENT_SET(st))
+            if (! (status & RSTAT_EOF))
+                break;
+
+            REPORT_BUF("    end-of-stream\n");
+            if (! st->loop || (! part.used && ++empty > 1))
             {
-                // Allow the current buffers to finish playing, but stop
-                // feeding more data.
-                st->feed = 0;
+                end = RSTAT_EOF;
                 break;
             }
-            else
+            if (SEGMENT_SET(st))
             {
-                stream_closeFile( st );
-                break;
+                st->dec->seek(st, st->start);
+                st->sampleCount = 0;
             }
+            else
+                st->dec->rewind(st);
+
+            if (freeBuf->used == freeBuf->avail)
+                break;
+        }
+
+        if (freeBuf->used)
+        {
+#ifdef FAUN_FIXED
+            faun_storeS16(freeBuf->sample.ptr, freeBuf->used*2);
+#endif
+            ring_push(&st->filled, freeBuf);
+            st->fillFrames += freeBuf->used;
+        }
+        REPORT_BUF("    used: %d\n", freeBuf->used);
+
+        if (end)
+        {
+            // Allow the filled buffers to finish playing, but stop feeding
+            // more data.  The file of a segment is kept open so another
+            // part can be played.
+            if (end == RSTAT_EOF && SEGMENT_SET(st))
+                st->feed = 0;
+            else
+                stream_closeFile( st );
+            st->ended = 1;
+            break;
         }
     }
 
     return fillCount;
 }
 
+
 //----------------------------------------------------------------------------
+// Stream decoding thread
+
+enum StreamOpCode {
+    SOP_PLAY_FILE,
+    SOP_PLAY_MEM,
+    SOP_PLAY_PART,
+    SOP_START,
+    SOP_DETACH,
+    SOP_RELEASE
+};
 
-#define SIMUL_MIX
+// Memory freed by SOP_RELEASE.
+enum StreamRelease {
+    SREL_SAMPLES,
+    SREL_BLOCKS,
+    SREL_BANK
+};
 
-static int faun_fadeChan(float* fadeTriplet, int fading, int fadeMask)
+// Stream operation run by streamThread for the audio thread.
+typedef struct {
+    int code;               // StreamOpCode
+    int si;
+    int mode;               // FAUN_PLAY mode or StreamRelease.
+    FileChunk fc;
+    MemChunk mem;           // Data for SOP_PLAY_MEM.
+    double part[2];         // SOP_PLAY_PART start & duration.
+    void* release;          // SOP_RELEASE memory & bank mapping size.
+    size_t releaseSize;
+}
+StreamOp;
+
+#define STREAM_OP_MAX   16      // Power of two.
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;   // Signals streamThread.
+    pthread_cond_t  done;   // Signals stream_waitOps() when ops are run.
+    StreamOp ops[STREAM_OP_MAX];    // Queue of posted ops.
+    _Atomic uint32_t opHead;        // Count of ops run.
+    _Atomic uint32_t opTail;        // Count of ops placed in the queue.
+    StreamOp* late;         // Ops held by the audio thread (queue full).
+    uint32_t lateUsed;
+    uint32_t lateAvail;
+    int leak;               // Set if a detach or release op was dropped.
+    atomic_int idle;        // streamThread is waiting on cond.
+    atomic_int more;        // Budget ran out with buffers left to fill.
+    int wake;               // Buffers have been returned.
+    int quit;
+    int up;
+    pthread_t thread;
+} _sdec;
+
+
+static void stream_releaseMem(const StreamOp* op)
 {
-    float gain   = fadeTriplet[0];
-    float fade   = fadeTriplet[2];
-    float target = fadeTriplet[4];
-
-    gain += fade;
-    if (fade < 0.0f) {
-        if (gain <= target)
-            goto done;
-    } else if (gain >= target) {
-        goto done;
+    switch (op->mode) {
+        case SREL_SAMPLES:
+            sample_free(op->release);
+            break;
+        case SREL_BLOCKS:
+            arena_releaseBlocks((ArenaBlock*) op->release);
+            break;
+        case SREL_BANK:
+            bank_unmap(op->release, op->releaseSize);
+            break;
     }
-    fadeTriplet[0] = gain;
-    return fading;
-
-done:
-    fadeTriplet[0] = target;
-    fadeTriplet[2] = 0.0f;
-    return fading & fadeMask;
 }
 
-static void _mix1StereoFade(float* restrict output, float* end,
-                            const float* restrict input, FaunSource* src)
+
+static void stream_runOp(const StreamOp* op)
 {
-    const int FADE_L = 1;
-    const int FADE_R = 2;
-    int fading = src->fadeL ? FADE_L : 0;
-    if (src->fadeR)
-        fading |= FADE_R;
-    assert(fading);
+    StreamOV* st = _stream + (op->si - _sourceLimit);
 
-    while (output != end) {
-        *output += *input++ * src->gainL;
-        output++;
-        *output += *input++ * src->gainR;
-        output++;
-
-        if (fading & FADE_L)
-            fading = faun_fadeChan(&src->gainL, fading, ~FADE_L);
-        if (fading & FADE_R)
-            fading = faun_fadeChan(&src->gainR, fading, ~FADE_R);
-        if (! fading) {
-            if (src->mode & END_AFTER_FADE) {
-                src->endPos = src->framesOut;   // Force end of play.
-            } else {
-                while (output != end) {
-                    *output += *input++ * src->gainL;
-                    output++;
-                    *output += *input++ * src->gainR;
-                    output++;
-                }
-            }
+    if (op->code != SOP_RELEASE) {
+        st->started = 0;
+        st->fadeFrames = 0;
+    }
+
+    switch (op->code) {
+        case SOP_PLAY_FILE:
+            stream_playFile(st, &op->fc, op->mode);
+            break;
+        case SOP_PLAY_MEM:
+            stream_playMem(st, op->mem.data, op->mem.size, op->mem.buf,
+                           op->mode);
+            break;
+        case SOP_PLAY_PART:
+            stream_playPart(st, op->part[0], op->part[1], op->mode);
+            break;
+        case SOP_START:
+            stream_start(st, op->mode);
+            break;
+        case SOP_DETACH:
+            stream_stop(st);
+            break;
+        case SOP_RELEASE:
+            stream_releaseMem(op);
             break;
-        }
     }
 }
 
-void faun_fadeBuffers(float* output, const float** inputEnd,
-                      FaunSource** src, int inCount, uint32_t sampleCount)
+
+// Return a monotonic time in microseconds.
+static uint64_t stream_usec(void)
 {
-    float* end = output + sampleCount;
-    int i;
-    for (i = 0; i < inCount; ++i) {
-        --inputEnd;
-        _mix1StereoFade(output, end, *inputEnd, src[i]);
-    }
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t) (count.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t) (count.QuadPart % freq.QuadPart) * 1000000 /
+           freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
 }
 
 
-#ifdef SIMUL_MIX
-static void _mix1Stereo(float* restrict output, float* end,
-                        const float* restrict input,
-                        float gainL, float gainR, int init)
+/*
+  Pick the stream which should have a buffer filled next.
+
+  Streams close to running out of decoded audio (less than half a buffer
+  ahead of the mix) come first, then those with a higher FAUN_PRIORITY,
+  and then those with the least audio ahead of the mix.
+
+  \param urgent  Set non-zero if the stream is close to running out.
+
+  Return NULL if no stream has a played buffer to fill.
+*/
+static StreamOV* stream_nextDeadline(int* urgent)
 {
-    if (init) {
-        while (output != end) {
-            *output++ = *input++ * gainL;
-            *output++ = *input++ * gainR;
-        }
-    } else {
-        while (output != end) {
-            *output += *input++ * gainL;
-            output++;
-            *output += *input++ * gainR;
-            output++;
+    StreamOV* st;
+    StreamOV* pick = NULL;
+    uint32_t ahead;
+    uint32_t least = 0;
+    uint32_t near = _voice.mix.rate / 8;
+    int i, pri, best = 0;
+
+    for (i = 0; i < _streamLimit; ++i) {
+        st = _stream + i;
+        if (! st->feed || ! STREAM_OPEN(st) || RING_EMPTY(&st->played))
+            continue;
+
+        // Close streams are placed above any FAUN_PRIORITY.
+        ahead = st->fillFrames - st->mixFrames;
+        pri = (ahead < near) ? STREAM_URGENT : st->priority;
+        if (! pick || pri > best || (pri == best && ahead < least)) {
+            pick  = st;
+            best  = pri;
+            least = ahead;
         }
     }
+    *urgent = (best == STREAM_URGENT);
+    return pick;
 }
 
-static void _mix2Stereo(float* restrict output, float* end,
-                        const float** input,
-                        const float* gainL, const float* gainR, int init)
+
+// Return the oldest op which has not been run, or NULL if there is none.
+static const StreamOp* stream_nextOp(void)
 {
-    const float* restrict in0 = input[0];
-    const float* restrict in1 = input[1];
-    if (init) {
-        while (output != end) {
-            *output++ = (*in0++ * gainL[0]) + (*in1++ * gainL[1]);
-            *output++ = (*in0++ * gainR[0]) + (*in1++ * gainR[1]);
-        }
-    } else {
-        while (output != end) {
-            *output += (*in0++ * gainL[0]) + (*in1++ * gainL[1]);
-            output++;
-            *output += (*in0++ * gainR[0]) + (*in1++ * gainR[1]);
-            output++;
-        }
-    }
+    uint32_t head = _sdec.opHead;
+    if (head == _sdec.opTail)
+        return NULL;
+    return _sdec.ops + (head & (STREAM_OP_MAX - 1));
 }
 
-static void _mix4Stereo(float* restrict output, float* end,
-                        const float** input,
-                        const float* gainL, const float* gainR, int init)
+
+// Remove the op returned by stream_nextOp() once it has been run.
+static void stream_finishOp(void)
 {
-    const float* restrict in0 = input[0];
-    const float* restrict in1 = input[1];
-    const float* restrict in2 = input[2];
-    const float* restrict in3 = input[3];
-    if (init) {
-        while (output != end) {
-            *output++ = (*in0++ * gainL[0]) + (*in1++ * gainL[1]) +
-                        (*in2++ * gainL[2]) + (*in3++ * gainL[3]);
-            *output++ = (*in0++ * gainR[0]) + (*in1++ * gainR[1]) +
-                        (*in2++ * gainR[2]) + (*in3++ * gainR[3]);
+    ++_sdec.opHead;             // Release the slot to the audio thread.
+#ifdef CAPTURE
+    mutexLock(_sdec.mutex);
+    condSignal(_sdec.done);
+    mutexUnlock(_sdec.mutex);
+#endif
+}
+
+
+/*
+  Stream decoder.  The decoders are opened, seeked & closed here by the
+  StreamOps which the audio thread posts.  Otherwise any buffers which the
+  audio thread has returned are refilled so that it never waits on file
+  reads or decoding during an update.  One buffer is filled at a time,
+  picked by stream_nextDeadline(), until the FAUN_STREAM_BUDGET is used.
+*/
+#ifdef _WIN32
+static DWORD WINAPI streamThread(LPVOID arg)
+#else
+static void* streamThread(void* arg)
+#endif
+{
+    const StreamOp* op;
+    StreamOV* st;
+    uint64_t start;
+    int budget, urgent, quit;
+    (void) arg;
+
+    for (;;) {
+        mutexLock(_sdec.mutex);
+        _sdec.idle = 1;
+        while (_sdec.opHead == _sdec.opTail && ! _sdec.wake && ! _sdec.quit)
+            condWaitF(_sdec.cond, _sdec.mutex);
+        _sdec.idle = 0;
+        quit = _sdec.quit;
+        _sdec.wake = 0;
+        mutexUnlock(_sdec.mutex);
+        if (quit)
+            break;
+
+        while ((op = stream_nextOp())) {
+            stream_runOp(op);
+            stream_finishOp();
         }
-    } else {
-        while (output != end) {
-            *output += (*in0++ * gainL[0]) + (*in1++ * gainL[1]) +
-                       (*in2++ * gainL[2]) + (*in3++ * gainL[3]);
-            output++;
-            *output += (*in0++ * gainR[0]) + (*in1++ * gainR[1]) +
-                       (*in2++ * gainR[2]) + (*in3++ * gainR[3]);
-            output++;
+
+        // Pending ops are run first; all streams are then checked again.
+        // Streams which are not urgent wait for the next update once the
+        // budget is spent.
+        start = stream_usec();
+        budget = _streamBudget;
+        _sdec.more = 0;
+        while (_sdec.opHead == _sdec.opTail &&
+               (st = stream_nextDeadline(&urgent))) {
+            if (budget && ! urgent &&
+                stream_usec() - start >= (uint64_t) budget) {
+                _sdec.more = 1;
+                break;
+            }
+            stream_fillBuffers(st, 1);
         }
     }
+    return 0;
 }
-#endif
 
 
-/*
- * Mix stereo inputs.
- *
- * \param output        Output buffer for the mixed samples.
- * \param input         Array of pointers to float input buffers.
- * \param gainL         Left channel gain for each input.
- * \param gainR         Right channel gain for each input.
- * \param inCount       Number of inputs.
- * \param sampleCount   Number of samples (frames*2) to mix from each input.
- */
-void faun_mixBuffers(float* output, const float** input,
-                     const float* gainL, const float* gainR,
-                     int inCount, uint32_t sampleCount)
+// Tell streamThread that played buffers have been returned.
+static void stream_wake(void)
 {
-#ifdef SIMUL_MIX
-    float* end = output + sampleCount;
-    int initial = 1;
+    mutexLock(_sdec.mutex);
+    _sdec.wake = 1;
+    condSignal(_sdec.cond);
+    mutexUnlock(_sdec.mutex);
+}
+
+
+// Put an op in the queue if there is room.  Return zero if it is full.
+static int stream_queueOp(const StreamOp* op)
+{
+    uint32_t tail = _sdec.opTail;
+    if (tail - _sdec.opHead == STREAM_OP_MAX)
+        return 0;
+    _sdec.ops[tail & (STREAM_OP_MAX - 1)] = *op;
+    _sdec.opTail = tail + 1;    // Publish op to streamThread.
+    return 1;
+}
+
+
+/*
+  Move the ops held by stream_post() into the queue as it empties.  Called
+  by the audio thread.
+*/
+static void stream_flushOps(void)
+{
+    uint32_t n = 0;
+
+    while (n < _sdec.lateUsed && stream_queueOp(_sdec.late + n))
+        ++n;
+    if (n) {
+        _sdec.lateUsed -= n;
+        memmove(_sdec.late, _sdec.late + n, _sdec.lateUsed * sizeof(StreamOp));
+        if (_sdec.idle)
+            stream_wake();
+    }
+}
+
+
+// Close the file of a SOP_PLAY_FILE op which will not be run.
+static void stream_closeOpFile(const StreamOp* op)
+{
+#ifdef GLV_ASSET_H
+    glv_assetClose((struct AssetFile*) &op->fc.asset);
+#else
+    fclose(op->fc.cfile);
+#endif
+}
+
+
+/*
+  Discard an op which could not be posted for lack of memory.  A played
+  stream fails to start.  If a detach op is lost then a stream may still
+  be reading memory given to stream_release(), so that is leaked instead.
+*/
+static void stream_dropOp(const StreamOp* op)
+{
+    fprintf(_errStream, "Faun stream %d: No memory for op %d\n",
+            op->si - _sourceLimit, op->code);
+    if (op->code == SOP_PLAY_FILE)
+        stream_closeOpFile(op);
+    else if (op->code == SOP_DETACH || op->code == SOP_RELEASE)
+        _sdec.leak = 1;
+}
+
+
+/*
+  Queue a StreamOp to be run by streamThread.  This is called by the audio
+  thread, which owns the stream sources and never waits for streamThread.
+  If the queue is full the op is held (in order with any others) until
+  stream_flushOps() can move it to the queue on a later update.
+
+  Return zero if the op was dropped as there is no memory to hold it.
+*/
+static int stream_post(const StreamOp* op)
+{
+    StreamOp* late;
+    uint32_t avail;
+
+    if (! _sdec.up) {
+        stream_runOp(op);
+        return 1;
+    }
+
+    stream_flushOps();
+    if (! _sdec.lateUsed && stream_queueOp(op)) {
+        if (_sdec.idle)
+            stream_wake();
+        return 1;
+    }
+
+    if (_sdec.lateUsed == _sdec.lateAvail) {
+        avail = _sdec.lateAvail ? _sdec.lateAvail * 2 : STREAM_OP_MAX;
+        late = (StreamOp*) realloc(_sdec.late, avail * sizeof(StreamOp));
+        if (! late) {
+            stream_dropOp(op);
+            return 0;
+        }
+        _sdec.late = late;
+        _sdec.lateAvail = avail;
+    }
+    _sdec.late[_sdec.lateUsed++] = *op;
+    return 1;
+}
+
+// Count of ops posted, including those held by stream_post().
+#define STREAM_OPS_POSTED   (_sdec.opTail + _sdec.lateUsed)
+
+// True when the ops posted up to count n have been run.
+#define STREAM_OPS_RUN(n)   ((int32_t) (_sdec.opHead - (n)) >= 0)
+
+#ifdef CAPTURE
+// Wait for the ops posted up to count n to be run.  Only captures wait
+// (see audioThread).
+static void stream_waitOps(uint32_t n)
+{
+    while (! STREAM_OPS_RUN(n)) {
+        stream_flushOps();
+        mutexLock(_sdec.mutex);
+        while (! STREAM_OPS_RUN(n) && _sdec.opHead != _sdec.opTail)
+            condWaitF(_sdec.done, _sdec.mutex);
+        mutexUnlock(_sdec.mutex);
+    }
+}
+#endif
+
+
+static void source_end(FaunSource*);
 
-    while (inCount > 3) {
+/*
+  Return played buffers of a stream source to streamThread and queue any
+  it has filled.  This is called by the audio thread for playing streams.
+
+  \param frames  Mix frames of the update.
+  \param freed   Incremented for each buffer returned.
+
+  Return non-zero if the source has enough frames queued for the update
+  or the stream has ended.  Otherwise the decoder has fallen behind and
+  the source should not be mixed or advanced.
+*/
+static int stream_collect(StreamOV* st, FaunSource* src, uint32_t frames,
+                          int* freed)
+{
+    SourceParam* par = SOURCE_PARAM(src);
+    FaunBuffer* buf;
+    uint32_t avail, need;
+    int ended, q;
+
+    // Read the flag first so any buffers filled before it was set are
+    // popped below.
+    ended = st->ended;
+    st->mixFrames = src->framesOut;
+
+    while ((buf = faun_processedBuffer(src))) {
+        ring_push(&st->played, buf);
+        ++*freed;
+    }
+    while (par->bufUsed < SOURCE_QUEUE_SIZE && (buf = ring_pop(&st->filled)))
+        faun_queueBuffer(src, buf);
+
+    if (src->qactive == QACTIVE_NONE) {
+        if (ended)
+            source_end(src);
+        return 0;
+    }
+    if (ended)
+        return 1;
+
+    // The last queued buffer must not be used up while the stream is
+    // still being fed, as source_advanceBuffer() would end the source.
+    avail = src->buffer->used - src->playPos;
+    for (q = src->qactive; ; ) {
+        if (++q == SOURCE_QUEUE_SIZE)
+            q = 0;
+        if (q == src->qtail)
+            break;
+        avail += par->bufferQueue[q]->used;
+    }
+    need = (uint32_t) ((src->playFrac + (uint64_t) frames * src->step) >> 16);
+    return avail > need + 1;
+}
+
+
+/*
+  Begin play of a stream source once the ops posted for it have been run.
+  Called by the audio thread.
+*/
+static void stream_begin(StreamOV* st, FaunSource* src)
+{
+    FaunBuffer* buf;
+
+    st->startPending = 0;
+    if (! st->started) {
+        // Nothing was decoded.
+        if (src->state == SS_PLAYING)
+            src->state = SS_STOPPED;
+        return;
+    }
+
+    while ((buf = ring_pop(&st->filled)))
+        faun_queueBuffer(src, buf);
+    src->playPos = src->framesOut = 0;
+    src->playFrac = 0;
+    if (st->fadeFrames)
+        source_initFadeOut(src, st->fadeFrames);
+}
+
+
+/*
+  Post a StreamOp which opens or restarts the decoder of a stream.  The
+  op takes back all the stream buffers, so the source queue is emptied.
+  The source is not mixed until stream_begin() is called for it.
+
+  \param play  Non-zero if the source is to play once the op has been run.
+*/
+static void stream_postPlay(const StreamOp* op, int play)
+{
+    StreamOV* st = _stream + (op->si - _sourceLimit);
+    FaunSource* src = _asource + op->si;
+
+    faun_sourceResetQueue(src);
+    if (stream_post(op)) {
+        src->state = play ? SS_PLAYING : SS_STOPPED;
+        st->startPending = play;
+        st->opWait = STREAM_OPS_POSTED;
+    } else {
+        st->startPending = 0;
+        faun_deactivate(src, op->si);
+    }
+}
+
+
+static void cmd_playStream(int si, const FileChunk* fc, int mode, uint32_t pid)
+{
+    StreamOp op;
+    assert(si >= _sourceLimit);
+    _asource[si].serialNo = pid;
+    assert(si == (int) FAUN_PID_SOURCE(pid));
+    source_setMode(_asource + si, mode);
+
+    op.code = SOP_PLAY_FILE;
+    op.si   = si;
+    op.mode = mode;
+    op.fc   = *fc;
+    _stream[si - _sourceLimit].memBuf = NULL;
+    stream_postPlay(&op, mode & (FAUN_PLAY_ONCE | FAUN_PLAY_LOOP));
+}
+
+
+static void cmd_playStreamMem(int si, const uint8_t* data, uint32_t size,
+                              const FaunBuffer* buf, int mode, uint32_t pid)
+{
+    StreamOp op;
+    assert(si >= _sourceLimit);
+    _asource[si].serialNo = pid;
+    assert(si == (int) FAUN_PID_SOURCE(pid));
+    source_setMode(_asource + si, mode);
+
+    op.code = SOP_PLAY_MEM;
+    op.si   = si;
+    op.mode = mode;
+    op.mem.data = data;
+    op.mem.buf  = buf;
+    op.mem.size = size;
+    _stream[si - _sourceLimit].memBuf = buf;
+    stream_postPlay(&op, mode & (FAUN_PLAY_ONCE | FAUN_PLAY_LOOP));
+}
+
+
+static void cmd_playStreamPart(int si, double start, double duration, int mode)
+{
+    StreamOp op;
+    assert(si >= _sourceLimit);
+    source_setMode(_asource + si, mode);
+
+    op.code = SOP_PLAY_PART;
+    op.si   = si;
+    op.mode = mode;
+    op.part[0] = start;
+    op.part[1] = duration;
+    stream_postPlay(&op, 1);
+}
+
+
+static void cmd_startStream(int si)
+{
+    StreamOp op;
+    op.code = SOP_START;
+    op.si   = si;
+    op.mode = _asource[si].mode;
+    stream_postPlay(&op, 1);
+}
+
+
+/*
+  Stop any streams decoding an encoded buffer before its samples are freed
+  with stream_release().  The sources are deactivated here and streamThread
+  stops the decoders when it runs the SOP_DETACH ops.
+*/
+static void stream_detachBuffer(const FaunBuffer* buf)
+{
+    StreamOV* st;
+    StreamOp op;
+    int i;
+
+    for (i = 0; i < _streamLimit; ++i) {
+        st = _stream + i;
+        if (st->memBuf == buf) {
+            st->memBuf = NULL;
+            st->startPending = 0;
+            faun_deactivate(_asource + st->sindex, st->sindex);
+
+            op.code = SOP_DETACH;
+            op.si   = st->sindex;
+            stream_post(&op);
+        }
+    }
+}
+
+
+/*
+  Free memory which a stream decoder may be reading.  If any ops are
+  pending, streamThread frees it once they have been run, as an op may
+  play or detach the memory.  The audio thread does not wait for this.
+  Once an op has been dropped (see stream_dropOp()) the memory is leaked.
+
+  \param kind     StreamRelease
+  \param mapSize  Size of a SREL_BANK mapping.
+*/
+static void stream_release(int kind, void* mem, size_t mapSize)
+{
+    StreamOp op;
+
+    op.code = SOP_RELEASE;
+    op.si   = _sourceLimit;
+    op.mode = kind;
+    op.release = mem;
+    op.releaseSize = mapSize;
+
+    if (_sdec.leak)
+        return;
+    if (STREAM_OPS_RUN(STREAM_OPS_POSTED))
+        stream_releaseMem(&op);
+    else
+        stream_post(&op);
+}
+
+
+/*
+  Free the samples of a buffer.  Encoded buffers may be played by a stream,
+  so those are freed with stream_release().
+*/
+static void faun_freeSamples(FaunBuffer* buf)
+{
+    if (buf->format == FAUN_VORBIS && buf->sample.ptr) {
+        stream_detachBuffer(buf);
+        stream_release(SREL_SAMPLES, buf->sample.ptr, 0);
+    } else
+        sample_free(buf->sample.ptr);
+    buf->sample.ptr = NULL;
+}
+
+
+/*
+  Return non-zero if the thread could not be started.
+*/
+static int stream_startThread(void)
+{
+    if (mutexInitF(_sdec.mutex))
+        return 1;
+    condInit(_sdec.cond);
+    condInit(_sdec.done);
+    _sdec.opHead = _sdec.opTail = 0;
+    _sdec.late = NULL;
+    _sdec.lateUsed = _sdec.lateAvail = 0;
+    _sdec.leak = 0;
+    _sdec.idle = 0;
+    _sdec.more = 0;
+    _sdec.wake = _sdec.quit = 0;
+
+    if (threadCreateF(_sdec.thread, streamThread, NULL)) {
+        condFree(_sdec.done);
+        condFree(_sdec.cond);
+        mutexFree(_sdec.mutex);
+        return 1;
+    }
+    _sdec.up = 1;
+    return 0;
+}
+
+
+// Clean up after an op which was posted but never run.
+static void stream_discardOp(const StreamOp* op)
+{
+    if (op->code == SOP_PLAY_FILE)
+        stream_closeOpFile(op);
+    else if (op->code == SOP_RELEASE)
+        stream_releaseMem(op);
+}
+
+
+/*
+  Stop streamThread.  The audio thread must no longer be running.
+*/
+static void stream_stopThread(void)
+{
+    uint32_t i;
+
+    if (! _sdec.up)
+        return;
+
+    mutexLock(_sdec.mutex);
+    _sdec.quit = 1;
+    condSignal(_sdec.cond);
+    mutexUnlock(_sdec.mutex);
+    threadJoin(_sdec.thread);
+    _sdec.up = 0;
+
+    // Close the files & free the memory of any ops which were not run.
+    for (; _sdec.opHead != _sdec.opTail; ++_sdec.opHead)
+        stream_discardOp(_sdec.ops + (_sdec.opHead & (STREAM_OP_MAX - 1)));
+    for (i = 0; i < _sdec.lateUsed; ++i)
+        stream_discardOp(_sdec.late + i);
+    free(_sdec.late);
+    _sdec.late = NULL;
+    _sdec.lateUsed = _sdec.lateAvail = 0;
+
+    condFree(_sdec.done);
+    condFree(_sdec.cond);
+    mutexFree(_sdec.mutex);
+}
+
+//----------------------------------------------------------------------------
+
+/*
+ * Mix stereo inputs.
+ *
+ * \param output        Output buffer for the mixed samples.
+ * \param input         Array of pointers to input buffers.
+ * \param gainL         Left channel gain for each input.
+ * \param gainR         Right channel gain for each input.
+ * \param inCount       Number of inputs.
+ * \param sampleCount   Number of samples (frames*2) to mix from each input.
+ */
+void faun_mixBuffers(MixSample* output, const FaunSample** input,
+                     const float* gainL, const float* gainR,
+                     int inCount, uint32_t sampleCount)
+{
+#if defined(FAUN_FIXED)
+    MixSample* end = output + sampleCount;
+    MixSample* out;
+    const int16_t* in;
+    int32_t gL, gR;
+    int i;
+
+    if (inCount < 1) {
+        memset(output, 0, sampleCount * sizeof(MixSample));
+        return;
+    }
+
+    // The gains are converted once per input so the inner loops are
+    // integer only.
+    gL = GAIN_Q15(gainL[0]);
+    gR = GAIN_Q15(gainR[0]);
+    in = input[0];
+    for (out = output; out != end; in += 2) {
+        *out++ = MUL_Q15(in[0], gL);
+        *out++ = MUL_Q15(in[1], gR);
+    }
+
+    for (i = 1; i < inCount; ++i) {
+        gL = GAIN_Q15(gainL[i]);
+        gR = GAIN_Q15(gainR[i]);
+        in = input[i];
+        for (out = output; out != end; in += 2) {
+            *out++ += MUL_Q15(in[0], gL);
+            *out++ += MUL_Q15(in[1], gR);
+        }
+    }
+#elif defined(SIMUL_MIX)
+    float* end = output + sampleCount;
+    int initial = 1;
+
+    while (inCount > 7) {
+        inCount -= 8;
+        _mixk.mix[3](output, end, input, gainL, gainR, initial);
+        initial = 0;
+        input += 8;
+        gainL += 8;
+        gainR += 8;
+    }
+
+    if (inCount > 3) {
         inCount -= 4;
-        _mix4Stereo(output, end, input, gainL, gainR, initial);
+        _mixk.mix[2](output, end, input, gainL, gainR, initial);
         initial = 0;
         input += 4;
         gainL += 4;
         gainR += 4;
     }
 
-    switch (inCount) {
-        case 3:
-            _mix2Stereo(output, end, input, gainL, gainR, initial);
-            _mix1Stereo(output, end, input[2], gainL[2], gainR[2], 0);
-            break;
-        case 2:
-            _mix2Stereo(output, end, input, gainL, gainR, initial);
-            break;
-        case 1:
-            _mix1Stereo(output, end, input[0], gainL[0], gainR[0], initial);
-            break;
-        default:
-            if (initial)
-                memset(output, 0, sampleCount * sizeof(float));
-            break;
+    switch (inCount) {
+        case 3:
+            _mixk.mix[1](output, end, input, gainL, gainR, initial);
+            _mixk.mix[0](output, end, input+2, gainL+2, gainR+2, 0);
+            break;
+        case 2:
+            _mixk.mix[1](output, end, input, gainL, gainR, initial);
+            break;
+        case 1:
+            _mixk.mix[0](output, end, input, gainL, gainR, initial);
+            break;
+        default:
+            if (initial)
+                memset(output, 0, sampleCount * sizeof(float));
+            break;
+    }
+#else
+    float* out;
+    float* end;
+    const float* in;
+    float gainL, gainR;
+    int i;
+    int mixed = 0;
+
+    if (inCount > 0) {
+        end = output + sampleCount;
+
+        gainL = inGainL[0];
+        gainR = inGainR[0];
+        if (gainL > GAIN_SILENCE_THRESHOLD ||
+            gainR > GAIN_SILENCE_THRESHOLD) {
+            in = input[0];
+            out = output;
+            while (out != end) {
+                *out++ = *in++ * gainL;
+                *out++ = *in++ * gainR;
+            }
+            ++mixed;
+        }
+
+        for (i = 1; i < inCount; i++) {
+            gainL = inGainL[i];
+            gainR = inGainR[i];
+            if (gainL > GAIN_SILENCE_THRESHOLD ||
+                gainR > GAIN_SILENCE_THRESHOLD) {
+                in = input[i];
+                out = output;
+                while (out != end) {
+                    *out += *in++ * gainL;
+                    out++;
+                    *out += *in++ * gainR;
+                    out++;
+                }
+                ++mixed;
+            }
+        }
+    }
+
+    if (! mixed)
+        memset(output, 0, sampleCount * sizeof(float));
+#endif
+}
+
+/*
+ * Mix mono inputs into stereo output.
+ *
+ * \param output        Output buffer for the mixed samples.
+ * \param input         Array of pointers to mono input buffers.
+ * \param gainL         Left channel gain for each input.
+ * \param gainR         Right channel gain for each input.
+ * \param inCount       Number of inputs.
+ * \param sampleCount   Number of output samples (frames*2).
+ * \param init          If non-zero, the output is set rather than added to.
+ */
+static void faun_mixMono(MixSample* output, const FaunSample** input,
+                         const float* gainL, const float* gainR,
+                         int inCount, uint32_t sampleCount, int init)
+{
+    MixSample* end = output + sampleCount;
+    int i;
+#ifdef FAUN_FIXED
+    MixSample* out;
+    const int16_t* in;
+    int32_t gL, gR;
+
+    for (i = 0; i < inCount; ++i) {
+        gL = GAIN_Q15(gainL[i]);
+        gR = GAIN_Q15(gainR[i]);
+        in = input[i];
+        if (init) {
+            for (out = output; out != end; out += 2, ++in) {
+                out[0] = MUL_Q15(*in, gL);
+                out[1] = MUL_Q15(*in, gR);
+            }
+            init = 0;
+        } else {
+            for (out = output; out != end; out += 2, ++in) {
+                out[0] += MUL_Q15(*in, gL);
+                out[1] += MUL_Q15(*in, gR);
+            }
+        }
+    }
+#else
+    for (i = 0; i < inCount; ++i) {
+        _mixk.mixMono(output, end, input[i], gainL[i], gainR[i], init);
+        init = 0;
+    }
+#endif
+}
+
+//----------------------------------------------------------------------------
+
+/*
+  Fill the channel gains of a ramp (every other float) for one fading
+  channel.  The gain is stepped towards the target as for a single frame
+  at a time, and the fadeTriplet gain & delta are updated.
+
+  Return the number of frames until the fade completed or zero if it is
+  still in progress at the end of the ramp.
+*/
+static uint32_t fade_rampChan(float* ramp, uint32_t frames,
+                              float* fadeTriplet)
+{
+    float gain   = fadeTriplet[0];
+    float fade   = fadeTriplet[2];
+    float target = fadeTriplet[4];
+    float* end   = ramp + frames*2;
+    float* it    = ramp;
+
+    if (fade < 0.0f) {
+        while (it != end) {
+            *it = gain;
+            it += 2;
+            gain += fade;
+            if (gain <= target)
+                goto done;
+        }
+    } else {
+        while (it != end) {
+            *it = gain;
+            it += 2;
+            gain += fade;
+            if (gain >= target)
+                goto done;
+        }
+    }
+    fadeTriplet[0] = gain;
+    return 0;
+
+done:
+    fadeTriplet[0] = target;
+    fadeTriplet[2] = 0.0f;
+    frames = (it - ramp) / 2;
+    for (; it != end; it += 2)
+        *it = target;
+    return frames;
+}
+
+/*
+  Mix fading sources using a precomputed gain ramp for each one.
+
+  \param output    Output buffer for the mixed samples.
+  \param inputEnd  End of array of pointers to the source input samples.
+                   These are in reverse order to the src array.
+  \param src       Array of fading sources.
+  \param inCount   Number of fading sources.
+  \param frames    Number of frames to mix from each input.
+  \param ramp      Scratch memory for frames*2 gain values.
+*/
+static void faun_fadeBuffers(MixSample* output, const FaunSample** inputEnd,
+                             FaunSource** src, int inCount, uint32_t frames,
+                             float* ramp)
+{
+    FaunSource* fs;
+    float* rend = ramp + frames*2;
+    float* it;
+    uint32_t mixLen, doneL, doneR;
+    int i;
+
+    for (i = 0; i < inCount; ++i) {
+        --inputEnd;
+        fs = src[i];
+
+        if (fs->fadeL) {
+            doneL = fade_rampChan(ramp, frames, &fs->gainL);
+        } else {
+            for (it = ramp; it != rend; it += 2)
+                *it = fs->gainL;
+            doneL = 0;
+        }
+
+        if (fs->fadeR) {
+            doneR = fade_rampChan(ramp + 1, frames, &fs->gainR);
+        } else {
+            for (it = ramp + 1; it < rend; it += 2)
+                *it = fs->gainR;
+            doneR = 0;
+        }
+
+        // When fading out to end play, stop mixing once both channels
+        // have reached their targets.
+        mixLen = frames;
+        if (! fs->fadeL && ! fs->fadeR && (fs->mode & END_AFTER_FADE)) {
+            mixLen = (doneL > doneR) ? doneL : doneR;
+            fs->endPos = fs->framesOut;     // Force end of play.
+        }
+
+        MIX_RAMP(output, output + mixLen*2, *inputEnd, ramp);
+    }
+}
+
+/*
+  Mix a submix bus which is changing volume into the main bus.
+
+  \param ramp  Scratch memory for frames*2 gain values.
+*/
+static void faun_fadeBus(MixSample* output, const FaunSample* input,
+                         FaunBus* bus, uint32_t frames, float* ramp)
+{
+    float* rend = ramp + frames*2;
+    float* it;
+
+    if (bus->fadeL)
+        fade_rampChan(ramp, frames, &bus->gainL);
+    else {
+        for (it = ramp; it != rend; it += 2)
+            *it = bus->gainL;
+    }
+
+    if (bus->fadeR)
+        fade_rampChan(ramp + 1, frames, &bus->gainR);
+    else {
+        for (it = ramp + 1; it < rend; it += 2)
+            *it = bus->gainR;
+    }
+
+    MIX_RAMP(output, output + frames*2, input, ramp);
+}
+
+/*
+  Step the gains of a fading bus over frames without mixing it.
+
+  \param ramp  Scratch memory for frames*2 gain values.
+*/
+static void bus_skipFade(FaunBus* bus, uint32_t frames, float* ramp)
+{
+    if (bus->fadeL)
+        fade_rampChan(ramp, frames, &bus->gainL);
+    if (bus->fadeR)
+        fade_rampChan(ramp + 1, frames, &bus->gainR);
+}
+
+//----------------------------------------------------------------------------
+
+static void source_end(FaunSource* src)
+{
+    faun_deactivate(src, SOURCE_ID(src));
+    if (src->mode & FAUN_SIGNAL_DONE)
+        signalDone(src);
+}
+
+/*
+  Count mix frames played by a source and begin any fade out.
+  The fadePos is only checked here at the end of each update, so a fade
+  out starts on the following update rather than inside the span.
+
+  Return zero if the source has finished playing.
+*/
+static int source_advanceTime(FaunSource* src, uint32_t frames)
+{
+    uint32_t pos = src->framesOut + frames;
+
+    src->framesOut = pos;
+    if (pos >= src->endPos) {
+        source_end(src);
+        return 0;
+    }
+
+    if (pos >= src->fadePos)
+        source_fadeOut(src);
+    return 1;
+}
+
+/*
+  Advance the buffer position of a source.
+  The frames must not extend past the end of the current buffer.
+
+  Return zero if the source has finished playing.
+*/
+static int source_advanceBuffer(FaunSource* src, uint32_t frames)
+{
+    FaunBuffer* buf;
+    uint32_t pos;
+    int n;
+
+    pos = src->playPos + frames;
+    if (pos < src->buffer->used) {
+        src->playPos = pos;
+        return 1;
+    }
+
+    // Load next buffer.
+    src->playPos = 0;
+    n = src->qactive;
+    if (++n == SOURCE_QUEUE_SIZE)
+        n = 0;
+    if (n == src->qtail) {
+        //printf("FAUN tail %d\n", n);
+        if ((src->mode & FAUN_PLAY_LOOP) &&
+            ((int) SOURCE_ID(src) < _sourceLimit))
+            return 1;
+    } else {
+        buf = SOURCE_PARAM(src)->bufferQueue[n];
+        if (buf->sample.ptr) {
+            // Buffer was not freed.
+            src->qactive = n;
+            src->buffer = buf;
+            src->step = faun_step(buf, SOURCE_PARAM(src)->playRate);
+            return 1;
+        }
+    }
+
+    source_end(src);
+    return 0;
+}
+
+/*
+  Advance the play position of a source which plays at the mix rate after
+  frames have been mixed.  The frames must not extend past the end of the
+  current buffer.
+
+  Return zero if the source has finished playing.
+*/
+static int source_advance(FaunSource* src, uint32_t frames)
+{
+    return source_advanceTime(src, frames) &&
+           source_advanceBuffer(src, frames);
+}
+
+#define SOURCE_SILENT(src) \
+    (! src->fadeL && ! src->fadeR && \
+     src->gainL <= GAIN_SILENCE_THRESHOLD && \
+     src->gainR <= GAIN_SILENCE_THRESHOLD)
+
+// Sources routed to a silent bus are skipped the same as silent sources.
+#define SOURCE_MUTED(src) \
+    (SOURCE_SILENT(src) || SOURCE_SILENT((_bus + src->bus)))
+
+/*
+  Advance a source over a number of mix frames which may cross any number
+  of buffer boundaries.  This is done after the source span is mixed, and
+  is also used to keep silent sources in sync without any mixing cost.
+*/
+static void source_skip(FaunSource* src, uint32_t frames)
+{
+    FaunBuffer* buf;
+    uint32_t avail;
+    int stepped = (src->step != STEP_UNITY);
+    int playing;
+
+    if (stepped) {
+        uint64_t pos = src->playFrac + (uint64_t) frames * src->step;
+        src->playFrac = (uint16_t) (pos & 0xffff);
+        if (! source_advanceTime(src, frames))
+            return;
+        frames = (uint32_t) (pos >> 16);
+    }
+
+    while (frames) {
+        buf = src->buffer;
+        avail = buf->used - src->playPos;
+        if (avail > frames)
+            avail = frames;
+        playing = stepped ? source_advanceBuffer(src, avail)
+                          : source_advance(src, avail);
+        if (! playing)
+            break;
+        if (! avail && buf == src->buffer)
+            break;      // Looping an empty buffer.
+        frames -= avail;
+    }
+}
+
+/*
+  Unpack frames of a packed buffer to samples with the channel count of
+  the buffer.
+*/
+static void buffer_unpack(FaunSample* dst, const FaunBuffer* buf,
+                          uint32_t pos, uint32_t frames)
+{
+    int chan = faun_channelCount(buf->chanLayout);
+
+    if (buf->format == FAUN_ADPCM)
+        adpcm_decode(dst, buf->sample.u8, chan, pos, frames);
+#ifndef FAUN_FIXED
+    else
+        _mixk.unpackS16(dst, buf->sample.s16 + pos*chan, frames*chan);
+#endif
+}
+
+/*
+  Copy buffer frames as stereo samples.  Mono frames are duplicated to both
+  channels.
+*/
+static void buffer_copyStereo(FaunSample* dst, const FaunBuffer* buf,
+                              uint32_t pos, uint32_t frames)
+{
+    const FaunSample* src;
+    const FaunSample* end;
+
+    if (BUFFER_PACKED(buf)) {
+        if (buf->chanLayout != FAUN_CHAN_1) {
+            buffer_unpack(dst, buf, pos, frames);
+            return;
+        }
+        // Unpack into the upper half and expand it in place.
+        src = dst + frames;
+        buffer_unpack(dst + frames, buf, pos, frames);
+    } else {
+        src = (const FaunSample*) buf->sample.ptr;
+        if (buf->chanLayout != FAUN_CHAN_1) {
+            memcpy(dst, src + pos*2, frames*2*sizeof(FaunSample));
+            return;
+        }
+        src += pos;
+    }
+
+    end = src + frames;
+    for (; src != end; ++src, dst += 2)
+        dst[0] = dst[1] = *src;
+}
+
+/*
+  Get the input samples of a source for the next buffer frames.
+
+  If the current buffer holds all the frames and is not packed then a
+  pointer into it is returned.  Otherwise the samples are gathered from the
+  buffer queue into the span memory, following the same rules as
+  source_advance(), and any frames after the source ends are zeroed.  The
+  source itself is not modified.
+
+  \param limit  Number of frames until the source ends.
+  \param span   Memory for frames*2 samples.
+  \param mono   If not NULL, a mono buffer which holds all the frames is
+                returned directly as one channel and *mono is set to 1.
+                Otherwise the samples are always stereo.
+  \param live   Set to the number of frames before any zeroed ones.
+*/
+static const FaunSample* source_span(const FaunSource* src, uint32_t frames,
+                                     uint32_t limit, FaunSample* span,
+                                     int* mono, uint32_t* live)
+{
+    const FaunBuffer* buf = src->buffer;
+    uint32_t pos = src->playPos;
+    uint32_t avail = buf->used - pos;
+    FaunSample* dst = span;
+    int q, next;
+
+    *live = frames;
+    if (avail >= frames) {
+        if (mono && buf->chanLayout == FAUN_CHAN_1) {
+            *mono = 1;
+            if (! BUFFER_PACKED(buf))
+                return (const FaunSample*) buf->sample.ptr + pos;
+            buffer_unpack(span, buf, pos, frames);
+            return span;
+        }
+        if (buf->chanLayout != FAUN_CHAN_1 && ! BUFFER_PACKED(buf))
+            return (const FaunSample*) buf->sample.ptr + pos*2;
+        buffer_copyStereo(span, buf, pos, frames);
+        return span;
     }
-#else
-    float* out;
-    float* end;
-    const float* in;
-    float gainL, gainR;
-    int i;
-    int mixed = 0;
 
-    if (inCount > 0) {
-        end = output + sampleCount;
+    q = src->qactive;
+    for (;;) {
+        buffer_copyStereo(dst, buf, pos, avail);
+        dst += avail*2;
+        frames -= avail;
 
-        gainL = inGainL[0];
-        gainR = inGainR[0];
-        if (gainL > GAIN_SILENCE_THRESHOLD ||
-            gainR > GAIN_SILENCE_THRESHOLD) {
-            in = input[0];
-            out = output;
-            while (out != end) {
-                *out++ = *in++ * gainL;
-                *out++ = *in++ * gainR;
-            }
-            ++mixed;
+        if (avail >= limit)
+            break;
+        limit -= avail;
+
+        pos = 0;
+        next = q + 1;
+        if (next == SOURCE_QUEUE_SIZE)
+            next = 0;
+        if (next == src->qtail) {
+            if (! (src->mode & FAUN_PLAY_LOOP) ||
+                (int) SOURCE_ID(src) >= _sourceLimit || ! buf->used)
+                break;
+        } else {
+            buf = SOURCE_PARAM(src)->bufferQueue[next];
+            if (! buf->sample.ptr)
+                break;
+            q = next;
         }
 
-        for (i = 1; i < inCount; i++) {
-            gainL = inGainL[i];
-            gainR = inGainR[i];
-            if (gainL > GAIN_SILENCE_THRESHOLD ||
-                gainR > GAIN_SILENCE_THRESHOLD) {
-                in = input[i];
-                out = output;
-                while (out != end) {
-                    *out += *in++ * gainL;
-                    out++;
-                    *out += *in++ * gainR;
-                    out++;
-                }
-                ++mixed;
-            }
+        avail = buf->used;
+        if (avail >= frames) {
+            buffer_copyStereo(dst, buf, 0, frames);
+            return span;
         }
     }
 
-    if (! mixed)
-        memset(output, 0, sampleCount * sizeof(float));
-#endif
+    *live -= frames;
+    memset(dst, 0, frames*2*sizeof(FaunSample));
+    return span;
 }
 
-//----------------------------------------------------------------------------
+/*
+  Get the input samples of a source for the next frames of the mix.
+
+  Sources which are not playing at the mix rate are interpolated from
+  the buffer frames into the span memory.  When the queue switches to a
+  buffer of another rate within the frames, the step of the first buffer
+  is used for both.
+
+  \param span    Memory for frames*2 samples.
+  \param gather  Memory for (frames * STEP_MAX / STEP_UNITY + 2) * 2
+                 samples.
+  \param mono    If not NULL, mono input may be returned as with
+                 source_span().  Interpolated input is always stereo.
+  \param live    Set to the number of frames before the source ends.
+*/
+static const FaunSample* source_input(const FaunSource* src, uint32_t frames,
+                                      FaunSample* span, FaunSample* gather,
+                                      int* mono, uint32_t* live)
+{
+    const FaunSample* in;
+    uint32_t limit = src->endPos - src->framesOut;
+    uint32_t n;
+
+    if (src->step == STEP_UNITY)
+        return source_span(src, frames, limit, span, mono, live);
+
+    n = (uint32_t) ((src->playFrac + (uint64_t) (frames - 1) * src->step)
+                    >> 16) + 2;
+    in = source_span(src, n, END_POS_NONE, gather, NULL, live);
+    MIX_INTERP(span, frames, in, src->playFrac, src->step);
+
+    *live = frames;
+    if (limit < frames) {
+        memset(span + limit*2, 0, (frames - limit)*2*sizeof(FaunSample));
+        *live = limit;
+    }
+    return span;
+}
 
 static void faun_evalProg(FaunProgram* prog, uint32_t mixClock)
 {
@@ -1449,7 +3712,7 @@ static void faun_evalProg(FaunProgram* prog, uint32_t mixClock)
                 return;
 
             case FO_WAIT:
-                prog->waitPos = mixClock + (*pc++) * 4410;
+                prog->waitPos = mixClock + (*pc++) * (_voice.mix.rate / 10);
                 prog->pc = pc - prog->code;
                 return;
 
@@ -1458,12 +3721,16 @@ static void faun_evalProg(FaunProgram* prog, uint32_t mixClock)
                 break;
 
             case FO_QUEUE:
-                if (prog->si < _sourceLimit)
-                    faun_queueBuffer(_asource + prog->si, _abuffer + (*pc++));
+                if (prog->si < _sourceLimit &&
+                    _abuffer[*pc].format != FAUN_VORBIS)
+                    faun_queueBuffer(_asource + prog->si, _abuffer + *pc);
+                ++pc;
                 break;
 
             case FO_PLAY_BUF:
-                if (prog->si < _sourceLimit)
+                // Streams can only play compressed buffers.
+                if (prog->si < _sourceLimit ||
+                    _abuffer[pc[0]].format == FAUN_VORBIS)
                     cmd_playSource(prog->si, pc[0], pc[1], prog->si);
                 pc += 2;
                 break;
@@ -1471,24 +3738,25 @@ static void faun_evalProg(FaunProgram* prog, uint32_t mixClock)
             case FO_START_STREAM:
                 if (prog->si >= _sourceLimit) {
                     source_setMode(_asource + prog->si, pc[0]);
-                    stream_start(_stream + (prog->si - _sourceLimit));
+                    cmd_startStream(prog->si);
                 }
                 ++pc;
                 break;
 
             case FO_SET_VOL:
                 // Set playVolume parameter; current volume is not changed.
-                _asource[prog->si].playVolume = (float) (*pc++) / 255.0f;
+                _aparam[prog->si].playVolume = (float) (*pc++) / 255.0f;
                 break;
 
             case FO_SET_FADE:
-                _asource[prog->si].fadePeriod = (float) (*pc++) / 10.0f;
+                _aparam[prog->si].fadePeriod = (float) (*pc++) / 10.0f;
                 break;
 
             case FO_SET_END:
             {
                 uint32_t pos = *pc++;
-                _asource[prog->si].endPos = pos ? pos * 4410 : END_POS_NONE;
+                _asource[prog->si].endPos =
+                    pos ? pos * (_voice.mix.rate / 10) : END_POS_NONE;
             }
                 break;
 
@@ -1519,7 +3787,7 @@ static void faun_evalProg(FaunProgram* prog, uint32_t mixClock)
             case FO_FADE_IN:
                 src = _asource + prog->si;
                 src->gainL = src->gainR = 0.0f;
-                src->targetL = src->targetR = src->playVolume;
+                src->targetL = src->targetR = _aparam[prog->si].playVolume;
                 source_setFadeDeltas(src);
                 break;
 
@@ -1553,12 +3821,16 @@ static void faun_evalProg(FaunProgram* prog, uint32_t mixClock)
             }
                 break;
 
+            case FO_SET_RATE:
+                source_setRate(prog->si, (float) (*pc++) / 100.0f);
+                break;
+
             case FO_CAPTURE:
 #ifdef CAPTURE
             {
                 char* outfile = getenv("FAUN_CAPTURE");
                 if (outfile && wfp == NULL) {
-                    wfp = wav_open(outfile, 44100 /*voice->mix.rate*/, 16, 2);
+                    wfp = wav_open(outfile, _voice.mix.rate, 16, 2);
                     endOnSignal = endCapture = 0;
                 }
             }
@@ -1568,14 +3840,14 @@ static void faun_evalProg(FaunProgram* prog, uint32_t mixClock)
             case FO_SET_VOL_f:
             {
                 const float* farg = (float*) prog->code;
-                _asource[prog->si].playVolume = farg[ *pc++ ];
+                _aparam[prog->si].playVolume = farg[ *pc++ ];
             }
                 break;
 
             case FO_SET_FADE_f:
             {
                 const float* farg = (float*) prog->code;
-                _asource[prog->si].fadePeriod = farg[ *pc++ ];
+                _aparam[prog->si].fadePeriod = farg[ *pc++ ];
             }
                 break;
 
@@ -1608,6 +3880,12 @@ static void faun_evalProg(FaunProgram* prog, uint32_t mixClock)
 
 //#include "cpuCounter.h"
 
+// True if a submix bus is a plain input to the main bus (see faun_fadeBus()).
+#define BUS_INPUT(bus) \
+    (! (bus)->fadeL && ! (bus)->fadeR && \
+     ((bus)->gainL > GAIN_SILENCE_THRESHOLD || \
+      (bus)->gainR > GAIN_SILENCE_THRESHOLD))
+
 #ifdef _WIN32
 static DWORD WINAPI audioThread(LPVOID arg)
 #else
@@ -1621,17 +3899,33 @@ static void* audioThread(void* arg)
     StreamOV* st;
     FaunSource** mixSource;
     FaunSource** fadeSource;
-    const float** input;
+    const FaunSample** input;
+    const FaunSample** monoInput;
+    const FaunSample** srcInput;
+    uint32_t* srcLive;
+    int* srcMono;
     float* inputGainL;
     float* inputGainR;
+    float* monoGainL;
+    float* monoGainR;
+    float* fadeRamp;
+    FaunSample* spanMem;
+    FaunSample* gatherMem;
+    MixSample* busMix;
+    MixSample* out;
+    int16_t* outS16 = NULL;
+#ifndef FAUN_FIXED
+    Limiter* limiter = NULL;
+    uint32_t ditherSeed[DITHER_LANES] = {
+        0x9e3779b9, 0x7f4a7c15, 0x85ebca6b, 0xc2b2ae35
+    };
+#endif
     const char* error;
     char cmdBuf[sizeof(CommandF) * 2];
     CommandA* cmd = (CommandA*) cmdBuf;
     int sourceCount;
     uint32_t mixed;
     uint32_t totalMixed = 0;    // Wraps after 27 hours.
-    uint32_t fragmentLen;
-    uint32_t samplesAvail;
     uint32_t mixSampleLen = voice->mix.used;
     uint32_t fileChunkSizeArg = 0;
     int i;
@@ -1639,11 +3933,14 @@ static void* audioThread(void* arg)
     MsgTime ts;
     int updateMs = 1000/voice->updateHz - 2;
     int sleepTime = updateMs;
-    int scount;
-    int n, fn;
+    int scount, inLimit;
+    int n, fn, mn, b;
+    uint32_t seg, segEnd;
+    uint32_t busMask;
+    int monoOk;
 
 #ifdef CPUCOUNTER_H
-    uint64_t t0, tp, tc, tm, tw;
+    uint64_t t0, tp, tc, tm, tl, tw;
 #define COUNTER(V)  V = cpuCounter()
 #else
 #define COUNTER(V)
@@ -1653,12 +3950,40 @@ static void* audioThread(void* arg)
     CoInitializeEx(NULL, COINIT_MULTITHREADED);
 #endif
 
+    // The main bus has the submix buses as additional inputs.
     n = scount = _sourceLimit + _streamLimit;
-    mixSource  = (FaunSource**) malloc(n * sizeof(void*) * 5);
+    inLimit = scount + FAUN_BUS_MAX;
+    mixSource  = (FaunSource**) malloc((n*4 + inLimit) * sizeof(void*) +
+                                       (inLimit + n) * 2 * sizeof(float) +
+                                       n * (sizeof(uint32_t) + sizeof(int)));
     fadeSource = mixSource + n;
-    input      = (const float**) (fadeSource + n);
-    inputGainL = (float*) (input + n);
-    inputGainR = inputGainL + n;
+    input      = (const FaunSample**) (fadeSource + n);
+    monoInput  = input + inLimit;
+    srcInput   = monoInput + n;
+    inputGainL = (float*) (srcInput + n);
+    inputGainR = inputGainL + inLimit;
+    monoGainL  = inputGainR + inLimit;
+    monoGainR  = monoGainL + n;
+    srcLive    = (uint32_t*) (monoGainR + n);
+    srcMono    = (int*) (srcLive + n);
+    fadeRamp   = (float*) malloc((n + FAUN_BUS_MAX) * mixSampleLen * 2 *
+                                 sizeof(float));
+    gatherMem  = (FaunSample*) malloc((mixSampleLen * (STEP_MAX / STEP_UNITY)
+                                       + 2) * 2 * sizeof(FaunSample));
+    if (voice->outFormat == FAUN_S16)
+        outS16 = (int16_t*) malloc(mixSampleLen * 2 * sizeof(int16_t));
+    if (! mixSource || ! fadeRamp || ! gatherMem ||
+        (voice->outFormat == FAUN_S16 && ! outS16)) {
+        fprintf(_errStream, "audioThread out of memory\n");
+        goto cleanup;
+    }
+    spanMem    = (FaunSample*) (fadeRamp + mixSampleLen * 2);
+    busMix     = (MixSample*) (fadeRamp + (n + 1) * mixSampleLen * 2);
+#ifndef FAUN_FIXED
+    if (_limitPercent && mixSampleLen >= LIMIT_DELAY)
+        limiter = limiter_alloc(_limitPercent * 0.01f, voice->mix.rate,
+                                mixSampleLen);
+#endif
 
     tmsg_setTimespec(&ts, sleepTime);
 
@@ -1728,26 +4053,60 @@ read_prog:
                     goto read_prog;
 
                 case CMD_SET_BUFFER:
+                {
+                    uint32_t tag;
                     //printf("CMD set buffer bi:%d cmdPart:%d\n",
                     //       cmd->select, cmdPart);
                     buf = _abuffer + cmd->select;
-                    free(buf->sample.ptr);
+                    faun_freeSamples(buf);
+
+                    // Command contains sample, used, rate, chanLayout,
+                    // format, & arena tag.  The samples have been converted
+                    // to the mix format or a packed format by
+                    // _cmdSetBuffer().
+                    memcpy(&buf->sample.ptr, cmdBuf + 2, sizeof(void*));
+                    memcpy(&buf->used, cmdBuf + 2 + sizeof(void*), 8);
+                    buf->chanLayout = cmdBuf[10 + sizeof(void*)];
+                    buf->format     = cmdBuf[11 + sizeof(void*)];
+                    memcpy(&tag, cmdBuf + 12 + sizeof(void*), 4);
+
+                    // Samples in an arena freed since they were loaded are
+                    // already gone.
+                    if (tag && ARENA_GEN(tag) < _arenaGenA[ARENA_ID(tag) - 1]) {
+                        buf->sample.ptr = NULL;
+                        buf->used = 0;
+                    }
+                    buf->avail = buf->used;
                     faun_detachBuffers();
-
-                    // Command contains sample, avail, & used members.
-                    memcpy(buf, cmdBuf + 2, 16);
-
-                    // The other parameters match _allocBufferVoice().
-                    buf->rate = voice->mix.rate;
-                    buf->format = FAUN_F32;
-                    buf->chanLayout = FAUN_CHAN_2;
+                }
                     break;
 
                 case CMD_BUFFERS_FREE:
-                    faun_freeBufferSamples(cmd->ext, _abuffer + cmd->select);
+                    buf = _abuffer + cmd->select;
+                    for (i = 0; i < cmd->ext; ++i)
+                        faun_freeSamples(buf + i);
                     faun_detachBuffers();
                     break;
 
+                case CMD_ARENA_FREE:
+                {
+                    // Argument is a block list or a bank mapping & size.
+                    void* mem;
+                    size_t mapSize;
+                    memcpy(&mem, &cmd->arg, sizeof(void*));
+                    memcpy(&mapSize, cmdBuf + 4 + sizeof(void*),
+                           sizeof(size_t));
+                    i = cmd->select - 1;
+                    faun_dropArenaBuffers(ARENA_TAG(cmd->select,
+                                                    _arenaGenA[i]));
+                    ++_arenaGenA[i];
+                    if (mapSize)
+                        stream_release(SREL_BANK, mem, mapSize);
+                    else
+                        stream_release(SREL_BLOCKS, mem, 0);
+                }
+                    break;
+
                 case CMD_PLAY_SOURCE:
                     src = _asource + cmd->select;
                     cmd_playSource(cmd->select, cmd->arg.u32[0], cmd->ext,
@@ -1786,6 +4145,15 @@ read_prog:
                 }
                     break;
 
+                case CMD_OPEN_STREAM_MEM:
+                {
+                    const uint8_t* data;
+                    memcpy(&data, &cmd->arg.u32[1], sizeof(void*));
+                    cmd_playStreamMem(cmd->select, data, cmd->arg.u32[3],
+                                      NULL, cmd->ext, cmd->arg.u32[0]);
+                }
+                    break;
+
                 case CMD_PLAY_STREAM_PART:
                 {
                     double d[2];
@@ -1800,35 +4168,35 @@ read_prog:
                     src = _asource + cmd->select;
                     src->targetL    = cmd->arg.f[0];
                     src->targetR    = cmd->arg.f[1];
-                    src->fadePeriod = cmd->arg.f[2];
+                    _aparam[cmd->select].fadePeriod = cmd->arg.f[2];
                     source_setFadeDeltas(src);
                     break;
 
                 case CMD_CON_START:
                 case CMD_CON_STOP:
                 case CMD_CON_RESUME:
-                    i = cmd->select;
-                    n = i + cmd->ext;
-                    for ( ; i < n; ++i) {
-                        src = _asource + i;
-                        if (src->qactive != QACTIVE_NONE) {
-                            src->state = (cmd->op == CMD_CON_STOP) ?
-                                            SS_STOPPED : SS_PLAYING;
-                        }
-                    }
-                    break;
-
                 case CMD_CON_FADE_OUT:
                     //printf("CMD control %x %d\n", cmd->select,
                     //        cmd->op - CMD_CON_START);
                     i = cmd->select;
                     n = i + cmd->ext;
-                    for ( ; i < n; ++i) {
+                    for ( ; i < n; ++i)
+                        source_control(_asource + i, cmd->op);
+                    break;
+
+                case CMD_BUS_CONTROL:
+                    for (i = 0; i < scount; ++i) {
                         src = _asource + i;
-                        source_fadeOut(src);
+                        if (src->bus == cmd->select)
+                            source_control(src, cmd->ext + CMD_CON_START);
                     }
                     break;
 
+                case CMD_BUS_VOLUME:
+                    bus_setVolume(_bus + cmd->select,
+                                  cmd->arg.f[0], cmd->arg.f[1]);
+                    break;
+
                 case CMD_PARAM_VOLUME:
                 case CMD_PARAM_VOLUME_APPLY:
                     //printf("CMD param-vol %d:%d %f\n",
@@ -1836,24 +4204,21 @@ read_prog:
                 {
                     float vol = cmd->arg.f[0];
                     int apply = (cmd->op == CMD_PARAM_VOLUME_APPLY);
-                    src = _asource + cmd->select;
-                    n = cmd->ext;
-                    while (n--) {
-                        src->playVolume = vol;
+                    i = cmd->select;
+                    n = i + cmd->ext;
+                    for ( ; i < n; ++i) {
+                        _aparam[i].playVolume = vol;
                         if (apply)
-                            source_setGain(src, vol, vol);
-                        ++src;
+                            source_setGain(_asource + i, vol, vol);
                     }
                 }
                     break;
 
                 case CMD_PARAM_FADE_PERIOD:
-                    src = _asource + cmd->select;
-                    n = cmd->ext;
-                    while (n--) {
-                        src->fadePeriod = cmd->arg.f[0];
-                        ++src;
-                    }
+                    i = cmd->select;
+                    n = i + cmd->ext;
+                    for ( ; i < n; ++i)
+                        _aparam[i].fadePeriod = cmd->arg.f[0];
                     break;
 
                 case CMD_PARAM_END_TIME:
@@ -1861,7 +4226,35 @@ read_prog:
                     if (cmd->arg.f[0] <= 0.01f)
                         src->endPos = END_POS_NONE;
                     else
-                        src->endPos = (uint32_t) (44100.0f * cmd->arg.f[0]);
+                        src->endPos = (uint32_t) (voice->mix.rate *
+                                                  cmd->arg.f[0]);
+                    break;
+
+                case CMD_PARAM_BUS:
+                    b = (int) cmd->arg.f[0];
+                    if (b < 0 || b >= FAUN_BUS_MAX)
+                        break;
+                    i = cmd->select;
+                    n = i + cmd->ext;
+                    for ( ; i < n; ++i)
+                        _asource[i].bus = b;
+                    break;
+
+                case CMD_PARAM_PLAYBACK_RATE:
+                    i = cmd->select;
+                    n = i + cmd->ext;
+                    for ( ; i < n; ++i)
+                        source_setRate(i, cmd->arg.f[0]);
+                    break;
+
+                case CMD_PARAM_PRIORITY:
+                    i = cmd->select;
+                    n = i + cmd->ext;
+                    if (i < _sourceLimit)
+                        i = _sourceLimit;
+                    b = limitU((int) cmd->arg.f[0], STREAM_PRIORITY_MAX);
+                    for ( ; i < n; ++i)
+                        _stream[i - _sourceLimit].priority = b;
                     break;
             }
             continue;
@@ -1882,6 +4275,7 @@ read_prog:
 
         // Collect active sources.
         sourceCount = 0;
+        busMask = 1;
         for (i = 0; i < _sourceLimit; ++i)
         {
             src = _asource + i;
@@ -1889,149 +4283,242 @@ read_prog:
             {
                 //if (src->fadeL || src->fadeR)
                 //    source_fade(src, NULL);
-                if (src->qactive != QACTIVE_NONE)
-                    mixSource[sourceCount++] = src;
+                if (src->qactive != QACTIVE_NONE) {
+                    if (SOURCE_MUTED(src))
+                        source_skip(src, mixSampleLen);
+                    else {
+                        mixSource[sourceCount++] = src;
+                        busMask |= 1 << src->bus;
+                    }
+                }
             }
         }
 
-        // Read streams and collect their sources.
+        // Swap buffers with streamThread and collect the stream sources.
+        // A stream which is waiting on its ops is not mixed or advanced.
+        stream_flushOps();
         n = 0;
         for (i = 0; i < _streamLimit; ++i)
         {
             st = _stream + i;
             src = _asource + st->sindex;
+            if (st->startPending) {
+#ifdef CAPTURE
+                // While capturing, a stream begins on the update its op was
+                // posted so that the output does not depend on how quickly
+                // streamThread runs it.  Only these updates wait.
+                if (wfp)
+                    stream_waitOps(st->opWait);
+#endif
+                if (! STREAM_OPS_RUN(st->opWait))
+                    continue;
+                stream_begin(st, src);
+            }
             if (src->state == SS_PLAYING)
             {
                 //if (src->fadeL || src->fadeR)
                 //    source_fade(src, st);
-                if (st->feed && st->chunk.cfile) {
-                    // Decoding only one stream per loop unless some streams
-                    // have no previously filled buffer to play.
-
-                    if (n == 0 || src->qactive == QACTIVE_NONE)
-                        n += stream_fillBuffers(st);
+                if (stream_collect(st, src, mixSampleLen, &n)) {
+                    if (SOURCE_MUTED(src))
+                        source_skip(src, mixSampleLen);
+                    else {
+                        mixSource[sourceCount++] = src;
+                        busMask |= 1 << src->bus;
+                    }
                 }
-                if (src->qactive != QACTIVE_NONE)
-                    mixSource[sourceCount++] = src;
             }
         }
+        if (n || _sdec.more)
+            stream_wake();
         //printf("KR sbuf %d\n", n);
 
         COUNTER(tc);
 
-        // Mix active sources into voice buffer.
-        for (mixed = 0; mixed < mixSampleLen; )
+        // Mix active sources into their bus buffers, with the main bus
+        // (the voice buffer) last.  Each source provides one contiguous
+        // span of input for the whole update, so buffer boundaries do not
+        // split the mix into multiple passes.
+        for (b = FAUN_BUS_MAX - 1; b >= 0; --b)
         {
-            // Determine size of fragment for this mix pass.
-            fragmentLen = mixSampleLen - mixed;
-            n = fn = 0;
+            if (! (busMask & (1 << b)))
+                continue;
+
+            if (b)
+                out = busMix + (b - 1) * mixSampleLen*2;
+            else
+                out = (MixSample*) voice->mix.sample.ptr;
+
+#ifdef FAUN_FIXED
+            // Integer sums are the same in any order.
+            monoOk = 1;
+#else
+            // faun_mixMono() adds its inputs after the stereo ones, so mono
+            // input is only kept as one channel when it is the sole input
+            // which is not fading.  Otherwise it is expanded to stereo and
+            // summed in source order.
+            n = 0;
+            if (! b) {
+                for (i = 1; i < FAUN_BUS_MAX; ++i) {
+                    if ((busMask & (1 << i)) && BUS_INPUT(_bus + i))
+                        ++n;
+                }
+            }
+            for (i = 0; i < sourceCount; ++i) {
+                src = mixSource[i];
+                if (src->bus == b && ! src->fadeL && ! src->fadeR)
+                    ++n;
+            }
+            monoOk = (n == 1);
+#endif
+
             for (i = 0; i < sourceCount; ++i)
             {
                 src = mixSource[i];
-                if (src->qactive != QACTIVE_NONE)
+                if (src->bus != b)
+                    continue;
+                srcMono[i] = 0;
+                srcInput[i] = source_input(src, mixSampleLen,
+                                           spanMem + i*mixSampleLen*2,
+                                           gatherMem,
+                                           (monoOk && ! src->fadeL &&
+                                            ! src->fadeR) ? srcMono + i : NULL,
+                                           srcLive + i);
+
+                REPORT_MIX("     mix source %d qactive:%d pos:%d\n",
+                           i, src->qactive, src->playPos);
+            }
+
+            // A source which ends within the update is only mixed up to its
+            // end.  The update is split into passes where the set of inputs
+            // changes so that each frame sums the inputs in the same order
+            // as when the source was dropped at the end of its buffer.
+            for (seg = 0; seg < mixSampleLen; seg = segEnd)
+            {
+                segEnd = mixSampleLen;
+                for (i = 0; i < sourceCount; ++i) {
+                    if (mixSource[i]->bus == b &&
+                        srcLive[i] > seg && srcLive[i] < segEnd)
+                        segEnd = srcLive[i];
+                }
+
+                n = fn = mn = 0;
+                if (! b) {
+                    // Submix buses are inputs to the main bus.
+                    for (i = 1; i < FAUN_BUS_MAX; ++i) {
+                        FaunBus* bus = _bus + i;
+                        if ((busMask & (1 << i)) && BUS_INPUT(bus)) {
+                            input[n] = (const FaunSample*)
+                                (busMix + ((i - 1) * mixSampleLen + seg)*2);
+                            inputGainL[n] = bus->gainL;
+                            inputGainR[n] = bus->gainR;
+                            ++n;
+                        }
+                    }
+                }
+
+                for (i = 0; i < sourceCount; ++i)
                 {
-                    buf = src->bufferQueue[src->qactive];
+                    src = mixSource[i];
+                    if (src->bus != b || srcLive[i] <= seg)
+                        continue;
                     if (src->fadeL || src->fadeR) {
                         fadeSource[fn++] = src;
-                        input[scount - fn] = buf->sample.f32 + src->playPos*2;
+                        input[inLimit - fn] = srcInput[i] + seg*2;
+                    } else if (srcMono[i]) {
+                        monoInput[mn] = srcInput[i] + seg;
+                        monoGainL[mn] = src->gainL;
+                        monoGainR[mn] = src->gainR;
+                        ++mn;
                     } else {
-                        input[n] = buf->sample.f32 + src->playPos*2;
+                        input[n] = srcInput[i] + seg*2;
                         inputGainL[n] = src->gainL;
                         inputGainR[n] = src->gainR;
                         ++n;
                     }
-
-                    samplesAvail = buf->used - src->playPos;
-                    if (samplesAvail < fragmentLen)
-                        fragmentLen = samplesAvail;
                 }
 
-                REPORT_MIX("     mix source %d qactive:%d pos:%d\n",
-                           i, src->qactive, src->playPos);
-            }
-
-            // Mix fragment.
-            REPORT_MIX("FAUN mixBuffers count:%d mixed:%4d/%d frag:%4d\n",
-                       sourceCount, mixed, mixSampleLen, fragmentLen);
-            {
-            float* voiceSamples = voice->mix.sample.f32 + mixed*2;
-            faun_mixBuffers(voiceSamples, input,
-                            inputGainL, inputGainR, n, fragmentLen*2);
-            if (fn) {
-                faun_fadeBuffers(voiceSamples, input + scount,
-                                 fadeSource, fn, fragmentLen*2);
-            }
+                REPORT_MIX("FAUN mixBuffers bus:%d count:%d frames:%d-%d\n",
+                           b, n + mn + fn, seg, segEnd);
+                if (n || ! mn)
+                    faun_mixBuffers(out + seg*2, input,
+                                    inputGainL, inputGainR, n,
+                                    (segEnd - seg)*2);
+                if (mn)
+                    faun_mixMono(out + seg*2, monoInput, monoGainL, monoGainR,
+                                 mn, (segEnd - seg)*2, ! n);
+                if (fn) {
+                    faun_fadeBuffers(out + seg*2, input + inLimit,
+                                     fadeSource, fn, segEnd - seg, fadeRamp);
+                }
             }
+#ifdef FAUN_FIXED
+            // Submixes become 16-bit inputs to the main bus.
+            if (b)
+                faun_saturateS16((int16_t*) out, out, mixSampleLen*2);
+#endif
+        }
 
-            // Advance play positions.
-            for (i = 0; i < sourceCount; ++i)
-            {
-                src = mixSource[i];
-                if (src->qactive != QACTIVE_NONE)
-                {
-                    uint32_t pos = src->framesOut + fragmentLen;
-
-                    src->framesOut = pos;
-                    if (pos >= src->endPos)
-                    {
-end_play:
-                        faun_deactivate(src, SOURCE_ID(src));
-                        if (src->mode & FAUN_SIGNAL_DONE)
-                            signalDone(src);
-                    }
-                    else
-                    {
-                        if (pos >= src->fadePos)
-                            source_fadeOut(src);
-
-                        pos = src->playPos + fragmentLen;
-                        buf = src->bufferQueue[src->qactive];
-                        if (pos >= buf->used)
-                        {
-                            // Load next buffer.
-                            src->playPos = 0;
-                            n = src->qactive;
-                            if (++n == SOURCE_QUEUE_SIZE)
-                                n = 0;
-                            if (n == src->qtail) {
-                                //printf("FAUN tail %d\n", n);
-                                if ((src->mode & FAUN_PLAY_LOOP) &&
-                                    ((int) SOURCE_ID(src) < _sourceLimit))
-                                    continue;
-                                goto end_play;
-                            } else {
-                                // Abort if a buffer was freed.
-                                if (! src->bufferQueue[n]->sample.ptr)
-                                    goto end_play;
-                                src->qactive = n;
-                            }
-                        }
-                        else
-                            src->playPos = pos;
-                    }
-                }
+        for (b = 1; b < FAUN_BUS_MAX; ++b)
+        {
+            FaunBus* bus = _bus + b;
+            if (! bus->fadeL && ! bus->fadeR)
+                continue;
+            if (busMask & (1 << b)) {
+                faun_fadeBus((MixSample*) voice->mix.sample.ptr,
+                             (const FaunSample*)
+                             (busMix + (b - 1) * mixSampleLen*2),
+                             bus, mixSampleLen, fadeRamp);
+            } else {
+                // Keep the fade in time while the bus has no input.
+                bus_skipFade(bus, mixSampleLen, fadeRamp);
             }
-            mixed += fragmentLen;
-            totalMixed += fragmentLen;
         }
 
+        // Advance play positions.
+        for (i = 0; i < sourceCount; ++i)
+            source_skip(mixSource[i], mixSampleLen);
+        mixed = mixSampleLen;
+        totalMixed += mixed;
+
         // Send final mix to audio system.
 
         COUNTER(tm);
-        error = sysaudio_write(voice, voice->mix.sample.f32,
-                               mixed*2 * sizeof(float));
+#ifndef FAUN_FIXED
+        if (limiter)
+            limiter_process(limiter, voice->mix.sample.f32, mixed);
+#endif
+
+        COUNTER(tl);
+        if (outS16) {
+#ifdef FAUN_FIXED
+            faun_saturateS16(outS16, (int32_t*) voice->mix.sample.ptr,
+                             mixed*2);
+#else
+            _mixk.outputS16(outS16, voice->mix.sample.f32, mixed*2,
+                            ditherSeed);
+#endif
+            error = sysaudio_write(voice, outS16, mixed*2 * sizeof(int16_t));
+        } else {
+            error = sysaudio_write(voice, voice->mix.sample.f32,
+                                   mixed*2 * sizeof(float));
+        }
 #ifdef CPUCOUNTER_H
         COUNTER(tw);
         printf("CT col   %9ld\n"
                "CT mix   %9ld\n"
-               "CT write %9ld\n", tc - tp, tm - tc, tw - tm);
+               "CT lim   %9ld\n"
+               "CT write %9ld\n", tc - tp, tm - tc, tl - tm, tw - tl);
 #endif
         if (error)
             fprintf(_errStream, "Faun sysaudio_write: %s\n", error);
 
 #ifdef CAPTURE
         if (wfp) {
+#ifdef FAUN_FIXED
+            wav_writeS16(wfp, outS16, mixed*2);
+#else
             wav_write(wfp, voice->mix.sample.f32, mixed*2);
+#endif
             if (endCapture) {
                 wav_close(wfp);
                 wfp = NULL;
@@ -2049,6 +4536,12 @@ cleanup:
         wfp = NULL;
     }
 #endif
+#ifndef FAUN_FIXED
+    free(limiter);
+#endif
+    free(outS16);
+    free(gatherMem);
+    free(fadeRamp);
     free(mixSource);
 #ifdef _WIN32
     CoUninitialize();
@@ -2096,6 +4589,9 @@ static void faun_command2(int op, int select)
   \def FAUN_PROGRAM_MAX
   The maximum number of bytes for the faun_program() length.
 
+  \def FAUN_BUS_MAX
+  The number of buses which sources & streams can be routed to.
+
   \def FAUN_PAIR(a,b)
   Used with faun_playSource() to queue two buffers that will be played
   sequentially.
@@ -2143,6 +4639,8 @@ static void faun_command2(int op, int select)
   \var FaunPlayMode::FAUN_PLAY_FADE_OUT
   Decreases gain to 0.0 gradually just before the source or stream ends.
   The fade period is set by #FAUN_FADE_PERIOD.
+  The fade begins with the first mix update after the fade start position
+  is reached, so it may begin up to one update period late.
 
   \var FaunPlayMode::FAUN_PLAY_FADE
   Used to set both #FAUN_PLAY_FADE_IN & #FAUN_PLAY_FADE_OUT.
@@ -2175,6 +4673,12 @@ static void faun_command2(int op, int select)
   ends.  The value is the number of seconds from the start when the sound will
   be stopped.
 
+  \var FaunParameter::FAUN_BUS
+  The bus (0 to FAUN_BUS_MAX-1) which a source or stream is mixed into.
+  Bus zero is the main bus; the others are submixes which are mixed into
+  the main bus using the volume set with faun_setBusVolume().
+  The default value is 0.
+
 
   \struct FaunSignal
   This struct is used for faun_pollSignals() & faun_waitSignal().
@@ -2209,7 +4713,7 @@ static int limitU(int val, int max)
 
   \param bufferLimit    Maximum number of buffers (0-256).
   \param sourceLimit    Maximum number of simultaneously playing sounds (0-32).
-  \param streamLimit    Maximum number of simultaneously playing streams (0-6).
+  \param streamLimit    Maximum number of simultaneously playing streams (0-16).
   \param progLimit      Maximum number of program execution units (0-16).
   \param appName        Program identifier for networked audio systems.
 
@@ -2236,34 +4740,44 @@ const char* faun_startup(int bufferLimit, int sourceLimit, int streamLimit,
 
     siLimit = _sourceLimit + _streamLimit;
 
+#ifdef SIMUL_MIX
+    mix_selectKernels();
+#endif
+
 #if 0
-    printf("FaunBuffer:%ld FaunSource:%ld StreamOV:%ld FaunProgram:%ld\n",
-           sizeof(FaunBuffer), sizeof(FaunSource), sizeof(StreamOV),
-           sizeof(FaunProgram));
-    // FaunBuffer:24 FaunSource:88 StreamOV:1176 FaunProgram:80
+    printf("FaunBuffer:%ld FaunSource:%ld SourceParam:%ld StreamOV:%ld"
+           " FaunProgram:%ld\n",
+           sizeof(FaunBuffer), sizeof(FaunSource), sizeof(SourceParam),
+           sizeof(StreamOV), sizeof(FaunProgram));
+    // FaunBuffer:24 FaunSource:64 SourceParam:48 StreamOV:1176
+    // FaunProgram:80
 #endif
     assert(sizeof(FaunBuffer) % 8 == 0);
     assert(sizeof(FaunSource) % 8 == 0);
+    assert(sizeof(SourceParam) % 8 == 0);
     assert(sizeof(StreamOV) % 8 == 0);
     assert(sizeof(FaunProgram) % 8 == 0);
 
-    i = bufferLimit * sizeof(FaunBuffer) +
-        siLimit     * sizeof(FaunSource) +
+    // The hot source array is placed first to begin on the malloc alignment.
+    i = siLimit     * sizeof(FaunSource) +
+        siLimit     * sizeof(SourceParam) +
+        bufferLimit * sizeof(FaunBuffer) +
         streamLimit * sizeof(StreamOV) +
         progLimit   * sizeof(FaunProgram) +
         siLimit     * sizeof(_Atomic uint32_t);
-    _abuffer = (FaunBuffer*) malloc(i);
-    if (! _abuffer) {
+    _asource = (FaunSource*) malloc(i);
+    if (! _asource) {
         sysaudio_close();
         return "No memory for arrays";
     }
 
-    _asource = (FaunSource*) (_abuffer + bufferLimit);
-    _stream  = (StreamOV*)  (_asource + siLimit);
+    _aparam  = (SourceParam*) (_asource + siLimit);
+    _abuffer = (FaunBuffer*) (_aparam + siLimit);
+    _stream  = (StreamOV*)  (_abuffer + bufferLimit);
 
     memset(_abuffer, 0, bufferLimit * sizeof(FaunBuffer));
     for (i = 0; i < siLimit; ++i)
-        faun_sourceInit(_asource + i, i);
+        faun_sourceInit(_asource + i, _aparam + i, i);
     for (i = 0; i < streamLimit; ++i)
         stream_init(_stream + i, sourceLimit + i);
 
@@ -2276,22 +4790,29 @@ const char* faun_startup(int bufferLimit, int sourceLimit, int streamLimit,
         _playbackId = (_Atomic uint32_t*) (_stream + _streamLimit);
     }
 
+    for (i = 0; i < FAUN_BUS_MAX; ++i)
+        bus_setVolume(_bus + i, 1.0f, 0.0f);
+
     for (i = 0; i < siLimit; ++i)
         atomic_init(_playbackId + i, NUL_PLAY_ID);
     _playSerialNo = NUL_PLAY_ID;
     atomic_flag_clear(&_pidLock);
 
-    faun_allocBufferSamples(&_voice.mix, FAUN_F32, FAUN_CHAN_2, 44100,
-                            44100 / DEF_UPDATE_HZ);
+    // A zero rate is replaced by sysaudio_allocVoice with that of the device.
+    faun_allocBufferSamples(&_voice.mix, FAUN_F32, FAUN_CHAN_2, _mixRate,
+                            _mixRate / DEF_UPDATE_HZ);
 
     // Set defaults which sysaudio_allocVoice may change.
     _voice.mix.used = _voice.mix.avail;
     _voice.updateHz = DEF_UPDATE_HZ;
+    _voice.outFormat = _outFormat;
 
     if ((error = sysaudio_allocVoice(&_voice, DEF_UPDATE_HZ, appName))) {
         sysaudio_close();
         return error;
     }
+    if (! _voice.mix.rate)
+        faun_setMixRate(&_voice, 44100);
 
     _audioUp = AUDIO_UP;
 
@@ -2308,6 +4829,12 @@ const char* faun_startup(int bufferLimit, int sourceLimit, int streamLimit,
         goto thread_fail1;
     }
 
+    // The audio thread runs stream operations on streamThread.
+    if (streamLimit && stream_startThread()) {
+        error = "Stream thread create failed";
+        goto thread_fail2;
+    }
+
     if (threadCreateF(_voice.thread, audioThread, &_voice)) {
         error = "Voice thread create failed";
         goto thread_fail2;
@@ -2338,6 +4865,9 @@ void faun_shutdown()
     int i;
 
     if (_audioUp == AUDIO_THREAD_UP) {
+        // Workers push to the audio thread so they are stopped first.
+        load_stopThreads();
+
         faun_command2(CMD_QUIT, 0);
         threadJoin(_voice.thread);
 
@@ -2346,6 +4876,7 @@ void faun_shutdown()
     }
 
     if (_audioUp) {
+        stream_stopThread();
         for (i = 0; i < _streamLimit; ++i) {
             st = _stream + i;
             stream_stop(st);
@@ -2355,9 +4886,20 @@ void faun_shutdown()
         faun_freeBufferSamples(_bufferLimit, _abuffer);
         faun_freeBufferSamples(1, &_voice.mix);
 
-        free(_abuffer);
-        _abuffer = NULL;
+        for (i = 0; i < ARENA_MAX; ++i) {
+            Arena* ar = _arena + i;
+            arena_releaseBlocks(ar->blocks);
+            if (ar->map)
+                bank_unmap(ar->map, ar->mapSize);
+            memset(ar, 0, sizeof(Arena));
+        }
+        _arenaCur = 0;
+        memset(_arenaGenA, 0, sizeof(_arenaGenA));
+
+        free(_asource);
         _asource = NULL;
+        _aparam  = NULL;
+        _abuffer = NULL;
         _stream  = NULL;
 
         sysaudio_freeVoice(&_voice);
@@ -2389,7 +4931,111 @@ void faun_setErrorStream(FILE* fp)
 
 
 /**
-  Check for signals from sources and streams.
+  Set a library option.  Except where noted this must be called before
+  faun_startup().
+
+  \param option  FaunOption enum value.
+  \param value   Option value.
+
+  FAUN_OUTPUT_FORMAT may be FAUN_FMT_F32 (the default) or FAUN_FMT_S16.
+  With FAUN_FMT_S16 the final mix is clipped, dithered & converted to
+  16-bit samples before it is passed to the audio system.
+
+  FAUN_LIMITER enables a look-ahead limiter on the final mix when value is
+  greater than zero.  The value is the peak output level as a percentage
+  of full scale.  Output is delayed by 63 frames (1.4 ms at 44100 Hz).
+
+  FAUN_MIX_RATE sets the sample rate of the mix in Hz.  The default of zero
+  uses the rate of the audio device so that the system does not need to
+  resample the output.  Buffers & streams at other rates are converted to
+  the mix rate when they are loaded or decoded.
+
+  FAUN_BUFFER_FORMAT selects how buffers loaded after the call are stored
+  in memory.  FAUN_FMT_F32 (the default) stores 32-bit float samples,
+  FAUN_FMT_S16 stores 16-bit samples (half the memory), and FAUN_FMT_ADPCM
+  stores 4-bit IMA ADPCM (about one eighth of the memory).  Packed
+  samples are converted to float by the mixer as they are played.
+  FAUN_FMT_COMPRESSED keeps the file data of Ogg Vorbis sounds in memory
+  (other sounds are stored as with FAUN_FMT_F32).  These buffers can only
+  be played on a stream with faun_playSource(), which decodes them as it
+  plays without any file access.  This option may be changed at any time.
+
+  FAUN_LOAD_THREADS sets the number of worker threads used by
+  faun_loadBufferAsync(), up to 16.  The default of zero uses one less
+  than the number of processors (but at least one).  This must be set
+  before the first faun_loadBufferAsync() call.
+
+  FAUN_STREAM_BUDGET limits the time in microseconds spent decoding streams
+  for each mix update.  Once it is used up only streams which are close to
+  running out of decoded audio are read until the next update.  The
+  default of zero has no limit.
+
+  When the library is built with FAUN_FIXED the output is always 16-bit
+  and the limiter is not available.
+*/
+void faun_setOption(int option, int value)
+{
+    switch (option) {
+        case FAUN_OUTPUT_FORMAT:
+#ifndef FAUN_FIXED
+            _outFormat = (value == FAUN_FMT_S16) ? FAUN_S16 : FAUN_F32;
+#endif
+            break;
+        case FAUN_LIMITER:
+            _limitPercent = limitU(value, 100);
+            break;
+        case FAUN_MIX_RATE:
+            _mixRate = limitU(value, 192000);
+            break;
+        case FAUN_BUFFER_FORMAT:
+            if (value == FAUN_FMT_ADPCM)
+                _bufFormat = FAUN_ADPCM;
+            else if (value == FAUN_FMT_COMPRESSED)
+                _bufFormat = FAUN_VORBIS;
+            else
+                _bufFormat = (value == FAUN_FMT_S16) ? FAUN_S16
+                                                     : FAUN_MIX_FORMAT;
+            break;
+        case FAUN_LOAD_THREADS:
+            _loadThreads = limitU(value, LOAD_THREAD_MAX);
+            break;
+        case FAUN_STREAM_BUDGET:
+            _streamBudget = limitU(value, 1000000);
+            break;
+    }
+}
+
+
+/**
+  Set the functions used to allocate sample memory.  This must be called
+  before faun_startup().
+
+  The functions are used for buffer samples, arena blocks, and temporary
+  memory used by the loaders.  They may be called from any thread,
+  including the audio thread, so they must be thread-safe.
+
+  \param alloc    Allocation function.  Pass NULL to use malloc() & free().
+  \param release  Function to free memory returned by alloc.
+  \param user     Pointer passed to alloc & release.
+*/
+void faun_setAllocator(FaunAllocFunc alloc, FaunFreeFunc release, void* user)
+{
+    if (_audioUp)
+        return;
+    if (alloc && release) {
+        _memAlloc = alloc;
+        _memFree  = release;
+        _memUser  = user;
+    } else {
+        _memAlloc = mem_mallocHook;
+        _memFree  = mem_freeHook;
+        _memUser  = NULL;
+    }
+}
+
+
+/**
+  Check for signals from sources, streams, and faun_loadBufferAsync().
 
   \param sigbuf    Pointer to memory for signals.
   \param count     Number of signals sigbuf can hold.
@@ -2431,21 +5077,66 @@ void faun_waitSignal(FaunSignal* sigbuf)
 
 
 /**
-  Send a single command to sources or streams.
+  Send a single command to sources or streams.
+
+  \param si         Source or stream index.
+  \param count      Number of sources or streams to command.
+  \param command    FaunCommand enum.
+*/
+void faun_control(int si, int count, int command)
+{
+    if( _audioUp && command < FC_COUNT)
+    {
+        CommandA cmd;
+        cmd.op     = command + CMD_CON_START;
+        cmd.select = si;
+        cmd.ext    = count;
+        faun_command(&cmd, 4);
+    }
+}
+
+
+/**
+  Send a single command to all sources and streams routed to a bus.
+
+  \param bus        Bus index (0 to FAUN_BUS_MAX-1).
+  \param command    FaunCommand enum.
+*/
+void faun_controlBus(int bus, int command)
+{
+    if (_audioUp && command < FC_COUNT && bus >= 0 && bus < FAUN_BUS_MAX)
+    {
+        CommandA cmd;
+        cmd.op     = CMD_BUS_CONTROL;
+        cmd.select = bus;
+        cmd.ext    = command;
+        faun_command(&cmd, 4);
+    }
+}
+
+
+/**
+  Change the gain of a submix bus.
 
-  \param si         Source or stream index.
-  \param count      Number of sources or streams to command.
-  \param command    FaunCommand enum.
+  The gain is applied once to the mix of all sources & streams routed to
+  the bus.  The main bus (0) has no gain.
+
+  \param bus        Bus index (1 to FAUN_BUS_MAX-1).
+  \param volume     Target volume.
+  \param period     Number of seconds for transition.  Use zero to change
+                    the volume immediately.
 */
-void faun_control(int si, int count, int command)
+void faun_setBusVolume(int bus, float volume, float period)
 {
-    if( _audioUp && command < FC_COUNT)
+    if (_audioUp && bus > 0 && bus < FAUN_BUS_MAX)
     {
         CommandA cmd;
-        cmd.op     = command + CMD_CON_START;
-        cmd.select = si;
-        cmd.ext    = count;
-        faun_command(&cmd, 4);
+        cmd.op     = CMD_BUS_VOLUME;
+        cmd.select = bus;
+        cmd.ext    = 0;
+        cmd.arg.f[0] = volume;
+        cmd.arg.f[1] = period;
+        faun_command(&cmd, 12);
     }
 }
 
@@ -2466,8 +5157,20 @@ void faun_controlSeq(int si, int count, const uint8_t* commands)
   \param si     Source or stream index.
   \param count  Number of sources or streams to modify.
   \param param  FaunParameter enum
-                (#FAUN_VOLUME, #FAUN_FADE_PERIOD, #FAUN_END_TIME).
+                (#FAUN_VOLUME, #FAUN_FADE_PERIOD, #FAUN_END_TIME, #FAUN_BUS,
+                #FAUN_PLAYBACK_RATE, #FAUN_PRIORITY).
   \param value  Value assigned to param.
+
+  FAUN_PLAYBACK_RATE scales the speed & pitch of a source playing buffers.
+  The range is 0.05 to 4.0 and the default is 1.0.  It takes effect
+  immediately and has no effect on streams.  The FO_SET_RATE program
+  opcode has a byte operand in 1/100 units, so programs can only set rates
+  up to 2.55.
+
+  FAUN_PRIORITY orders the decoding of streams (e.g. to keep music ahead of
+  ambient sounds).  When several streams need decoding, those with the
+  higher priority are decoded first.  The range is 0 to 255 and the
+  default is 0.  It has no effect on sources which only play buffers.
 */
 void faun_setParameter(int si, int count, uint8_t param, float value)
 {
@@ -2551,19 +5254,151 @@ void faun_program(int exec, const uint8_t* bytecode, int len)
 }
 
 
-static float _cmdSetBuffer(int bi, const FaunBuffer* buf)
+/*
+  Convert the float samples of a loaded buffer to another storage format
+  and release the unused memory.
+*/
+static void faun_storeBuffer(FaunBuffer* buf, int fmt)
+{
+    int chan = faun_channelCount(buf->chanLayout);
+    void* mem;
+
+    if (fmt == FAUN_ADPCM) {
+        mem = sample_alloc(adpcm_size(chan, buf->used));
+        if (! mem)
+            return;     // Keep the float samples.
+        adpcm_encode((uint8_t*) mem, buf->sample.f32, chan, buf->used);
+        sample_free(buf->sample.ptr);
+        buf->sample.ptr = mem;
+    } else {
+        faun_storeS16(buf->sample.ptr, buf->used * chan);
+        if (buf->used) {
+            mem = sample_realloc(buf->sample.ptr,
+                                 buf->used * chan * sizeof(int16_t));
+            if (mem)
+                buf->sample.ptr = mem;
+        }
+    }
+    buf->avail = buf->used;
+    buf->format = fmt;
+}
+
+
+/*
+  Convert the samples of a loaded buffer to the rate & storage format used
+  for playback.
+
+  \param rate  Mix rate.
+  \param fmt   Storage format (_bufFormat).
+
+  Return error message or NULL if successful.
+*/
+static const char* faun_prepareBuffer(FaunBuffer* buf, uint32_t rate,
+                                      int fmt)
+{
+    // Encoded buffers are left as they are; a stream decodes them on play.
+    if (buf->format == FAUN_VORBIS)
+        return NULL;
+
+    // Buffers are played at their own rate, but those above the mix rate
+    // are converted down so the mixer does not need to filter them.
+    if (buf->rate > rate && ! faun_convertRate(buf, rate))
+        return "No memory to convert sample rate";
+
+    // Loaders decode to float.
+    if (fmt == FAUN_VORBIS)
+        fmt = FAUN_MIX_FORMAT;
+    if (fmt != FAUN_F32)
+        faun_storeBuffer(buf, fmt);
+    return NULL;
+}
+
+
+/*
+  Pass the buffer samples to the audio thread.
+
+  \param tag  Tag of the arena holding the samples or zero.
+*/
+static void _cmdPushBuffer(int bi, const FaunBuffer* buf, uint32_t tag)
 {
     uint8_t cmd[MSG_SIZE];
 
     cmd[0] = CMD_SET_BUFFER;
     cmd[1] = bi;
-    memcpy(cmd+2, buf, 16);
+    memcpy(cmd+2, &buf->sample.ptr, sizeof(void*));
+    memcpy(cmd+2+sizeof(void*), &buf->used, 8);     // used & rate.
+    cmd[10+sizeof(void*)] = buf->chanLayout;
+    cmd[11+sizeof(void*)] = buf->format;
+    memcpy(cmd+12+sizeof(void*), &tag, 4);
     tmsg_push(_voice.cmd, cmd);
+}
+
+
+/*
+  Prepare a loaded buffer & pass it to the audio thread.
+
+  \param fmt    Storage format (_bufFormat).
+  \param arena  Tag of arena to place the samples in or zero (_arenaCur).
+
+  Return duration in seconds or zero upon failure.
+*/
+static float _cmdSetBuffer(int bi, FaunBuffer* buf, int fmt, uint32_t arena)
+{
+    const char* error;
+    void* heap;
 
+    error = faun_prepareBuffer(buf, _voice.mix.rate, fmt);
+    if (error) {
+        fprintf(_errStream, "Faun %s\n", error);
+        sample_free(buf->sample.ptr);
+        return 0.0f;
+    }
+
+    // The samples are only placed in an arena once they are final.
+    heap = buf->sample.ptr;
+    if (arena && heap)
+        buf->sample.ptr = arena_adopt(heap, arena);
+    if (buf->sample.ptr == heap)
+        arena = 0;
+
+    _cmdPushBuffer(bi, buf, arena);
     return (float) buf->used / (float) buf->rate;
 }
 
 
+/*
+  Read a file into a buffer & pass it to the audio thread.  This is used
+  by both the user & load threads.
+
+  Return duration in seconds or zero upon failure.
+*/
+static float faun_loadFile(int bi, const char* file, uint32_t offset,
+                           uint32_t size, int fmt, uint32_t arena)
+{
+    FaunBuffer buf;
+    const char* error;
+    float duration = 0.0f;
+
+    FILE* fp = fopen(file, "rb");
+    if (fp) {
+        buf.sample.ptr = NULL;
+        error = faun_readBuffer(&buf, fp, offset, size, fmt);
+        if (! error && ! buf.sample.ptr)
+            error = "file format not recognized";
+        if (error) {
+            fprintf(_errStream, "Faun %s (%s)\n", error, file);
+            sample_free(buf.sample.ptr);
+        } else
+            duration = _cmdSetBuffer(bi, &buf, fmt, arena);
+
+        fclose(fp);
+    } else {
+        fprintf(_errStream, "Faun loadBuffer cannot open \"%s\"\n", file);
+    }
+    return duration;
+}
+
+
 /**
   Load a file into a PCM buffer.
 
@@ -2574,33 +5409,17 @@ static float _cmdSetBuffer(int bi, const FaunBuffer* buf)
 
   \return Duration in seconds or zero upon failure.
 
-  \sa faun_loadBufferF(), faun_loadBufferPcm(), faun_loadBufferSfx()
+  \sa faun_loadBufferF(), faun_loadBufferPcm(), faun_loadBufferSfx(),
+      faun_loadBufferAsync()
 */
 float faun_loadBuffer(int bi, const char* file, uint32_t offset, uint32_t size)
 {
-    float duration = 0.0f;
-
     if( _audioUp && bi < _bufferLimit )
     {
-        FaunBuffer buf;
-        const char* error;
-
         // Load buffer in user thread.
-        FILE* fp = fopen(file, "rb");
-        if (fp) {
-            buf.sample.ptr = NULL;
-            error = faun_readBuffer(&buf, fp, offset, size);
-            if (error)
-                fprintf(_errStream, "Faun %s (%s)\n", error, file);
-            else
-                duration = _cmdSetBuffer(bi, &buf);
-
-            fclose(fp);
-        } else {
-            fprintf(_errStream, "Faun loadBuffer cannot open \"%s\"\n", file);
-        }
+        return faun_loadFile(bi, file, offset, size, _bufFormat, _arenaCur);
     }
-    return duration;
+    return 0.0f;
 }
 
 
@@ -2624,17 +5443,257 @@ float faun_loadBufferF(int bi, FILE* fp, uint32_t size)
 
         // Load buffer in user thread.
         buf.sample.ptr = NULL;
-        error = faun_readBuffer(&buf, fp, 0, size);
+        error = faun_readBuffer(&buf, fp, 0, size, _bufFormat);
         if (error)
             fprintf(_errStream, "Faun %s\n", error);
         else
-            return _cmdSetBuffer(bi, &buf);
+            return _cmdSetBuffer(bi, &buf, _bufFormat, _arenaCur);
     }
     return 0.0f;
 }
 
 
+//----------------------------------------------------------------------------
+// Asynchronous loading
+
+typedef struct LoadRequest {
+    struct LoadRequest* next;
+    uint32_t offset;
+    uint32_t size;
+    uint16_t bi;
+    uint8_t  format;        // _bufFormat when queued.
+    uint32_t arena;         // _arenaCur when queued.
+    char     file[1];
+}
+LoadRequest;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    LoadRequest* head;      // Pending requests.
+    LoadRequest* tail;
+    atomic_int quit;
+    atomic_int running;
+    int threadCount;
+    pthread_t thread[LOAD_THREAD_MAX];
+} _load;
+
+
+#ifdef _WIN32
+static DWORD WINAPI loadThread(LPVOID arg)
+#else
+static void* loadThread(void* arg)
+#endif
+{
+    LoadRequest* req;
+    FaunSignal sig;
+    float duration;
+    (void) arg;
+
+    for (;;) {
+        mutexLock(_load.mutex);
+        while (! _load.head && ! _load.quit)
+            condWaitF(_load.cond, _load.mutex);
+        req = NULL;
+        if (! _load.quit) {
+            req = _load.head;
+            _load.head = req->next;
+        }
+        mutexUnlock(_load.mutex);
+        if (! req)
+            break;
+
+        duration = faun_loadFile(req->bi, req->file, req->offset, req->size,
+                                 req->format, req->arena);
+        sig.id = req->bi;
+        sig.signal = (duration > 0.0f) ? FAUN_SIGNAL_LOADED
+                                       : FAUN_SIGNAL_LOAD_FAILED;
+        free(req);
+
+        // Once shutdown has begun nobody is reading signals.
+        if (! _load.quit)
+            tmsg_push(_voice.sig, &sig);
+    }
+
+    _load.running -= 1;
+    return 0;
+}
+
+
+/*
+  Return number of threads started.
+*/
+static int load_startThreads(void)
+{
+    int i;
+    int count = _loadThreads;
+
+    if (! count) {
+        count = faun_processorCount() - 1;
+        if (count < 1)
+            count = 1;
+        else if (count > LOAD_THREAD_MAX)
+            count = LOAD_THREAD_MAX;
+    }
+
+    if (mutexInitF(_load.mutex))
+        return 0;
+    condInit(_load.cond);
+    _load.head = _load.tail = NULL;
+    _load.quit = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (threadCreateF(_load.thread[i], loadThread, NULL))
+            break;
+    }
+    _load.running = _load.threadCount = i;
+    if (! i) {
+        condFree(_load.cond);
+        mutexFree(_load.mutex);
+    }
+    return i;
+}
+
+
+/*
+  Stop the load threads & discard any pending requests.
+  The audio thread must still be running.
+*/
+static void load_stopThreads(void)
+{
+    LoadRequest* req;
+    LoadRequest* next;
+    FaunSignal sig;
+    MsgTime ts;
+    int i;
+
+    if (! _load.threadCount)
+        return;
+
+    mutexLock(_load.mutex);
+    _load.quit = 1;
+    condBroadcast(_load.cond);
+    mutexUnlock(_load.mutex);
+
+    // Drain the signal port so no worker stays blocked pushing to it.
+    while (_load.running) {
+        tmsg_setTimespec(&ts, 10);
+        tmsg_popTimespec(_voice.sig, &sig, &ts);
+    }
+
+    for (i = 0; i < _load.threadCount; ++i)
+        threadJoin(_load.thread[i]);
+    _load.threadCount = 0;
+
+    for (req = _load.head; req; req = next) {
+        next = req->next;
+        free(req);
+    }
+    _load.head = _load.tail = NULL;
+
+    condFree(_load.cond);
+    mutexFree(_load.mutex);
+}
+
+
+/**
+  Queue a file to be loaded into a PCM buffer by a worker thread.
+
+  The file is read just as faun_loadBuffer() does, using the
+  FAUN_BUFFER_FORMAT & arena (see faun_beginArena()) in effect when this
+  is called.  After the buffer has been passed to the audio thread a
+  FaunSignal is sent with the buffer index as the id and a signal of
+  FAUN_SIGNAL_LOADED or FAUN_SIGNAL_LOAD_FAILED.  The buffer should not be
+  used or loaded again until the signal is received.
+
+  The workers are started on the first call; the FAUN_LOAD_THREADS option
+  sets how many there are.  Requests are begun in order but may complete
+  in any order.
+
+  \param bi       Buffer index.
+  \param file     Path to audio file.
+  \param offset   Byte offset to the start of data in the file.
+  \param size     Bytes to read from file. Pass zero to read to the file end.
+
+  \return Non-zero if the request was queued.
+
+  \sa faun_loadBuffer(), faun_pollSignals()
+*/
+int faun_loadBufferAsync(int bi, const char* file, uint32_t offset,
+                         uint32_t size)
+{
+    LoadRequest* req;
+    size_t len;
+
+    if (! _audioUp || bi < 0 || bi >= _bufferLimit)
+        return 0;
+
+    if (! _load.threadCount && ! load_startThreads()) {
+        fprintf(_errStream, "Faun load thread create failed\n");
+        return 0;
+    }
+
+    len = strlen(file);
+    req = (LoadRequest*) malloc(sizeof(LoadRequest) + len);
+    if (! req)
+        return 0;
+    req->next   = NULL;
+    req->offset = offset;
+    req->size   = size;
+    req->bi     = bi;
+    req->format = _bufFormat;
+    req->arena  = _arenaCur;
+    memcpy(req->file, file, len + 1);
+
+    mutexLock(_load.mutex);
+    if (_load.head)
+        _load.tail->next = req;
+    else
+        _load.head = req;
+    _load.tail = req;
+    condSignal(_load.cond);
+    mutexUnlock(_load.mutex);
+    return 1;
+}
+
+
 #ifdef USE_LOAD_MEM
+/**
+  Load an audio file which is held in memory into a buffer.
+
+  The data is the same as a file passed to faun_loadBuffer() (WAV, Ogg
+  Vorbis, FLAC, or rFX) and is decoded directly from the memory, which
+  may be released once this function returns.
+
+  \param bi       Buffer index.
+  \param data     Pointer to the file data.
+  \param size     Byte size of data.
+
+  \return Duration in seconds or zero upon failure.
+
+  \sa faun_loadBuffer(), faun_playStreamMem()
+*/
+float faun_loadBufferMem(int bi, const void* data, uint32_t size)
+{
+    if (_audioUp && bi < _bufferLimit) {
+        FaunBuffer buf;
+        const char* error;
+
+        buf.sample.ptr = NULL;
+        error = faun_readBufferMem(&buf, (const uint8_t*) data, size,
+                                   _bufFormat);
+        if (! error && ! buf.sample.ptr)
+            error = "data format not recognized";
+        if (error) {
+            fprintf(_errStream, "Faun %s (loadBufferMem)\n", error);
+            sample_free(buf.sample.ptr);
+        } else
+            return _cmdSetBuffer(bi, &buf, _bufFormat, _arenaCur);
+    }
+    return 0.0f;
+}
+
+
 /**
   Load PCM audio data from memory into a buffer.
 
@@ -2652,29 +5711,24 @@ float faun_loadBufferPcm(int bi, int format, const void* samples,
 {
     if (_audioUp && bi < _bufferLimit) {
         FaunBuffer buf;
-        uint32_t inFrames = frames;
         int chan = (format & FAUN_FMT_STEREO) ? 2 : 1;
-        int rate;
-
-        if (format & FAUN_FMT_22050) {
-            frames *= 2;
-            rate = 22050;
-        } else {
-            rate = 44100;
-        }
+        int rate = (format & FAUN_FMT_22050) ? 22050 : 44100;
 
         buf.sample.ptr = NULL;
-        _allocBufferVoice(&buf, frames);
+        if (! _allocBufferLoad(&buf, chan, rate, frames)) {
+            fprintf(_errStream, "Faun No memory for PCM samples\n");
+            return 0.0f;
+        }
         buf.used = frames;
 
         if (format & FAUN_FMT_S16)
-            convS16_F32(buf.sample.f32, (const int16_t*) samples, inFrames,
-                        rate, chan);
+            convS16_F32(buf.sample.f32, (const int16_t*) samples, frames,
+                        chan);
         else
-            convF32_F32(buf.sample.f32, (const float*) samples, inFrames,
-                        rate, chan);
+            convF32_F32(buf.sample.f32, (const float*) samples, frames,
+                        chan);
 
-        return _cmdSetBuffer(bi, &buf);
+        return _cmdSetBuffer(bi, &buf, _bufFormat, _arenaCur);
     }
     return 0.0f;
 }
@@ -2695,9 +5749,14 @@ float faun_loadBufferSfx(int bi, const void* sfxParam)
 {
     if (_audioUp && bi < _bufferLimit) {
         FaunBuffer buf;
+        const char* error;
+
         buf.sample.ptr = NULL;
-        faun_generateSfx(&buf, (const SfxParams*) sfxParam);
-        return _cmdSetBuffer(bi, &buf);
+        error = faun_generateSfx(&buf, (const SfxParams*) sfxParam);
+        if (error)
+            fprintf(_errStream, "Faun %s\n", error);
+        else
+            return _cmdSetBuffer(bi, &buf, _bufFormat, _arenaCur);
     }
     return 0.0f;
 }
@@ -2729,6 +5788,172 @@ void faun_freeBuffers(int bi, int count)
 }
 
 
+/**
+  Begin placing the samples of loaded buffers in a new arena.
+
+  Buffers loaded after this call (until faun_endArena()) are allocated
+  from large blocks of memory which are only released by faun_freeArena().
+  This avoids fragmenting the heap when the sounds for a game level are
+  loaded & later freed together.
+
+  \param blockSize  Bytes in each arena block.  Pass zero for the default
+                    of 4 MiB.  Larger sounds get a block of their own.
+
+  \return Arena identifier or zero if all arenas are in use.
+
+  \sa faun_endArena(), faun_freeArena()
+*/
+int faun_beginArena(uint32_t blockSize)
+{
+    return ARENA_ID(arena_claim(blockSize ? blockSize : ARENA_BLOCK, 1));
+}
+
+
+/**
+  Stop placing loaded buffers in the arena.  Following loads use the
+  allocator set with faun_setAllocator().
+*/
+void faun_endArena(void)
+{
+    while (atomic_flag_test_and_set(&_arenaLock)) {}
+    _arenaCur = 0;
+    atomic_flag_clear(&_arenaLock);
+}
+
+
+/**
+  Free all the buffers in an arena and release its memory.  Any sources or
+  streams playing those buffers are stopped.  Nothing is done if the arena
+  is not in use (e.g. it has already been freed).
+
+  \param id  Arena identifier returned by faun_beginArena() or
+             faun_loadBank().
+*/
+void faun_freeArena(int id)
+{
+    if (_audioUp && id > 0 && id <= ARENA_MAX) {
+        CommandA cmd;
+        Arena* ar = _arena + (id - 1);
+        void* mem;
+        size_t mapSize;
+        uint32_t gen;
+
+        while (atomic_flag_test_and_set(&_arenaLock)) {}
+        if (! ar->inUse) {
+            // Already freed; the generation must only advance once.
+            atomic_flag_clear(&_arenaLock);
+            return;
+        }
+        if (ar->map) {
+            mem = ar->map;
+            mapSize = ar->mapSize;
+        } else {
+            mem = ar->blocks;
+            mapSize = 0;
+        }
+        gen = ar->gen;
+        memset(ar, 0, sizeof(Arena));
+        ar->gen = gen + 1;
+        if (ARENA_ID(_arenaCur) == id)
+            _arenaCur = 0;
+        atomic_flag_clear(&_arenaLock);
+
+        // The audio thread releases the memory after detaching the buffers
+        // so the arena can be reused immediately.  It counts the frees of
+        // each arena to track the generation.
+        cmd.op     = CMD_ARENA_FREE;
+        cmd.select = id;
+        memcpy(&cmd.arg, &mem, sizeof(void*));
+        memcpy(((char*) &cmd.arg) + sizeof(void*), &mapSize, sizeof(size_t));
+        faun_command(&cmd, 4 + sizeof(void*) + sizeof(size_t));
+    }
+}
+
+
+/**
+  Load the buffers of a sound bank file made by the faun_bank tool.
+
+  The file is mapped into memory and the samples are used in place without
+  decoding or copying.  The bank is held by an arena which must be freed
+  with faun_freeArena() to release the buffers & the mapping.
+
+  Banks are built for a mix rate; any buffer with a rate above the current
+  mix rate is not loaded.
+
+  \param bi    Buffer index of the first bank entry.  The entries are
+               loaded into consecutive buffers.
+  \param file  Path to bank file.
+
+  \return Arena identifier or zero upon failure.
+*/
+int faun_loadBank(int bi, const char* file)
+{
+    const BankHeader* hdr;
+    const BankEntry* ent;
+    SampleHeader* sh;
+    FaunBuffer buf;
+    uint8_t* map;
+    size_t size;
+    uint32_t tag;
+    int i, count, id;
+
+    if (! _audioUp || bi < 0 || bi >= _bufferLimit)
+        return 0;
+
+    map = (uint8_t*) bank_map(file, &size);
+    if (! map) {
+        fprintf(_errStream, "Faun cannot map bank %s\n", file);
+        return 0;
+    }
+
+    hdr = (const BankHeader*) map;
+    if (size < sizeof(BankHeader) ||
+        memcmp(hdr->magic, BANK_MAGIC, 4) != 0 ||
+        hdr->version != BANK_VERSION ||
+        size < sizeof(BankHeader) + hdr->count * sizeof(BankEntry)) {
+        fprintf(_errStream, "Faun invalid bank %s\n", file);
+        bank_unmap(map, size);
+        return 0;
+    }
+
+    tag = arena_claim(0, 0);
+    id = ARENA_ID(tag);
+    if (! id) {
+        fprintf(_errStream, "Faun has no free arena for bank %s\n", file);
+        bank_unmap(map, size);
+        return 0;
+    }
+    _arena[id - 1].map = map;
+    _arena[id - 1].mapSize = size;
+
+    count = hdr->count;
+    if (count > _bufferLimit - bi)
+        count = _bufferLimit - bi;
+
+    ent = (const BankEntry*) (hdr + 1);
+    for (i = 0; i < count; ++i, ++ent) {
+        if (! bank_validEntry(ent, map, size) || ent->rate > _voice.mix.rate) {
+            fprintf(_errStream, "Faun cannot use bank %s entry %d\n",
+                    file, i);
+            continue;
+        }
+
+        buf.sample.ptr = map + ent->offset;
+        sh = SAMPLE_HEADER(buf.sample.ptr);
+        sh->base  = NULL;
+        sh->size  = ent->size;
+        sh->arena = tag;
+
+        buf.used = buf.avail = ent->frames;
+        buf.rate = ent->rate;
+        buf.chanLayout = ent->chanLayout;
+        buf.format = ent->format;
+        _cmdPushBuffer(bi + i, &buf, tag);
+    }
+    return id;
+}
+
+
 static uint32_t faun_nextPlayId(int si)
 {
     if (++_playSerialNo > 0xffffff)
@@ -2752,6 +5977,9 @@ static uint32_t faun_nextPlayId(int si)
   mode includes #FAUN_PLAY_FADE_IN.
   To change the volume after playing has started use faun_pan().
 
+  A buffer kept compressed (see #FAUN_BUFFER_FORMAT) can only be played on
+  a stream, so si must then be a stream index.
+
   \param si     Source index.
   \param bi     Buffer indices.  Use the FAUN_PAIR() & FAUN_TRIO() macros to
                 queue two or three buffers.
@@ -2819,8 +6047,9 @@ uint32_t faun_playSourceVol(int si, int bi, int mode, float volL, float volR)
 /**
   Open a file and optionally begin streaming.
 
-  Reading can be limited to a specific chunk of the file if the size argument
-  is non-zero.
+  The file may contain Ogg Vorbis, WAVE, or FLAC (if built with USE_FLAC)
+  data.  Reading can be limited to a specific chunk of the file if the size
+  argument is non-zero.
 
   To begin playback the mode must include either #FAUN_PLAY_ONCE or
   #FAUN_PLAY_LOOP.  If it does not, then a #FC_START command or a call to
@@ -2875,6 +6104,41 @@ uint32_t faun_playStream(int si, const char* file, uint32_t offset,
 }
 
 
+#ifdef USE_LOAD_MEM
+/**
+  Begin streaming Ogg Vorbis, WAVE, or FLAC data which is held in memory.
+
+  This is the same as faun_playStream() except that the decoder reads the
+  memory directly.  The data is owned by the caller and must remain valid
+  until the stream is stopped or another stream is played on it.
+
+  \param si     Stream index.
+  \param data   Pointer to the file data.
+  \param size   Byte size of data.
+  \param mode   The FaunPlayMode (#FAUN_PLAY_ONCE, #FAUN_PLAY_LOOP, etc.).
+
+  \returns Unique play identifier or zero if streaming could not start.
+*/
+uint32_t faun_playStreamMem(int si, const void* data, uint32_t size, int mode)
+{
+    if( _audioUp && data && size )
+    {
+        uint32_t pid = faun_nextPlayId(si);
+        CommandA cmd;
+        cmd.op     = CMD_OPEN_STREAM_MEM;
+        cmd.select = si;
+        cmd.ext    = mode;
+        cmd.arg.u32[0] = pid;
+        memcpy(&cmd.arg.u32[1], &data, sizeof(void*));
+        cmd.arg.u32[3] = size;
+        faun_command(&cmd, 20);
+        return pid;
+    }
+    return NUL_PLAY_ID;
+}
+#endif
+
+
 /**
   Begin playing a segment from a stream.
 
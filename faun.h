@@ -46,6 +46,7 @@ enum FaunOpcode {
     FO_PAN,             // L target, R target
     FO_SIGNAL,
     FO_CAPTURE,
+    FO_SET_RATE,        // 1/100 units (0.05 - 2.55)
     /*
     FO_SET_VOL_f,       // float argN
     FO_SET_FADE_f,      // float argN
@@ -56,14 +57,17 @@ enum FaunOpcode {
 };
 
 #define FAUN_PROGRAM_MAX    64
+#define FAUN_BUS_MAX        8
 
 enum FaunFormat {
     FAUN_FMT_S16    = 1,
     FAUN_FMT_F32    = 2,
+    FAUN_FMT_ADPCM  = 4,
     FAUN_FMT_MONO   = 0,
     FAUN_FMT_STEREO = 8,
     FAUN_FMT_22050  = 0x10,
-    FAUN_FMT_44100  = 0x20
+    FAUN_FMT_44100  = 0x20,
+    FAUN_FMT_COMPRESSED = 0x40
 };
 
 enum FaunPlayMode {
@@ -73,6 +77,8 @@ enum FaunPlayMode {
     FAUN_PLAY_FADE_OUT  = 0x0020,
     FAUN_SIGNAL_DONE    = 0x0040,
     FAUN_SIGNAL_PROG    = 0x0080,
+    FAUN_SIGNAL_LOADED  = 0x0100,
+    FAUN_SIGNAL_LOAD_FAILED = 0x0200,
     FAUN_PLAY_FADE      = FAUN_PLAY_FADE_IN | FAUN_PLAY_FADE_OUT
 };
 
@@ -80,11 +86,25 @@ enum FaunPlayMode {
 #define FAUN_TRIO(a,b,c)    (((c+1) << 20) | ((b+1) << 10) | a)
 #define FAUN_PID_SOURCE(pid) (pid & 0xff)
 
+enum FaunOption {
+    FAUN_OUTPUT_FORMAT,     // FAUN_FMT_F32 (default) or FAUN_FMT_S16
+    FAUN_LIMITER,           // Limiter threshold percent (0 = off, default)
+    FAUN_MIX_RATE,          // Mix rate in Hz (0 = device rate, default)
+    FAUN_BUFFER_FORMAT,     // FAUN_FMT_F32 (default), _S16, _ADPCM, or
+                            // _COMPRESSED
+    FAUN_LOAD_THREADS,      // Async load workers (0 = cores - 1, default)
+    FAUN_STREAM_BUDGET,     // Stream decode usec per update (0 = no limit)
+    FAUN_OPTION_COUNT
+};
+
 enum FaunParameter {
     FAUN_VOLUME,
     FAUN_VOLUME_APPLY,
     FAUN_FADE_PERIOD,
     FAUN_END_TIME,
+    FAUN_BUS,
+    FAUN_PLAYBACK_RATE,
+    FAUN_PRIORITY,
     FAUN_PARAM_COUNT
 };
 
@@ -94,6 +114,9 @@ typedef struct {
 }
 FaunSignal;
 
+typedef void* (*FaunAllocFunc)(size_t size, void* user);
+typedef void  (*FaunFreeFunc)(void* ptr, void* user);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -103,24 +126,37 @@ const char* faun_startup(int bufferLimit, int sourceLimit,
 void faun_shutdown();
 void faun_suspend(int halt);
 void faun_setErrorStream(FILE*);
+void faun_setOption(int option, int value);
+void faun_setAllocator(FaunAllocFunc, FaunFreeFunc, void* user);
 int  faun_pollSignals(FaunSignal* sigbuf, int count);
 void faun_waitSignal(FaunSignal* sigbuf);
 void faun_control(int si, int count, int command);
+void faun_controlBus(int bus, int command);
+void faun_setBusVolume(int bus, float volume, float period);
 void faun_setParameter(int si, int count, uint8_t param, float value);
 void faun_pan(int si, float finalVolL, float finalVolR, float period);
 void faun_program(int ei, const uint8_t* bytecode, int len);
 
 float faun_loadBuffer(int bi, const char* file, uint32_t offset, uint32_t size);
 float faun_loadBufferF(int bi, FILE* file, uint32_t size);
+float faun_loadBufferMem(int bi, const void* data, uint32_t size);
 float faun_loadBufferPcm(int bi, int format, const void* samples,
                          uint32_t frames);
 float faun_loadBufferSfx(int bi, const void* sfxParam);
+int   faun_loadBufferAsync(int bi, const char* file, uint32_t offset,
+                           uint32_t size);
 void  faun_freeBuffers(int bi, int count);
+int   faun_beginArena(uint32_t blockSize);
+void  faun_endArena(void);
+void  faun_freeArena(int id);
+int   faun_loadBank(int bi, const char* file);
 uint32_t faun_playSource(int si, int bi, int mode);
 uint32_t faun_playSourceVol(int si, int bi, int mode, float volL, float volR);
 
 uint32_t faun_playStream(int si, const char* file, uint32_t offset,
                          uint32_t size, int mode);
+uint32_t faun_playStreamMem(int si, const void* data, uint32_t size,
+                            int mode);
 void faun_playStreamPart(int si, double start, double duration, int mode);
 int  faun_isPlaying(uint32_t pid);
 
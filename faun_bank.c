@@ -0,0 +1,174 @@
+/*
+  faun_bank - Build a Faun sound bank for faun_loadBank().
+
+  Each input file (WAV, Ogg Vorbis, FLAC, or rFX) is decoded & converted
+  just as faun_loadBuffer() would, then written to the bank in the order
+  given.  The library source is included directly so the loaders can be
+  used without starting audio.
+
+  Usage: faun_bank [-r <rate>] [-f <format>] <output> <input> ...
+*/
+
+#include "faun.c"
+
+#define DEF_RATE    48000
+
+static void usage()
+{
+    printf("Usage: faun_bank [-r <rate>] [-f <format>] <output> <input> ...\n"
+           "\n"
+           "Options:\n"
+           "  -f <format>  Buffer storage format: f32 (default), s16, adpcm,\n"
+           "               or ogg (keep Ogg Vorbis compressed)\n"
+           "  -r <rate>    Mix rate of the program (default %d)\n",
+           DEF_RATE);
+}
+
+
+static int parseFormat(const char* name)
+{
+    static const char* names[4] = { "f32", "s16", "adpcm", "ogg" };
+    static const int values[4] = {
+        FAUN_FMT_F32, FAUN_FMT_S16, FAUN_FMT_ADPCM, FAUN_FMT_COMPRESSED
+    };
+    int i;
+    for (i = 0; i < 4; ++i) {
+        if (strcmp(name, names[i]) == 0)
+            return values[i];
+    }
+    return -1;
+}
+
+
+static const char* loadInput(FaunBuffer* buf, const char* file, int rate)
+{
+    const char* error;
+    FILE* fp;
+
+    fp = fopen(file, "rb");
+    if (! fp)
+        return "Cannot open file";
+    buf->sample.ptr = NULL;
+    error = faun_readBuffer(buf, fp, 0, 0, _bufFormat);
+    fclose(fp);
+    if (error)
+        return error;
+    if (! buf->sample.ptr || ! buf->used)
+        return "No samples";
+    faun_prepareBuffer(buf, rate, _bufFormat);
+    return NULL;
+}
+
+
+static int writePad(FILE* fp, long pos)
+{
+    static const uint8_t zero[SAMPLE_ALIGN * 2] = { 0 };
+    long n = pos - ftell(fp);
+    return fwrite(zero, 1, n, fp) == (size_t) n;
+}
+
+
+static int writeBank(const char* file, const FaunBuffer* bufs, int count)
+{
+    BankHeader hdr;
+    BankEntry* ent;
+    BankEntry* it;
+    FILE* fp;
+    uint32_t pos;
+    int i, ok = 0;
+
+    ent = (BankEntry*) calloc(count, sizeof(BankEntry));
+    if (! ent)
+        return 0;
+
+    memcpy(hdr.magic, BANK_MAGIC, 4);
+    hdr.version = BANK_VERSION;
+    hdr.count = count;
+    hdr.reserved[0] = hdr.reserved[1] = 0;
+
+    // Each data block follows a BANK_SLOT reserved for the SampleHeader.
+    pos = sizeof(BankHeader) + count * sizeof(BankEntry);
+    for (i = 0, it = ent; i < count; ++i, ++it) {
+        pos = (pos + BANK_SLOT + SAMPLE_ALIGN-1) & ~(SAMPLE_ALIGN-1);
+        it->offset = pos;
+        it->size   = SAMPLE_HEADER(bufs[i].sample.ptr)->size;
+        it->frames = bufs[i].used;
+        it->rate   = bufs[i].rate;
+        it->chanLayout = bufs[i].chanLayout;
+        it->format = bufs[i].format;
+        pos += it->size;
+    }
+
+    fp = fopen(file, "wb");
+    if (fp) {
+        ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+             fwrite(ent, sizeof(BankEntry), count, fp) == (size_t) count;
+        for (i = 0, it = ent; ok && i < count; ++i, ++it) {
+            ok = writePad(fp, it->offset) &&
+                 fwrite(bufs[i].sample.ptr, 1, it->size, fp) == it->size;
+        }
+        if (fclose(fp))
+            ok = 0;
+    }
+    free(ent);
+    return ok;
+}
+
+
+int main(int argc, char** argv)
+{
+    FaunBuffer* bufs;
+    const char* error;
+    const char* output = NULL;
+    int rate = DEF_RATE;
+    int fmt;
+    int i, count = 0;
+
+    _errStream = stderr;
+#ifdef SIMUL_MIX
+    mix_selectKernels();
+#endif
+
+    bufs = (FaunBuffer*) calloc(argc, sizeof(FaunBuffer));
+    if (! bufs)
+        return 1;
+
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            fmt = parseFormat(argv[++i]);
+            if (fmt < 0) {
+                fprintf(stderr, "Invalid format %s\n", argv[i]);
+                return 1;
+            }
+            faun_setOption(FAUN_BUFFER_FORMAT, fmt);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rate = atoi(argv[++i]);
+            if (rate < LOAD_RATE_MIN || rate > LOAD_RATE_MAX) {
+                fprintf(stderr, "Invalid rate %s\n", argv[i]);
+                return 1;
+            }
+        } else if (argv[i][0] == '-') {
+            usage();
+            return (strcmp(argv[i], "-h") == 0) ? 0 : 1;
+        } else if (! output) {
+            output = argv[i];
+        } else {
+            error = loadInput(bufs + count, argv[i], rate);
+            if (error) {
+                fprintf(stderr, "%s: %s\n", argv[i], error);
+                return 1;
+            }
+            ++count;
+        }
+    }
+
+    if (! count) {
+        usage();
+        return 1;
+    }
+    if (count > 0xffff || ! writeBank(output, bufs, count)) {
+        fprintf(stderr, "Cannot write bank %s\n", output);
+        return 1;
+    }
+    return 0;
+}
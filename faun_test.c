@@ -41,7 +41,7 @@ int command(const char* str)
 int param(const char* str)
 {
     static const char* paramName[FAUN_PARAM_COUNT] = {
-        "vol", "fade", "end"
+        "vol", "vol-apply", "fade", "end", "bus", "rate", "pri"
     };
     int i;
     for (i = 0; i < FAUN_PARAM_COUNT; ++i) {
@@ -52,6 +52,27 @@ int param(const char* str)
     return FAUN_PARAM_COUNT;
 }
 
+float loadMem(int bi, const char* file)
+{
+    FILE* fp;
+    void* data;
+    long size;
+    float dur = 0.0f;
+
+    fp = fopen(file, "rb");
+    if (! fp)
+        return dur;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = malloc(size);
+    if (data && fread(data, 1, size, fp) == (size_t) size)
+        dur = faun_loadBufferMem(bi, data, size);
+    free(data);
+    fclose(fp);
+    return dur;
+}
+
 int main(int argc, char** argv)
 {
     const char* error;
@@ -63,9 +84,13 @@ int main(int argc, char** argv)
     int i, ch;
     int si = 0;
     int enabled = 1;
+    int loading = 0;
     uint32_t offset = 0;
     uint32_t size = 0;
 
+    // The capture checksums in test/good are for this rate.
+    faun_setOption(FAUN_MIX_RATE, 44100);
+
     if ((error = faun_startup(16, 8, 3, 1, "Faun Test"))) {
         fprintf(stderr, "faun_startup: %s\n", error);
         return 1;
@@ -146,6 +171,56 @@ int main(int argc, char** argv)
             }
                 break;
 
+            case 'A':                   // Async Load Buffer
+                INC_ARG;
+                if (faun_loadBufferAsync(atoi(arg+2), argv[i], offset, size))
+                    ++loading;
+                offset = size = 0;
+                break;
+
+            case 'L':                   // Wait for async loads
+                for (ch = 0; loading; )
+                {
+                    faun_waitSignal(&sig);
+                    if (sig.signal == FAUN_SIGNAL_LOAD_FAILED)
+                        ch = 1;
+                    else if (sig.signal != FAUN_SIGNAL_LOADED)
+                        continue;
+                    --loading;
+                }
+                if (ch)
+                {
+                    fprintf(stderr, "Command -L failed\n");
+                    faun_shutdown();
+                    return EX_NOINPUT;
+                }
+                break;
+
+            case 'B':                   // Load Bank
+                INC_ARG;
+                if (! faun_loadBank(atoi(arg+2), argv[i]))
+                {
+                    fprintf(stderr, "Command -B%d failed\n", atoi(arg+2));
+                    faun_shutdown();
+                    return EX_NOINPUT;
+                }
+                break;
+
+            case 'M':                   // Load Buffer from Memory
+                INC_ARG;
+                ch = atoi(arg+2);
+                if (! loadMem(ch, argv[i]))
+                {
+                    fprintf(stderr, "Command -M%d failed\n", ch);
+                    faun_shutdown();
+                    return EX_NOINPUT;
+                }
+                break;
+
+            case 'F':                   // Buffer Format (FaunFormat)
+                faun_setOption(FAUN_BUFFER_FORMAT, atoi(arg+2));
+                break;
+
             case 'W':                   // Wait for signal
                 faun_closeOnSignal();
                 faun_waitSignal(&sig);
@@ -228,6 +303,10 @@ int main(int argc, char** argv)
                     PUSH_OP_ARG(FO_QUEUE);
                     break;
 
+                case 'r':               // ra - Playback rate (percent)
+                    PUSH_OP_ARG(FO_SET_RATE);
+                    break;
+
                 case 's':               // so - Set Source
                                         // ss - Start Stream
                     if (arg[1] == 'o') {
@@ -22,6 +22,7 @@ faun-compile: func [blk block!] [
       | 'pan    double! double! (append bc 15 vol-pair bc second tok third tok)
       | 'signal         (append bc 16)
       | 'capture        (append bc 17)
+      | 'set-rate double! (appair bc 18 to-int mul 100.0 second tok)
       | path! opt int! (
             b: to-block first tok
             stype: first b
@@ -70,6 +71,7 @@ bc-arguments: func [bc binary!] [
            15 [prin " pa" prin [second bc third bc] bc: skip bc 2]
            16 [prin " sg"]
            17 [prin " ca"]
+           18 [prin " ra" ++ bc prin first bc]
               [prin "<?>"]
         ]
         ++ bc
@@ -7,6 +7,8 @@ enum FaunSampleFormat {
     FAUN_S16,
     FAUN_S24,
     FAUN_F32,
+    FAUN_ADPCM,     // IMA ADPCM blocks (buffer storage only)
+    FAUN_VORBIS,    // Ogg Vorbis file data (buffer storage only)
     FAUN_FORMAT_COUNT
 };
 
@@ -48,6 +50,7 @@ typedef struct {
    pthread_t    thread;
    void*        backend;
    uint32_t     updateHz;
+   uint32_t     outFormat;      // FaunSampleFormat given to sysaudio_write.
 #ifdef ANDROID
    uint32_t     frameBytes;
 #endif
@@ -55,3 +58,4 @@ typedef struct {
 FaunVoice;
 
 void faun_reserve(FaunBuffer* buf, int frames);
+void faun_setMixRate(FaunVoice* voice, int rate);
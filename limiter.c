@@ -0,0 +1,169 @@
+/*
+  Faun master limiter
+
+  Frames over the threshold get a gain which is the minimum required over
+  the LIMIT_LOOKAHEAD frames that follow them (hold), released slowly back
+  to 1.0, and smoothed with a moving average of the same length.  This
+  lowers the gain before a peak arrives so the output is delayed by
+  LIMIT_DELAY frames.
+
+  When the limiter is not reducing the gain and a whole update is under the
+  threshold only the delay is applied.
+*/
+
+#define LIMIT_LOOKAHEAD     64      // Power of two.
+#define LIMIT_DELAY         (LIMIT_LOOKAHEAD - 1)
+#define LIMIT_RELEASE_SEC   0.08f
+
+typedef struct {
+    float    threshold;
+    float    release;       // Release coefficient per frame.
+    float    gain;          // Current released gain.
+    double   sum;           // Sum of ring.
+    uint32_t idle;          // Frames since the released gain was below 1.0.
+    uint32_t pos;           // Input frame counter.
+    uint32_t hhead;         // Hold queue start & length.
+    uint32_t hlen;
+    float*   delay;         // Last LIMIT_DELAY input frames.
+    float*   delayNext;
+    float*   frameGain;     // Gain for each sample of an update.
+    float    ring[LIMIT_LOOKAHEAD];     // Released gains being averaged.
+    float    holdVal[LIMIT_LOOKAHEAD];  // Ascending minimums of the hold.
+    uint32_t holdPos[LIMIT_LOOKAHEAD];
+}
+Limiter;
+
+
+/*
+  Allocate a limiter for updates of the given number of frames.
+  Free it with free().
+
+  \param threshold  Peak output level (0.0 - 1.0).
+  \param rate       Sample rate.
+  \param frames     Number of frames in each update.
+*/
+static Limiter* limiter_alloc(float threshold, uint32_t rate, uint32_t frames)
+{
+    Limiter* lim;
+    int i;
+
+    lim = (Limiter*) malloc(sizeof(Limiter) +
+                            (LIMIT_DELAY*2*2 + frames*2) * sizeof(float));
+    if (lim) {
+        lim->threshold = threshold;
+        lim->release = 1.0f - expf(-1.0f / (LIMIT_RELEASE_SEC * rate));
+        lim->gain = 1.0f;
+        lim->sum = LIMIT_LOOKAHEAD;
+        lim->idle = LIMIT_LOOKAHEAD;
+        lim->pos = 0;
+        lim->hhead = lim->hlen = 0;
+        lim->delay     = (float*) (lim + 1);
+        lim->delayNext = lim->delay + LIMIT_DELAY*2;
+        lim->frameGain = lim->delayNext + LIMIT_DELAY*2;
+        memset(lim->delay, 0, LIMIT_DELAY*2 * sizeof(float));
+        for (i = 0; i < LIMIT_LOOKAHEAD; ++i)
+            lim->ring[i] = 1.0f;
+    }
+    return lim;
+}
+
+
+/*
+  Turn the required gain of each frame into the smoothed gain to apply to
+  the delayed output.
+*/
+static void limiter_smooth(Limiter* lim, float* gain, uint32_t frames)
+{
+    const uint32_t mask = LIMIT_LOOKAHEAD - 1;
+    float* end = gain + frames*2;
+    float g, r, s;
+    uint32_t pos = lim->pos;
+    uint32_t head = lim->hhead;
+    uint32_t len = lim->hlen;
+    uint32_t n;
+
+    r = lim->gain;
+    for (; gain != end; gain += 2, ++pos) {
+        // Hold the minimum gain of the window.
+        if (len && lim->holdPos[head] + LIMIT_LOOKAHEAD <= pos) {
+            head = (head + 1) & mask;
+            --len;
+        }
+        g = gain[0];
+        while (len && lim->holdVal[(head + len - 1) & mask] >= g)
+            --len;
+        n = (head + len) & mask;
+        lim->holdVal[n] = g;
+        lim->holdPos[n] = pos;
+        ++len;
+        g = lim->holdVal[head];
+
+        // Release.
+        if (g < r)
+            r = g;
+        else if (r < 1.0f) {
+            r += (g - r) * lim->release;
+            if (r > 0.9999f)
+                r = 1.0f;
+        }
+
+        if (r < 1.0f)
+            lim->idle = 0;
+        else if (++lim->idle == LIMIT_LOOKAHEAD)
+            lim->sum = LIMIT_LOOKAHEAD;     // Discard rounding errors.
+
+        // Average.
+        n = pos & mask;
+        lim->sum += r - lim->ring[n];
+        lim->ring[n] = r;
+        s = (float) (lim->sum * (1.0 / LIMIT_LOOKAHEAD));
+        gain[0] = gain[1] = s;
+    }
+
+    lim->gain = r;
+    lim->pos = pos;
+    lim->hhead = head;
+    lim->hlen = len;
+}
+
+
+/*
+  Limit the peaks of the mixed samples in place.
+
+  \param mix     Stereo samples.
+  \param frames  Number of frames in mix.  Must be at least LIMIT_DELAY.
+*/
+static void limiter_process(Limiter* lim, float* mix, uint32_t frames)
+{
+    const uint32_t dlen = LIMIT_DELAY*2;
+    float* tail = mix + (frames*2 - dlen);
+    float* gain;
+    float* end;
+    float* tmp;
+
+    if (lim->idle >= LIMIT_LOOKAHEAD &&
+        _mixk.peak(mix, frames*2) <= lim->threshold) {
+        lim->idle += frames;
+        lim->pos += frames;
+        lim->hlen = 0;
+        gain = NULL;
+    } else {
+        gain = lim->frameGain;
+        _mixk.limitGain(gain, mix, frames*2, lim->threshold);
+        limiter_smooth(lim, gain, frames);
+    }
+
+    // Delay the input.
+    memcpy(lim->delayNext, tail, dlen * sizeof(float));
+    memmove(mix + dlen, mix, (frames*2 - dlen) * sizeof(float));
+    memcpy(mix, lim->delay, dlen * sizeof(float));
+    tmp = lim->delay;
+    lim->delay = lim->delayNext;
+    lim->delayNext = tmp;
+
+    if (gain) {
+        end = mix + frames*2;
+        for (; mix != end; ++mix, ++gain)
+            *mix *= *gain;
+    }
+}
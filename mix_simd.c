@@ -0,0 +1,924 @@
+/*
+  Faun SIMD mixing kernels
+
+  These produce the same results as the scalar _mix*Stereo functions.
+  The multiply & add order of each output sample is kept identical and
+  no fused multiply-add is used, so the capture checksums do not change.
+
+  The kernel set is chosen once by mix_selectKernels() from faun_startup().
+  It also holds the panning of mono inputs, the conversion of the final
+  mix for 16-bit output, the unpacking of 16-bit buffers, the gain
+  computation of the limiter, the filter of the resampler, and the
+  interpolation of sources played at another rate.
+
+  The loaders & stream decoders use the conversion and interleave kernels.
+  These divide by 32767 like the scalar code, so loaded samples are also
+  unchanged.
+*/
+
+#if defined(FAUN_NO_SIMD)
+#elif defined(__SSE2__) || defined(_M_X64) || \
+      (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIX_SSE2
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define MIX_AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER)
+#define MIX_AVX2
+#define TARGET_AVX2
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define MIX_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#define MIX_INLINE  static __forceinline
+#else
+#define MIX_INLINE  static inline __attribute__((always_inline))
+#endif
+
+typedef void (*MixStereoFunc)(float* restrict output, float* end,
+                              const float** input,
+                              const float* gainL, const float* gainR,
+                              int init);
+
+typedef void (*MixRampFunc)(float* restrict output, float* end,
+                            const float* restrict input,
+                            const float* restrict ramp);
+
+typedef void (*MixMonoFunc)(float* restrict output, float* end,
+                            const float* restrict input,
+                            float gainL, float gainR, int init);
+
+typedef void (*MixOutputFunc)(int16_t* dst, const float* src, uint32_t count,
+                              uint32_t* seed);
+
+typedef void (*MixUnpackFunc)(float* dst, const int16_t* src, uint32_t count);
+
+typedef float (*MixPeakFunc)(const float* src, uint32_t count);
+
+typedef void (*MixLimitFunc)(float* gain, const float* src, uint32_t count,
+                             float threshold);
+
+typedef void (*MixFirFunc)(float* out, const float* in, const float* coef,
+                           uint32_t taps);
+
+typedef void (*MixInterpFunc)(float* restrict out, uint32_t frames,
+                              const float* restrict in, uint32_t frac,
+                              uint32_t step);
+
+typedef void (*MixConvS16Func)(float* dst, const int16_t* src,
+                               uint32_t count);
+
+typedef void (*MixConvS32Func)(float* dst, const int32_t* src,
+                               uint32_t count, int shift);
+
+typedef void (*MixInterleaveFunc)(float* dst, const float* l, const float* r,
+                                  uint32_t frames);
+
+typedef void (*MixInterleaveS32Func)(float* dst, const int32_t* l,
+                                     const int32_t* r, uint32_t frames,
+                                     int shift);
+
+typedef struct {
+    MixStereoFunc mix[4];       // 1, 2, 4, & 8 inputs.
+    MixRampFunc ramp;
+    MixMonoFunc mixMono;
+    MixOutputFunc outputS16;
+    MixUnpackFunc unpackS16;
+    MixPeakFunc peak;
+    MixLimitFunc limitGain;
+    MixFirFunc fir;
+    MixInterpFunc interp;
+    MixConvS16Func convS16;
+    MixConvS32Func convS32;
+    MixInterleaveFunc interleave;
+    MixInterleaveS32Func interleaveS32;
+    const char* name;
+}
+MixKernels;
+
+static MixKernels _mixk;
+
+#define MIX_WRAPPER(name, impl, N) \
+static void name(float* restrict output, float* end, const float** input, \
+                 const float* gainL, const float* gainR, int init) { \
+    impl(output, end, input, gainL, gainR, init, N); \
+}
+
+#if defined(MIX_SSE2) || defined(MIX_NEON)
+/*
+  Mix the trailing samples which do not fill a vector using the scalar
+  kernel for the same input count.
+*/
+static void _mixTail(float* output, float* end, const float** input,
+                     const float* gainL, const float* gainR, int init,
+                     int inCount, size_t offset)
+{
+    const float* tin[8];
+    int i;
+
+    if (output == end)
+        return;
+    for (i = 0; i < inCount; ++i)
+        tin[i] = input[i] + offset;
+
+    switch (inCount) {
+        case 1:
+            _mix1Stereo(output, end, tin, gainL, gainR, init);
+            break;
+        case 2:
+            _mix2Stereo(output, end, tin, gainL, gainR, init);
+            break;
+        case 4:
+            _mix4Stereo(output, end, tin, gainL, gainR, init);
+            break;
+        default:
+            _mix8Stereo(output, end, tin, gainL, gainR, init);
+            break;
+    }
+}
+#endif
+
+#ifdef MIX_SSE2
+/*
+  Sum products of up to four inputs in the same order as _mix4Stereo:
+  ((in0*g0 + in1*g1) + in2*g2) + in3*g3
+*/
+MIX_INLINE __m128 _sumSSE(const float** in, const __m128* g, size_t i,
+                          int first, int count)
+{
+    __m128 sum = _mm_mul_ps(_mm_loadu_ps(in[first] + i), g[first]);
+    int k;
+    for (k = first + 1; k < first + count; ++k)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(in[k] + i), g[k]));
+    return sum;
+}
+
+MIX_INLINE void _mixNSSE(float* restrict output, float* end,
+                         const float** input,
+                         const float* gainL, const float* gainR, int init,
+                         const int inCount)
+{
+    __m128 g[8];
+    __m128 sum;
+    size_t i;
+    size_t vlen = (size_t) (end - output) & ~(size_t) 3;
+    const int group = (inCount > 4) ? 4 : inCount;
+    int k;
+
+    for (k = 0; k < inCount; ++k)
+        g[k] = _mm_setr_ps(gainL[k], gainR[k], gainL[k], gainR[k]);
+
+    for (i = 0; i < vlen; i += 4) {
+        sum = _sumSSE(input, g, i, 0, group);
+        if (! init)
+            sum = _mm_add_ps(_mm_loadu_ps(output + i), sum);
+        if (inCount > 4)
+            sum = _mm_add_ps(sum, _sumSSE(input, g, i, 4, 4));
+        _mm_storeu_ps(output + i, sum);
+    }
+
+    _mixTail(output + vlen, end, input, gainL, gainR, init, inCount, vlen);
+}
+
+MIX_WRAPPER(_mix1StereoSSE, _mixNSSE, 1)
+MIX_WRAPPER(_mix2StereoSSE, _mixNSSE, 2)
+MIX_WRAPPER(_mix4StereoSSE, _mixNSSE, 4)
+MIX_WRAPPER(_mix8StereoSSE, _mixNSSE, 8)
+
+static void _mixRampSSE(float* restrict output, float* end,
+                        const float* restrict input,
+                        const float* restrict ramp)
+{
+    float* vend = output + ((size_t) (end - output) & ~(size_t) 3);
+    for (; output != vend; output += 4, input += 4, ramp += 4) {
+        __m128 prod = _mm_mul_ps(_mm_loadu_ps(input), _mm_loadu_ps(ramp));
+        _mm_storeu_ps(output, _mm_add_ps(_mm_loadu_ps(output), prod));
+    }
+    _mixRampStereo(output, end, input, ramp);
+}
+
+/*
+  Four frame version of _mixMonoStereo.
+*/
+static void _mixMonoSSE(float* restrict output, float* end,
+                        const float* restrict input,
+                        float gainL, float gainR, int init)
+{
+    const __m128 g = _mm_setr_ps(gainL, gainR, gainL, gainR);
+    float* vend = output + ((size_t) (end - output) & ~(size_t) 7);
+    __m128 v, lo, hi;
+
+    for (; output != vend; output += 8, input += 4) {
+        v  = _mm_loadu_ps(input);
+        lo = _mm_mul_ps(_mm_unpacklo_ps(v, v), g);
+        hi = _mm_mul_ps(_mm_unpackhi_ps(v, v), g);
+        if (! init) {
+            lo = _mm_add_ps(_mm_loadu_ps(output), lo);
+            hi = _mm_add_ps(_mm_loadu_ps(output + 4), hi);
+        }
+        _mm_storeu_ps(output, lo);
+        _mm_storeu_ps(output + 4, hi);
+    }
+    _mixMonoStereo(output, end, input, gainL, gainR, init);
+}
+
+/*
+  Two frame version of _interpStereo.
+*/
+static void _interpStereoSSE(float* restrict out, uint32_t frames,
+                             const float* restrict in, uint32_t frac,
+                             uint32_t step)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 65536.0f);
+    float* vend = out + (frames & ~1u)*2;
+    const float* in1;
+    __m128 a0, a1, va, vb, t;
+    uint32_t frac1;
+
+    for (; out != vend; out += 4) {
+        frac1 = frac + step;
+        in1 = in + (frac1 >> 16) * 2;
+        frac1 &= 0xffff;
+
+        a0 = _mm_loadu_ps(in);
+        a1 = _mm_loadu_ps(in1);
+        va = _mm_movelh_ps(a0, a1);
+        vb = _mm_movehl_ps(a1, a0);
+        t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_setr_epi32(frac, frac,
+                                                      frac1, frac1)), scale);
+        _mm_storeu_ps(out, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), t)));
+
+        frac = frac1 + step;
+        in = in1 + (frac >> 16) * 2;
+        frac &= 0xffff;
+    }
+    _interpStereo(out, frames & 1, in, frac, step);
+}
+
+/*
+  Four sample version of _outputS16.
+*/
+static void _outputS16SSE(int16_t* dst, const float* src, uint32_t count,
+                          uint32_t* seed)
+{
+    const __m128  scale  = _mm_set1_ps(32767.0f);
+    const __m128  dscale = _mm_set1_ps(1.0f / 65536.0f);
+    const __m128  vmax   = _mm_set1_ps(32767.0f);
+    const __m128  vmin   = _mm_set1_ps(-32768.0f);
+    const __m128i mask   = _mm_set1_epi32(0xffff);
+    const __m128i bias   = _mm_set1_epi32(65535);
+    __m128i x = _mm_loadu_si128((const __m128i*) seed);
+    __m128i r;
+    __m128 v;
+    const float* vend = src + (count & ~(uint32_t) (DITHER_LANES - 1));
+
+    for (; src != vend; src += 4, dst += 4) {
+        x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+        x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+        x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+        r = _mm_sub_epi32(_mm_add_epi32(_mm_and_si128(x, mask),
+                                        _mm_srli_epi32(x, 16)), bias);
+        v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src), scale),
+                       _mm_mul_ps(_mm_cvtepi32_ps(r), dscale));
+        v = _mm_min_ps(_mm_max_ps(v, vmin), vmax);
+        r = _mm_cvtps_epi32(v);
+        _mm_storel_epi64((__m128i*) dst, _mm_packs_epi32(r, r));
+    }
+    _mm_storeu_si128((__m128i*) seed, x);
+
+    _outputS16(dst, src, count & (DITHER_LANES - 1), seed);
+}
+
+/*
+  Eight sample version of _unpackS16.
+*/
+static void _unpackS16SSE(float* dst, const int16_t* src, uint32_t count)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 32767.0f);
+    const int16_t* vend = src + (count & ~7u);
+    __m128i v, lo, hi;
+
+    for (; src != vend; src += 8, dst += 8) {
+        v  = _mm_loadu_si128((const __m128i*) src);
+        lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    _unpackS16(dst, src, count & 7);
+}
+
+static float _peakSSE(const float* src, uint32_t count)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const float* vend = src + (count & ~3u);
+    __m128 peak = _mm_setzero_ps();
+    float tail;
+
+    for (; src != vend; src += 4)
+        peak = _mm_max_ps(peak, _mm_andnot_ps(sign, _mm_loadu_ps(src)));
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+
+    tail = _peak(src, count & 3);
+    return (tail > _mm_cvtss_f32(peak)) ? tail : _mm_cvtss_f32(peak);
+}
+
+static void _limitGainSSE(float* gain, const float* src, uint32_t count,
+                          float threshold)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 thr  = _mm_set1_ps(threshold);
+    const float* vend = src + (count & ~3u);
+    __m128 a;
+
+    for (; src != vend; src += 4, gain += 4) {
+        a = _mm_andnot_ps(sign, _mm_loadu_ps(src));
+        a = _mm_max_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2,3,0,1)));
+        _mm_storeu_ps(gain, _mm_min_ps(one, _mm_div_ps(thr, a)));
+    }
+    _limitGain(gain, src, count & 3, threshold);
+}
+
+static void _firStereoSSE(float* out, const float* in, const float* coef,
+                          uint32_t taps)
+{
+    const float* end = in + (taps & ~3)*2;
+    __m128 s0 = _mm_setzero_ps();
+    __m128 s1 = _mm_setzero_ps();
+
+    for (; in != end; in += 8, coef += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(in), _mm_loadu_ps(coef)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(in + 4),
+                                       _mm_loadu_ps(coef + 4)));
+    }
+    s0 = _mm_add_ps(s0, s1);
+    s0 = _mm_add_ps(s0, _mm_movehl_ps(s0, s0));
+    _mm_storel_pi((__m64*) out, s0);
+
+    if (taps & 3) {
+        float t[2];
+        _firStereo(t, in, coef, taps & 3);
+        out[0] += t[0];
+        out[1] += t[1];
+    }
+}
+
+static void _convS16SSE(float* dst, const int16_t* src, uint32_t count)
+{
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const int16_t* vend = src + (count & ~7u);
+    __m128i v, lo, hi;
+
+    for (; src != vend; src += 8, dst += 8) {
+        v  = _mm_loadu_si128((const __m128i*) src);
+        lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst,     _mm_div_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + 4, _mm_div_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    _convS16(dst, src, count & 7);
+}
+
+MIX_INLINE __m128 _convS32x4SSE(const int32_t* src, __m128 scale)
+{
+    __m128i v = _mm_loadu_si128((const __m128i*) src);
+    return _mm_div_ps(_mm_cvtepi32_ps(v), scale);
+}
+
+static void _convS32SSE(float* dst, const int32_t* src, uint32_t count,
+                        int shift)
+{
+    const __m128 scale = _mm_set1_ps(CONV_S32_SCALE(shift));
+    const int32_t* vend = src + (count & ~3u);
+
+    for (; src != vend; src += 4, dst += 4)
+        _mm_storeu_ps(dst, _convS32x4SSE(src, scale));
+    _convS32(dst, src, count & 3, shift);
+}
+
+static void _interleaveSSE(float* dst, const float* l, const float* r,
+                           uint32_t frames)
+{
+    const float* vend = l + (frames & ~3u);
+    __m128 a, b;
+
+    for (; l != vend; l += 4, r += 4, dst += 8) {
+        a = _mm_loadu_ps(l);
+        b = _mm_loadu_ps(r);
+        _mm_storeu_ps(dst,     _mm_unpacklo_ps(a, b));
+        _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(a, b));
+    }
+    _interleave(dst, l, r, frames & 3);
+}
+
+static void _interleaveS32SSE(float* dst, const int32_t* l, const int32_t* r,
+                              uint32_t frames, int shift)
+{
+    const __m128 scale = _mm_set1_ps(CONV_S32_SCALE(shift));
+    const int32_t* vend = l + (frames & ~3u);
+    __m128 a, b;
+
+    for (; l != vend; l += 4, r += 4, dst += 8) {
+        a = _convS32x4SSE(l, scale);
+        b = _convS32x4SSE(r, scale);
+        _mm_storeu_ps(dst,     _mm_unpacklo_ps(a, b));
+        _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(a, b));
+    }
+    _interleaveS32(dst, l, r, frames & 3, shift);
+}
+#endif
+
+#ifdef MIX_AVX2
+TARGET_AVX2
+MIX_INLINE __m256 _sumAVX(const float** in, const __m256* g, size_t i,
+                          int first, int count)
+{
+    __m256 sum = _mm256_mul_ps(_mm256_loadu_ps(in[first] + i), g[first]);
+    int k;
+    for (k = first + 1; k < first + count; ++k)
+        sum = _mm256_add_ps(sum,
+                            _mm256_mul_ps(_mm256_loadu_ps(in[k] + i), g[k]));
+    return sum;
+}
+
+TARGET_AVX2
+MIX_INLINE void _mixNAVX(float* restrict output, float* end,
+                         const float** input,
+                         const float* gainL, const float* gainR, int init,
+                         const int inCount)
+{
+    __m256 g[8];
+    __m256 sum;
+    size_t i;
+    size_t vlen = (size_t) (end - output) & ~(size_t) 7;
+    const int group = (inCount > 4) ? 4 : inCount;
+    int k;
+
+    for (k = 0; k < inCount; ++k)
+        g[k] = _mm256_setr_ps(gainL[k], gainR[k], gainL[k], gainR[k],
+                              gainL[k], gainR[k], gainL[k], gainR[k]);
+
+    for (i = 0; i < vlen; i += 8) {
+        sum = _sumAVX(input, g, i, 0, group);
+        if (! init)
+            sum = _mm256_add_ps(_mm256_loadu_ps(output + i), sum);
+        if (inCount > 4)
+            sum = _mm256_add_ps(sum, _sumAVX(input, g, i, 4, 4));
+        _mm256_storeu_ps(output + i, sum);
+    }
+
+    _mixTail(output + vlen, end, input, gainL, gainR, init, inCount, vlen);
+}
+
+#define MIX_WRAPPER_AVX(name, N) \
+TARGET_AVX2 \
+static void name(float* restrict output, float* end, const float** input, \
+                 const float* gainL, const float* gainR, int init) { \
+    _mixNAVX(output, end, input, gainL, gainR, init, N); \
+}
+
+MIX_WRAPPER_AVX(_mix1StereoAVX, 1)
+MIX_WRAPPER_AVX(_mix2StereoAVX, 2)
+MIX_WRAPPER_AVX(_mix4StereoAVX, 4)
+MIX_WRAPPER_AVX(_mix8StereoAVX, 8)
+
+TARGET_AVX2
+static void _firStereoAVX(float* out, const float* in, const float* coef,
+                          uint32_t taps)
+{
+    const float* end = in + (taps & ~3)*2;
+    __m256 s = _mm256_setzero_ps();
+    __m128 s0;
+
+    for (; in != end; in += 8, coef += 8)
+        s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(in),
+                                           _mm256_loadu_ps(coef)));
+    s0 = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    s0 = _mm_add_ps(s0, _mm_movehl_ps(s0, s0));
+    _mm_storel_pi((__m64*) out, s0);
+
+    if (taps & 3) {
+        float t[2];
+        _firStereo(t, in, coef, taps & 3);
+        out[0] += t[0];
+        out[1] += t[1];
+    }
+}
+
+TARGET_AVX2
+static void _mixRampAVX(float* restrict output, float* end,
+                        const float* restrict input,
+                        const float* restrict ramp)
+{
+    float* vend = output + ((size_t) (end - output) & ~(size_t) 7);
+    for (; output != vend; output += 8, input += 8, ramp += 8) {
+        __m256 prod = _mm256_mul_ps(_mm256_loadu_ps(input),
+                                    _mm256_loadu_ps(ramp));
+        _mm256_storeu_ps(output, _mm256_add_ps(_mm256_loadu_ps(output), prod));
+    }
+    _mixRampStereo(output, end, input, ramp);
+}
+#endif
+
+#ifdef MIX_NEON
+MIX_INLINE float32x4_t _sumNEON(const float** in, const float32x4_t* g,
+                                size_t i, int first, int count)
+{
+    float32x4_t sum = vmulq_f32(vld1q_f32(in[first] + i), g[first]);
+    int k;
+    for (k = first + 1; k < first + count; ++k)
+        sum = vaddq_f32(sum, vmulq_f32(vld1q_f32(in[k] + i), g[k]));
+    return sum;
+}
+
+MIX_INLINE void _mixNNEON(float* restrict output, float* end,
+                          const float** input,
+                          const float* gainL, const float* gainR, int init,
+                          const int inCount)
+{
+    float32x4_t g[8];
+    float32x4_t sum;
+    size_t i;
+    size_t vlen = (size_t) (end - output) & ~(size_t) 3;
+    const int group = (inCount > 4) ? 4 : inCount;
+    int k;
+
+    for (k = 0; k < inCount; ++k) {
+        float lr[4] = { gainL[k], gainR[k], gainL[k], gainR[k] };
+        g[k] = vld1q_f32(lr);
+    }
+
+    for (i = 0; i < vlen; i += 4) {
+        sum = _sumNEON(input, g, i, 0, group);
+        if (! init)
+            sum = vaddq_f32(vld1q_f32(output + i), sum);
+        if (inCount > 4)
+            sum = vaddq_f32(sum, _sumNEON(input, g, i, 4, 4));
+        vst1q_f32(output + i, sum);
+    }
+
+    _mixTail(output + vlen, end, input, gainL, gainR, init, inCount, vlen);
+}
+
+MIX_WRAPPER(_mix1StereoNEON, _mixNNEON, 1)
+MIX_WRAPPER(_mix2StereoNEON, _mixNNEON, 2)
+MIX_WRAPPER(_mix4StereoNEON, _mixNNEON, 4)
+MIX_WRAPPER(_mix8StereoNEON, _mixNNEON, 8)
+
+static void _mixRampNEON(float* restrict output, float* end,
+                         const float* restrict input,
+                         const float* restrict ramp)
+{
+    float* vend = output + ((size_t) (end - output) & ~(size_t) 3);
+    for (; output != vend; output += 4, input += 4, ramp += 4) {
+        float32x4_t prod = vmulq_f32(vld1q_f32(input), vld1q_f32(ramp));
+        vst1q_f32(output, vaddq_f32(vld1q_f32(output), prod));
+    }
+    _mixRampStereo(output, end, input, ramp);
+}
+
+static void _mixMonoNEON(float* restrict output, float* end,
+                         const float* restrict input,
+                         float gainL, float gainR, int init)
+{
+    const float gv[4] = { gainL, gainR, gainL, gainR };
+    const float32x4_t g = vld1q_f32(gv);
+    float* vend = output + ((size_t) (end - output) & ~(size_t) 7);
+    float32x4x2_t z;
+    float32x4_t v, lo, hi;
+
+    for (; output != vend; output += 8, input += 4) {
+        v  = vld1q_f32(input);
+        z  = vzipq_f32(v, v);
+        lo = vmulq_f32(z.val[0], g);
+        hi = vmulq_f32(z.val[1], g);
+        if (! init) {
+            lo = vaddq_f32(vld1q_f32(output), lo);
+            hi = vaddq_f32(vld1q_f32(output + 4), hi);
+        }
+        vst1q_f32(output, lo);
+        vst1q_f32(output + 4, hi);
+    }
+    _mixMonoStereo(output, end, input, gainL, gainR, init);
+}
+
+static void _interpStereoNEON(float* restrict out, uint32_t frames,
+                              const float* restrict in, uint32_t frac,
+                              uint32_t step)
+{
+    float* vend = out + (frames & ~1u)*2;
+    const float* in1;
+    float32x4_t a0, a1, va, vb, t;
+    uint32_t frac1;
+
+    for (; out != vend; out += 4) {
+        frac1 = frac + step;
+        in1 = in + (frac1 >> 16) * 2;
+        frac1 &= 0xffff;
+
+        a0 = vld1q_f32(in);
+        a1 = vld1q_f32(in1);
+        va = vcombine_f32(vget_low_f32(a0), vget_low_f32(a1));
+        vb = vcombine_f32(vget_high_f32(a0), vget_high_f32(a1));
+        t = vcombine_f32(vdup_n_f32((float) frac  * (1.0f / 65536.0f)),
+                         vdup_n_f32((float) frac1 * (1.0f / 65536.0f)));
+        vst1q_f32(out, vaddq_f32(va, vmulq_f32(vsubq_f32(vb, va), t)));
+
+        frac = frac1 + step;
+        in = in1 + (frac >> 16) * 2;
+        frac &= 0xffff;
+    }
+    _interpStereo(out, frames & 1, in, frac, step);
+}
+
+static void _firStereoNEON(float* out, const float* in, const float* coef,
+                           uint32_t taps)
+{
+    const float* end = in + (taps & ~3)*2;
+    float32x4_t s0 = vdupq_n_f32(0.0f);
+    float32x4_t s1 = vdupq_n_f32(0.0f);
+    float32x2_t r;
+
+    for (; in != end; in += 8, coef += 8) {
+        s0 = vaddq_f32(s0, vmulq_f32(vld1q_f32(in), vld1q_f32(coef)));
+        s1 = vaddq_f32(s1, vmulq_f32(vld1q_f32(in + 4), vld1q_f32(coef + 4)));
+    }
+    s0 = vaddq_f32(s0, s1);
+    r = vadd_f32(vget_low_f32(s0), vget_high_f32(s0));
+    vst1_f32(out, r);
+
+    if (taps & 3) {
+        float t[2];
+        _firStereo(t, in, coef, taps & 3);
+        out[0] += t[0];
+        out[1] += t[1];
+    }
+}
+
+static void _unpackS16NEON(float* dst, const int16_t* src, uint32_t count)
+{
+    const float32x4_t scale = vdupq_n_f32(1.0f / 32767.0f);
+    const int16_t* vend = src + (count & ~7u);
+    int16x8_t v;
+
+    for (; src != vend; src += 8, dst += 8) {
+        v = vld1q_s16(src);
+        vst1q_f32(dst, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))),
+                                 scale));
+        vst1q_f32(dst + 4,
+                  vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))),
+                            scale));
+    }
+    _unpackS16(dst, src, count & 7);
+}
+
+static void _interleaveNEON(float* dst, const float* l, const float* r,
+                            uint32_t frames)
+{
+    const float* vend = l + (frames & ~3u);
+    float32x4x2_t z;
+
+    for (; l != vend; l += 4, r += 4, dst += 8) {
+        z.val[0] = vld1q_f32(l);
+        z.val[1] = vld1q_f32(r);
+        vst2q_f32(dst, z);
+    }
+    _interleave(dst, l, r, frames & 3);
+}
+
+#ifdef __aarch64__
+static void _convS16NEON(float* dst, const int16_t* src, uint32_t count)
+{
+    const float32x4_t scale = vdupq_n_f32(32767.0f);
+    const int16_t* vend = src + (count & ~7u);
+    int16x8_t v;
+
+    for (; src != vend; src += 8, dst += 8) {
+        v = vld1q_s16(src);
+        vst1q_f32(dst, vdivq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))),
+                                 scale));
+        vst1q_f32(dst + 4,
+                  vdivq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))),
+                            scale));
+    }
+    _convS16(dst, src, count & 7);
+}
+
+MIX_INLINE float32x4_t _convS32x4NEON(const int32_t* src, float32x4_t scale)
+{
+    return vdivq_f32(vcvtq_f32_s32(vld1q_s32(src)), scale);
+}
+
+static void _convS32NEON(float* dst, const int32_t* src, uint32_t count,
+                         int shift)
+{
+    const float32x4_t scale = vdupq_n_f32(CONV_S32_SCALE(shift));
+    const int32_t* vend = src + (count & ~3u);
+
+    for (; src != vend; src += 4, dst += 4)
+        vst1q_f32(dst, _convS32x4NEON(src, scale));
+    _convS32(dst, src, count & 3, shift);
+}
+
+static void _interleaveS32NEON(float* dst, const int32_t* l,
+                               const int32_t* r, uint32_t frames, int shift)
+{
+    const float32x4_t scale = vdupq_n_f32(CONV_S32_SCALE(shift));
+    const int32_t* vend = l + (frames & ~3u);
+    float32x4x2_t z;
+
+    for (; l != vend; l += 4, r += 4, dst += 8) {
+        z.val[0] = _convS32x4NEON(l, scale);
+        z.val[1] = _convS32x4NEON(r, scale);
+        vst2q_f32(dst, z);
+    }
+    _interleaveS32(dst, l, r, frames & 3, shift);
+}
+
+/*
+  Four sample version of _outputS16.
+*/
+static void _outputS16NEON(int16_t* dst, const float* src, uint32_t count,
+                           uint32_t* seed)
+{
+    const float32x4_t scale  = vdupq_n_f32(32767.0f);
+    const float32x4_t dscale = vdupq_n_f32(1.0f / 65536.0f);
+    const float32x4_t vmax   = vdupq_n_f32(32767.0f);
+    const float32x4_t vmin   = vdupq_n_f32(-32768.0f);
+    const uint32x4_t  mask   = vdupq_n_u32(0xffff);
+    const int32x4_t   bias   = vdupq_n_s32(65535);
+    uint32x4_t x = vld1q_u32(seed);
+    int32x4_t r;
+    float32x4_t v;
+    const float* vend = src + (count & ~(uint32_t) (DITHER_LANES - 1));
+
+    for (; src != vend; src += 4, dst += 4) {
+        x = veorq_u32(x, vshlq_n_u32(x, 13));
+        x = veorq_u32(x, vshrq_n_u32(x, 17));
+        x = veorq_u32(x, vshlq_n_u32(x, 5));
+        r = vsubq_s32(vreinterpretq_s32_u32(vaddq_u32(vandq_u32(x, mask),
+                                                      vshrq_n_u32(x, 16))),
+                      bias);
+        v = vaddq_f32(vmulq_f32(vld1q_f32(src), scale),
+                      vmulq_f32(vcvtq_f32_s32(r), dscale));
+        v = vminq_f32(vmaxq_f32(v, vmin), vmax);
+        vst1_s16(dst, vqmovn_s32(vcvtnq_s32_f32(v)));
+    }
+    vst1q_u32(seed, x);
+
+    _outputS16(dst, src, count & (DITHER_LANES - 1), seed);
+}
+
+static float _peakNEON(const float* src, uint32_t count)
+{
+    const float* vend = src + (count & ~3u);
+    float32x4_t peak = vdupq_n_f32(0.0f);
+    float tail;
+
+    for (; src != vend; src += 4)
+        peak = vmaxq_f32(peak, vabsq_f32(vld1q_f32(src)));
+
+    tail = _peak(src, count & 3);
+    return (tail > vmaxvq_f32(peak)) ? tail : vmaxvq_f32(peak);
+}
+
+static void _limitGainNEON(float* gain, const float* src, uint32_t count,
+                           float threshold)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t thr = vdupq_n_f32(threshold);
+    const float* vend = src + (count & ~3u);
+    float32x4_t a;
+
+    for (; src != vend; src += 4, gain += 4) {
+        a = vabsq_f32(vld1q_f32(src));
+        a = vmaxq_f32(a, vrev64q_f32(a));
+        vst1q_f32(gain, vminq_f32(one, vdivq_f32(thr, a)));
+    }
+    _limitGain(gain, src, count & 3, threshold);
+}
+#endif
+#endif
+
+#ifdef MIX_AVX2
+static int mix_haveAVX2()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
+    __cpuid(info, 1);
+    // Require OSXSAVE & AVX, then check that the OS saves the YMM state.
+    if ((info[2] & 0x18000000) != 0x18000000)
+        return 0;
+    if ((_xgetbv(0) & 6) != 6)
+        return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] & 0x20) != 0;
+#endif
+}
+#endif
+
+/*
+  Set _mixk to the best kernels supported by the CPU.
+*/
+static void mix_selectKernels()
+{
+#ifdef MIX_AVX2
+    if (mix_haveAVX2()) {
+        _mixk.mix[0] = _mix1StereoAVX;
+        _mixk.mix[1] = _mix2StereoAVX;
+        _mixk.mix[2] = _mix4StereoAVX;
+        _mixk.mix[3] = _mix8StereoAVX;
+        _mixk.ramp = _mixRampAVX;
+        _mixk.mixMono = _mixMonoSSE;
+        _mixk.outputS16 = _outputS16SSE;
+        _mixk.unpackS16 = _unpackS16SSE;
+        _mixk.peak = _peakSSE;
+        _mixk.limitGain = _limitGainSSE;
+        _mixk.fir = _firStereoAVX;
+        _mixk.interp = _interpStereoSSE;
+        _mixk.convS16 = _convS16SSE;
+        _mixk.convS32 = _convS32SSE;
+        _mixk.interleave = _interleaveSSE;
+        _mixk.interleaveS32 = _interleaveS32SSE;
+        _mixk.name = "AVX2";
+        return;
+    }
+#endif
+#if defined(MIX_SSE2)
+    _mixk.mix[0] = _mix1StereoSSE;
+    _mixk.mix[1] = _mix2StereoSSE;
+    _mixk.mix[2] = _mix4StereoSSE;
+    _mixk.mix[3] = _mix8StereoSSE;
+    _mixk.ramp = _mixRampSSE;
+    _mixk.mixMono = _mixMonoSSE;
+    _mixk.outputS16 = _outputS16SSE;
+    _mixk.unpackS16 = _unpackS16SSE;
+    _mixk.peak = _peakSSE;
+    _mixk.limitGain = _limitGainSSE;
+    _mixk.fir = _firStereoSSE;
+    _mixk.interp = _interpStereoSSE;
+    _mixk.convS16 = _convS16SSE;
+    _mixk.convS32 = _convS32SSE;
+    _mixk.interleave = _interleaveSSE;
+    _mixk.interleaveS32 = _interleaveS32SSE;
+    _mixk.name = "SSE2";
+#elif defined(MIX_NEON)
+    _mixk.mix[0] = _mix1StereoNEON;
+    _mixk.mix[1] = _mix2StereoNEON;
+    _mixk.mix[2] = _mix4StereoNEON;
+    _mixk.mix[3] = _mix8StereoNEON;
+    _mixk.ramp = _mixRampNEON;
+    _mixk.mixMono = _mixMonoNEON;
+#ifdef __aarch64__
+    _mixk.outputS16 = _outputS16NEON;
+    _mixk.peak = _peakNEON;
+    _mixk.limitGain = _limitGainNEON;
+    _mixk.convS16 = _convS16NEON;
+    _mixk.convS32 = _convS32NEON;
+    _mixk.interleaveS32 = _interleaveS32NEON;
+#else
+    _mixk.outputS16 = _outputS16;
+    _mixk.peak = _peak;
+    _mixk.limitGain = _limitGain;
+    _mixk.convS16 = _convS16;
+    _mixk.convS32 = _convS32;
+    _mixk.interleaveS32 = _interleaveS32;
+#endif
+    _mixk.interleave = _interleaveNEON;
+    _mixk.unpackS16 = _unpackS16NEON;
+    _mixk.fir = _firStereoNEON;
+    _mixk.interp = _interpStereoNEON;
+    _mixk.name = "NEON";
+#else
+    _mixk.mix[0] = _mix1Stereo;
+    _mixk.mix[1] = _mix2Stereo;
+    _mixk.mix[2] = _mix4Stereo;
+    _mixk.mix[3] = _mix8Stereo;
+    _mixk.ramp = _mixRampStereo;
+    _mixk.mixMono = _mixMonoStereo;
+    _mixk.outputS16 = _outputS16;
+    _mixk.unpackS16 = _unpackS16;
+    _mixk.peak = _peak;
+    _mixk.limitGain = _limitGain;
+    _mixk.fir = _firStereo;
+    _mixk.interp = _interpStereo;
+    _mixk.convS16 = _convS16;
+    _mixk.convS32 = _convS32;
+    _mixk.interleave = _interleave;
+    _mixk.interleaveS32 = _interleaveS32;
+    _mixk.name = "scalar";
+#endif
+}
@@ -0,0 +1,533 @@
+/*
+  Faun parallel decoding
+
+  Long Ogg Vorbis & FLAC files are decoded into a buffer by several threads
+  at once.  The file data is read into memory and divided into pieces
+  which begin where a decoder can start; any sample for Vorbis (the
+  decoder is seeked) and a frame header for FLAC.  Each piece is decoded
+  into its own region of the buffer, so the samples are the same as those
+  of a serial decode.
+*/
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define SPLIT_MIN_FRAMES    (1 << 18)   // Least frames worth a thread.
+#define SPLIT_MAX           8
+
+typedef struct DecodePiece DecodePiece;
+
+struct DecodePiece {
+    void (*decode)(DecodePiece*);
+    const uint8_t* data;    // File data shared by all pieces.
+    uint32_t size;
+    uint32_t pos;           // Data offset where decoding begins.
+    uint32_t start;         // First frame of the piece.
+    uint32_t end;           // Frame after the last of the piece.
+    uint32_t metaEnd;       // FLAC metadata size.
+    FaunBuffer* buf;
+    const char* error;
+    int threaded;
+    pthread_t thread;
+};
+
+
+static int faun_processorCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int) n : 1;
+#endif
+}
+
+
+/*
+  Return the number of pieces to decode the given number of frames in.
+  A result less than two means the decode should not be split.
+*/
+static int split_count(uint32_t frames)
+{
+    uint32_t n = faun_processorCount();
+    if (n > SPLIT_MAX)
+        n = SPLIT_MAX;
+    if (n > frames / SPLIT_MIN_FRAMES)
+        n = frames / SPLIT_MIN_FRAMES;
+    return n;
+}
+
+
+/*
+  Read file data into memory.
+
+  \param start  File position of the data.
+  \param size   Bytes of data, or zero to read to the file end.  This is
+                set to the number of bytes read.
+*/
+static uint8_t* split_readData(FILE* fp, long start, uint32_t* size)
+{
+    uint8_t* mem;
+
+    if (! *size) {
+        fseek(fp, 0, SEEK_END);
+        *size = (uint32_t) (ftell(fp) - start);
+    }
+    fseek(fp, start, SEEK_SET);
+
+    mem = (uint8_t*) mem_alloc(*size);
+    if (mem && fread(mem, 1, *size, fp) != *size) {
+        mem_free(mem);
+        mem = NULL;
+    }
+    return mem;
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI split_thread(LPVOID arg)
+#else
+static void* split_thread(void* arg)
+#endif
+{
+    DecodePiece* pc = (DecodePiece*) arg;
+    pc->decode(pc);
+    return 0;
+}
+
+
+/*
+  Decode the pieces, one on the calling thread and each of the others on a
+  thread of its own.
+
+  Return error message of the first piece to fail or NULL if successful.
+*/
+static const char* split_run(DecodePiece* pieces, int count)
+{
+    DecodePiece* pc;
+    DecodePiece* end = pieces + count;
+
+    for (pc = pieces + 1; pc != end; ++pc) {
+        pc->threaded = ! threadCreateF(pc->thread, split_thread, pc);
+        if (! pc->threaded)
+            pc->decode(pc);
+    }
+    pieces->decode(pieces);
+
+    for (pc = pieces + 1; pc != end; ++pc) {
+        if (pc->threaded)
+            threadJoin(pc->thread);
+    }
+    for (pc = pieces; pc != end; ++pc) {
+        if (pc->error)
+            return pc->error;
+    }
+    return NULL;
+}
+
+
+static void split_decodeOgg(DecodePiece* pc)
+{
+    StreamOV os;
+    FaunBuffer part;
+    int chan = faun_channelCount(pc->buf->chanLayout);
+
+    // Minimal version of stream_init() to use stream_read().
+    os.sampleCount = 0;
+    os.rs.coef = NULL;
+    os.rsBuf = NULL;
+
+    os.mem.data = pc->data;
+    os.mem.buf  = NULL;
+    os.mem.size = pc->size;
+    os.mem.pos  = 0;
+
+    os.dec = &streamVorbis;
+    if (os.dec->open(&os)) {
+        pc->error = "Ogg open failed";
+        return;
+    }
+
+    if (pc->start && ov_pcm_seek(&os.in.vf, pc->start) < 0) {
+        pc->error = "Ogg seek failed";
+    } else {
+        part = *pc->buf;
+        part.sample.f32 += pc->start * chan;
+        part.avail = pc->end - pc->start;
+        stream_read(&os, &part);
+        if (part.used != part.avail)
+            pc->error = "Ogg read failed";
+    }
+    os.dec->close(&os);
+}
+
+
+/*
+  Decode Ogg Vorbis data in memory in pieces.  The buffer must already be
+  allocated for all the frames.  A count of one decodes serially.
+
+  Return error message or NULL if successful.
+*/
+static const char* split_oggMem(FaunBuffer* buf, const uint8_t* data,
+                                uint32_t size, int count)
+{
+    DecodePiece pieces[SPLIT_MAX];
+    DecodePiece* pc;
+    const char* error;
+    uint32_t frames = buf->avail;
+    int i;
+
+    for (i = 0, pc = pieces; i < count; ++i, ++pc) {
+        pc->decode = split_decodeOgg;
+        pc->data   = data;
+        pc->pos    = 0;
+        pc->size   = size;
+        pc->start  = (uint64_t) frames * i / count;
+        pc->end    = (uint64_t) frames * (i + 1) / count;
+        pc->buf    = buf;
+        pc->error  = NULL;
+    }
+
+    error = split_run(pieces, count);
+    if (! error)
+        buf->used = frames;
+    return error;
+}
+
+
+/*
+  Decode Ogg Vorbis file data in pieces.
+
+  \param start  File position of the data.
+  \param size   Bytes of data, or zero to read to the file end.
+*/
+static const char* split_ogg(FaunBuffer* buf, FILE* fp, long start,
+                             uint32_t size, int count)
+{
+    const char* error;
+    uint8_t* data = split_readData(fp, start, &size);
+    if (! data)
+        return "Ogg fread failed";
+    error = split_oggMem(buf, data, size, count);
+    mem_free(data);
+    return error;
+}
+
+
+#if USE_FLAC == 2
+#define FLAC_STREAMINFO_END 42      // Magic, block header & STREAMINFO.
+#define FLAC_FRAME_HEADER_MAX 16
+
+typedef struct {
+    uint32_t frames;
+    uint32_t rate;
+    uint32_t blockSize;     // Maximum block size.
+    int chan;
+}
+FlacInfo;
+
+
+/*
+  Read the STREAMINFO from the first FLAC_STREAMINFO_END bytes of a file.
+
+  Return non-zero if the stream can be decoded in pieces.
+*/
+static int split_flacInfo(FlacInfo* fi, const uint8_t* hdr)
+{
+    const uint8_t* si = hdr + 8;
+    uint64_t frames;
+
+    if (memcmp(hdr, "fLaC", 4) || (hdr[4] & 0x7F) != META_TYPE_STREAMINFO)
+        return 0;
+
+    fi->blockSize = (si[2] << 8) | si[3];
+    fi->rate = (si[10] << 12) | (si[11] << 4) | (si[12] >> 4);
+    fi->chan = ((si[12] >> 1) & 7) + 1;
+    frames = ((uint64_t) (si[13] & 15) << 32) | ((uint32_t) si[14] << 24) |
+             (si[15] << 16) | (si[16] << 8) | si[17];
+    fi->frames = frames;
+
+    return fi->chan <= 2 && frames <= UINT32_MAX &&
+           fi->blockSize <= FLAC_SUBSET_MAX_BLOCK_SIZE_48KHZ &&
+           fi->rate >= LOAD_RATE_MIN && fi->rate <= LOAD_RATE_MAX;
+}
+
+static uint8_t split_crc8(const uint8_t* it, const uint8_t* end)
+{
+    int crc = 0;
+    int i;
+    for (; it != end; ++it) {
+        crc ^= *it;
+        for (i = 0; i < 8; ++i)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x107 : crc << 1;
+    }
+    return crc;
+}
+
+
+/*
+  Check for a valid FLAC frame header.  At least FLAC_FRAME_HEADER_MAX
+  bytes must be readable.
+
+  \param blockSize  Block size of a fixed-blocksize stream.
+  \param sample     Set to the first frame (sample number) of the block.
+
+  Return non-zero if the header is valid.
+*/
+static int split_flacHeader(const uint8_t* hp, uint32_t blockSize,
+                            uint64_t* sample)
+{
+    const uint8_t* it = hp + 4;
+    uint64_t num;
+    int bsCode   = hp[2] >> 4;
+    int rateCode = hp[2] & 15;
+    int sizeCode = (hp[3] >> 1) & 7;
+    int n;
+
+    if (hp[0] != 0xFF || (hp[1] & 0xFE) != 0xF8 ||
+        ! bsCode || rateCode == 15 || (hp[3] >> 4) > 10 ||
+        sizeCode == 3 || sizeCode == 7 || (hp[3] & 1))
+        return 0;
+
+    // UTF-8 style coding of the frame or sample number.
+    num = *it++;
+    if (num < 0x80)
+        n = 0;
+    else if (num < 0xC0)
+        return 0;
+    else {
+        for (n = 1; n < 7 && (num & (0x40 >> n)); ++n)
+            ;
+        if (n == 7)
+            return 0;
+        num &= 0x3F >> n;
+    }
+    for (; n; --n, ++it) {
+        if ((*it & 0xC0) != 0x80)
+            return 0;
+        num = (num << 6) | (*it & 0x3F);
+    }
+
+    if (bsCode == 6)
+        it += 1;
+    else if (bsCode == 7)
+        it += 2;
+    if (rateCode == 12)
+        it += 1;
+    else if (rateCode > 12)
+        it += 2;
+
+    if (split_crc8(hp, it) != *it)
+        return 0;
+    *sample = (hp[1] & 1) ? num : num * blockSize;
+    return 1;
+}
+
+
+/*
+  Return the first frame of the block being output by the decoder.
+*/
+static uint64_t split_flacBlockStart(fx_flac_t* flac)
+{
+    const fx_flac_t* inst = (const fx_flac_t*) FX_ALIGN_ADDR(flac);
+    const fx_flac_frame_header_t* fh = inst->frame_header;
+    if (fh->blocking_strategy == BLK_VARIABLE)
+        return fh->sync_info;
+    return fh->sync_info * inst->streaminfo->max_block_size;
+}
+
+
+static void split_decodeFlac(DecodePiece* pc)
+{
+    const uint32_t decodeSize = FAUN_FLAC_DECODE_SIZE;
+    const uint8_t* in;
+    int32_t* decodeBuf;
+    float* pcmOut;
+    fx_flac_state_t fstate;
+    fx_flac_t* flac;
+    uint32_t inLen, procLen, avail;
+    int chan = faun_channelCount(pc->buf->chanLayout);
+    uint32_t pos = pc->start * chan;    // Sample positions.
+    uint32_t end = pc->end * chan;
+    int blockBegin = 1;
+
+    flac = fx_flac_init(mem_alloc(fx_flac_size(FLAC_SUBSET_MAX_BLOCK_SIZE_48KHZ,
+                                               2)),
+                        FLAC_SUBSET_MAX_BLOCK_SIZE_48KHZ, 2);
+    decodeBuf = (int32_t*) mem_alloc(decodeSize * sizeof(int32_t));
+    if (! flac || ! decodeBuf) {
+        pc->error = "FLAC decoder alloc failed";
+        goto done;
+    }
+
+    // Read the metadata, then continue with the first block of the piece.
+    in = pc->data;
+    avail = pc->metaEnd;
+    while (avail) {
+        inLen = avail;
+        fstate = fx_flac_process(flac, in, &inLen, NULL, NULL);
+        if (fstate == FLAC_ERR || ! inLen) {
+            pc->error = "FLAC metadata invalid";
+            goto done;
+        }
+        in += inLen;
+        avail -= inLen;
+    }
+
+    in = pc->data + pc->pos;
+    avail = pc->size - pc->pos;
+    pcmOut = pc->buf->sample.f32 + pos;
+    while (pos < end) {
+        inLen = avail;
+        procLen = decodeSize;
+        fstate = fx_flac_process(flac, in, &inLen, decodeBuf, &procLen);
+        if (fstate == FLAC_ERR)
+            break;
+        in += inLen;
+        avail -= inLen;
+
+        if (procLen) {
+            // A block which was skipped (due to a CRC error) or which is not
+            // at the expected position would make the result differ from a
+            // serial decode.
+            if (blockBegin) {
+                if (split_flacBlockStart(flac) * chan != pos)
+                    break;
+                blockBegin = 0;
+            }
+            if (procLen > end - pos)
+                procLen = end - pos;
+            _mixk.convS32(pcmOut, decodeBuf, procLen, FOXEN_CONV_SHIFT);
+            pcmOut += procLen;
+            pos += procLen;
+        }
+
+        if (fstate == FLAC_END_OF_FRAME)
+            blockBegin = 1;
+        else if (! inLen && ! procLen)
+            break;
+    }
+    if (pos < end)
+        pc->error = "FLAC decode failed";
+
+done:
+    mem_free(decodeBuf);
+    mem_free(flac);
+}
+
+
+/*
+  Decode FLAC data in memory in pieces if it is long enough.
+
+  Return non-zero if the buffer was loaded.
+*/
+static int split_flacMem(FaunBuffer* buf, const uint8_t* data, uint32_t size)
+{
+    DecodePiece pieces[SPLIT_MAX];
+    DecodePiece* pc;
+    FlacInfo fi;
+    uint64_t sample;
+    uint32_t pos;
+    int i, count;
+
+    if (size < FLAC_STREAMINFO_END || ! split_flacInfo(&fi, data))
+        return 0;
+    count = split_count(fi.frames);
+    if (count < 2)
+        return 0;
+
+    // Skip the metadata blocks.
+    for (pos = 4; pos + 4 <= size; ) {
+        i = data[pos];
+        pos += 4 + ((data[pos+1] << 16) | (data[pos+2] << 8) | data[pos+3]);
+        if (i & 0x80)
+            break;
+    }
+    if (pos + FLAC_FRAME_HEADER_MAX > size)
+        return 0;
+
+    pieces[0].pos = pos;
+    pieces[0].start = 0;
+    pc = pieces + 1;
+
+    // Find a block near each split point.  Blocks in a fixed-blocksize
+    // stream are numbered rather than giving their first sample.
+    for (i = 1; i < count; ++i) {
+        pos = pieces[0].pos +
+              (uint64_t) (size - pieces[0].pos) * i / count;
+        if (pos <= pc[-1].pos)
+            pos = pc[-1].pos + 1;
+        for (; pos + FLAC_FRAME_HEADER_MAX <= size; ++pos) {
+            if (data[pos] == 0xFF &&
+                (data[pos+1] & 1) == (data[pieces[0].pos+1] & 1) &&
+                split_flacHeader(data + pos, fi.blockSize, &sample))
+                break;
+        }
+        if (pos + FLAC_FRAME_HEADER_MAX > size)
+            break;
+        if (sample <= pc[-1].start || sample >= fi.frames)
+            continue;
+        pc->pos = pos;
+        pc->start = sample;
+        ++pc;
+    }
+    count = pc - pieces;
+    if (count < 2)
+        return 0;
+
+    if (! _allocBufferLoad(buf, fi.chan, fi.rate, fi.frames))
+        return 0;
+
+    for (i = 0, pc = pieces; i < count; ++i, ++pc) {
+        pc->decode  = split_decodeFlac;
+        pc->data    = data;
+        pc->size    = size;
+        pc->end     = (i + 1 < count) ? pc[1].start : fi.frames;
+        pc->metaEnd = pieces[0].pos;
+        pc->buf     = buf;
+        pc->error   = NULL;
+    }
+    if (split_run(pieces, count))
+        return 0;
+    buf->used = fi.frames;
+    return 1;
+}
+
+
+/*
+  Decode FLAC file data in pieces if it is long enough.
+
+  \param fp          File positioned after preReadLen bytes of the data.
+  \param size        Bytes of data, or zero to read to the file end.
+  \param preReadLen  Number of bytes already read from fp.
+
+  Return non-zero if the buffer was loaded.  If zero is returned then fp
+  is left at the same position so that foxenFlacDecode() can be used.
+*/
+static int split_flac(FaunBuffer* buf, FILE* fp, uint32_t size,
+                      long preReadLen)
+{
+    FlacInfo fi;
+    uint8_t hdr[FLAC_STREAMINFO_END];
+    uint8_t* data;
+    long start = ftell(fp) - preReadLen;
+    int ok = 0;
+
+    // Check the length before reading the whole file.
+    fseek(fp, start, SEEK_SET);
+    if (fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr) &&
+        split_flacInfo(&fi, hdr) && split_count(fi.frames) > 1) {
+        data = split_readData(fp, start, &size);
+        if (data) {
+            ok = split_flacMem(buf, data, size);
+            mem_free(data);
+        }
+    }
+    if (! ok)
+        fseek(fp, start + preReadLen, SEEK_SET);
+    return ok;
+}
+#endif
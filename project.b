@@ -3,6 +3,7 @@ options [
     static: false       "Build static library"
     ftest:  false       "Build faun_test program (modifies library)"
     load-mem: true      "Include functions to load buffers from memory"
+    fixed:  false       "Mix 16-bit samples in fixed point (for slow FPUs)"
 ]
 
 if int? flac [
@@ -17,6 +18,7 @@ libfaun: [
     ]
     if ftest [cflags "-DCAPTURE"]
     if load-mem [cflags "-DUSE_LOAD_MEM"]
+    if fixed [cflags "-DFAUN_FIXED"]
     include_from %support
     if msvc [include_from %../usr/include]
     sources [
@@ -58,6 +60,22 @@ if ftest [
     ]
 ]
 
+exe %faun_bank append [
+    console
+    cflags "-DUSE_SFX_GEN -DUSE_LOAD_MEM"
+    switch flac [
+        libflac [cflags "-DUSE_FLAC=1"]
+        foxen   [cflags "-DUSE_FLAC=2"]
+    ]
+    if fixed [cflags "-DFAUN_FIXED"]
+    include_from %support
+    if msvc [include_from %../usr/include]
+    sources [
+        %support/tmsg.c
+        %faun_bank.c
+    ]
+] faun-dep
+
 exe %basic [
     console faun-link sources [%example/basic.c]
 ]
@@ -65,6 +83,14 @@ exe %basic [
 dist [
     %faun.def
     %support/cpuCounter.h
+    %adpcm.c
+    %alloc.c
+    %bank.c
+    %decoder.c
+    %parallel.c
+    %mix_simd.c
+    %limiter.c
+    %resample.c
     %sys_pulseaudio.c
     %sys_wasapi.c
 ]
@@ -0,0 +1,308 @@
+/*
+  Faun sample rate converter
+
+  Converts stereo float samples from one rate to another with a polyphase
+  windowed-sinc (Kaiser) filter.  The rates are reduced by their greatest
+  common divisor and when the output rate is then no more than
+  RESAMPLE_PHASE_MAX the filter phases are exact; otherwise the position is
+  truncated to the phase at or before it of RESAMPLE_PHASE_MAX phases.
+
+  Input is copied into a block buffer which keeps the filter history, so a
+  stream of data can be converted in pieces of any size.  Each output frame
+  is computed by the _mixk.fir kernel.
+*/
+
+#define RESAMPLE_TAPS       32      // Filter length when upsampling.
+#define RESAMPLE_TAPS_MAX   128
+#define RESAMPLE_PHASE_MAX  512
+#define RESAMPLE_BLOCK      1024    // Input frames copied per block.
+#define RESAMPLE_CUTOFF     0.45f   // Fraction of the lower rate.
+#define RESAMPLE_BETA       8.0
+
+typedef struct {
+    uint32_t inRate;    // Reduced input rate.
+    uint32_t outRate;   // Reduced output rate.
+    uint32_t step;      // Whole input frames per output frame.
+    uint32_t fstep;     // Fractional input frames per output frame.
+    uint32_t frac;      // Position between input frames in 1/outRate units.
+    uint32_t pos;       // Buffer frame of the first filter tap.
+    uint32_t used;      // Frames in buf.
+    uint32_t taps;
+    uint32_t phases;
+    uint64_t inTotal;
+    uint64_t outTotal;
+    float*   coef;      // Coefficients, taps*2 for each phase.
+    float*   buf;       // taps + RESAMPLE_BLOCK frames.
+}
+Resampler;
+
+
+static uint32_t resample_gcd(uint32_t a, uint32_t b)
+{
+    uint32_t t;
+    while (b) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+
+// Modified Bessel function of the first kind, order zero.
+static double resample_besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    double q = x * x * 0.25;
+    int k;
+
+    for (k = 1; k < 32; ++k) {
+        term *= q / ((double) k * k);
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+
+/*
+  Fill the coefficient table.  Each coefficient is stored twice so that
+  the kernels can multiply interleaved stereo frames directly.
+*/
+static void resample_design(Resampler* rs)
+{
+    const double PI = 3.14159265358979323846;
+    const int half = rs->taps / 2;
+    double fc, d, x, w, h, sum;
+    double norm = 1.0 / resample_besselI0(RESAMPLE_BETA);
+    float* cp;
+    uint32_t p;
+    int k;
+
+    // Cutoff in cycles per input sample.
+    fc = RESAMPLE_CUTOFF;
+    if (rs->outRate < rs->inRate)
+        fc = fc * rs->outRate / rs->inRate;
+
+    for (p = 0; p < rs->phases; ++p) {
+        cp = rs->coef + p * rs->taps * 2;
+        sum = 0.0;
+        for (k = 0; k < (int) rs->taps; ++k) {
+            // Distance of the tap from the output position.
+            d = (double) (k - (half - 1)) - (double) p / rs->phases;
+            x = d / half;
+            if (x <= -1.0 || x >= 1.0) {
+                h = 0.0;
+            } else {
+                w = resample_besselI0(RESAMPLE_BETA * sqrt(1.0 - x * x)) * norm;
+                h = 2.0 * fc * w;
+                if (d != 0.0)
+                    h *= sin(2.0 * PI * fc * d) / (2.0 * PI * fc * d);
+            }
+            cp[k*2] = (float) h;
+            sum += h;
+        }
+
+        // Normalize for unity gain at DC.
+        for (k = 0; k < (int) rs->taps; ++k)
+            cp[k*2] = cp[k*2+1] = (float) (cp[k*2] / sum);
+    }
+}
+
+
+/*
+  Reset the converter to the start of new input.
+*/
+static void resample_reset(Resampler* rs)
+{
+    // Start with silence before the first input frame so the first output
+    // is centered on it.
+    rs->used = rs->taps/2 - 1;
+    memset(rs->buf, 0, rs->used * 2 * sizeof(float));
+    rs->pos = 0;
+    rs->frac = 0;
+    rs->inTotal = rs->outTotal = 0;
+}
+
+
+/*
+  Initialize a converter.  Free it with resample_free().
+
+  Return zero if memory allocation fails.
+*/
+static int resample_init(Resampler* rs, uint32_t inRate, uint32_t outRate)
+{
+    uint32_t g = resample_gcd(inRate, outRate);
+    uint32_t taps;
+
+    rs->inRate  = inRate  / g;
+    rs->outRate = outRate / g;
+    rs->step  = rs->inRate / rs->outRate;
+    rs->fstep = rs->inRate % rs->outRate;
+
+    // Widen the filter when downsampling to keep the transition band.
+    taps = RESAMPLE_TAPS;
+    if (rs->inRate > rs->outRate) {
+        taps = (uint32_t) (((uint64_t) RESAMPLE_TAPS * rs->inRate +
+                            rs->outRate - 1) / rs->outRate);
+        taps = (taps + 3) & ~3;
+        if (taps > RESAMPLE_TAPS_MAX)
+            taps = RESAMPLE_TAPS_MAX;
+    }
+    rs->taps = taps;
+    rs->phases = (rs->outRate > RESAMPLE_PHASE_MAX) ? RESAMPLE_PHASE_MAX
+                                                    : rs->outRate;
+
+    rs->coef = (float*) malloc((rs->phases * taps * 2 +
+                                (taps + RESAMPLE_BLOCK) * 2) * sizeof(float));
+    if (! rs->coef)
+        return 0;
+    rs->buf = rs->coef + rs->phases * taps * 2;
+
+    resample_design(rs);
+    resample_reset(rs);
+    return 1;
+}
+
+
+static void resample_free(Resampler* rs)
+{
+    free(rs->coef);
+    rs->coef = NULL;
+}
+
+
+/*
+  Return the maximum number of frames which resample_run() followed by
+  resample_flush() will output for the given number of input frames.
+*/
+static uint32_t resample_outputLimit(const Resampler* rs, uint32_t frames)
+{
+    return (uint32_t) (((uint64_t) frames * rs->outRate) / rs->inRate) + 2;
+}
+
+
+/*
+  Return the maximum number of input frames which can be passed to
+  resample_run() without producing more than the given number of frames.
+*/
+static uint32_t resample_inputLimit(const Resampler* rs, uint32_t frames)
+{
+    int64_t n;
+
+    // Output k needs the frames up to pos + (frac + k*inRate)/outRate + taps.
+    n = (int64_t) (((uint64_t) frames * rs->inRate + rs->frac) /
+                   rs->outRate) - 1;
+    n += rs->taps + rs->pos - rs->used;
+    return (n > 0) ? (uint32_t) n : 0;
+}
+
+
+/*
+  Compute output frames until more input is needed or limit is reached.
+*/
+static uint32_t resample_filter(Resampler* rs, float* dst, uint32_t limit)
+{
+    const float* coef;
+    float* out = dst;
+    uint32_t taps = rs->taps;
+    uint32_t pos  = rs->pos;
+    uint32_t frac = rs->frac;
+    uint32_t phase;
+    uint32_t count = 0;
+
+    while (pos + taps <= rs->used && count < limit) {
+        if (rs->phases == rs->outRate)
+            phase = frac;
+        else
+            phase = (uint32_t) (((uint64_t) frac * rs->phases) / rs->outRate);
+        coef = rs->coef + phase * taps * 2;
+        _mixk.fir(out, rs->buf + pos*2, coef, taps);
+        out += 2;
+        ++count;
+
+        pos  += rs->step;
+        frac += rs->fstep;
+        if (frac >= rs->outRate) {
+            frac -= rs->outRate;
+            ++pos;
+        }
+    }
+
+    rs->pos  = pos;
+    rs->frac = frac;
+    rs->outTotal += count;
+    return count;
+}
+
+
+/*
+  Drop frames which are no longer needed from the start of the buffer.
+*/
+static void resample_compact(Resampler* rs)
+{
+    if (rs->pos) {
+        rs->used -= rs->pos;
+        memmove(rs->buf, rs->buf + rs->pos*2, rs->used * 2 * sizeof(float));
+        rs->pos = 0;
+    }
+}
+
+
+/*
+  Convert input frames.  All the input is consumed, but output frames
+  which need the following input are held back until the next call.
+
+  \param dst     Output memory for resample_outputLimit() frames.
+  \param src     Stereo input samples.
+  \param frames  Number of frames in src.
+
+  \return Number of frames written to dst.
+*/
+static uint32_t resample_run(Resampler* rs, float* dst, const float* src,
+                             uint32_t frames)
+{
+    const uint32_t cap = rs->taps + RESAMPLE_BLOCK;
+    uint32_t n;
+    uint32_t count = 0;
+
+    rs->inTotal += frames;
+    while (frames) {
+        n = cap - rs->used;
+        if (n > frames)
+            n = frames;
+        memcpy(rs->buf + rs->used*2, src, n * 2 * sizeof(float));
+        rs->used += n;
+        src += n*2;
+        frames -= n;
+
+        count += resample_filter(rs, dst + count*2, UINT32_MAX);
+        resample_compact(rs);
+    }
+    return count;
+}
+
+
+/*
+  Output any frames held back at the end of the input.
+
+  \return Number of frames written to dst.
+*/
+static uint32_t resample_flush(Resampler* rs, float* dst)
+{
+    uint64_t total;
+    uint32_t n = rs->taps;
+
+    // Number of output frames which cover the input.
+    total = (rs->inTotal * rs->outRate + rs->inRate - 1) / rs->inRate;
+    if (rs->outTotal >= total)
+        return 0;
+
+    memset(rs->buf + rs->used*2, 0, n * 2 * sizeof(float));
+    rs->used += n;
+    n = resample_filter(rs, dst, (uint32_t) (total - rs->outTotal));
+    resample_compact(rs);
+    return n;
+}
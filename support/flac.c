@@ -295,6 +295,25 @@ static inline uint64_t fx_bitstream_peek_msb(fx_bitstream_t *reader,
 	return (reader->buf << reader->pos) >> (BUFSIZE - n_bits);
 }
 
+/**
+ * Returns the number of zero bits which lead the next n_bits bits, or n_bits
+ * if they are all zero. Does not advance the reader.
+ */
+static inline uint8_t fx_bitstream_count_zeros(fx_bitstream_t *reader,
+                                               uint8_t n_bits) {
+	assert((n_bits >= 1U) && (reader->pos + n_bits <= BUFSIZE));
+	const uint64_t bits = reader->buf << reader->pos;
+#if defined(__GNUC__)
+	const uint8_t zeros = bits ? (uint8_t)__builtin_clzll(bits) : BUFSIZE;
+#else
+	uint8_t zeros = 0U;
+	while (zeros < n_bits && !(bits & (1ULL << (BUFSIZE - 1U - zeros)))) {
+		zeros++;
+	}
+#endif
+	return (zeros < n_bits) ? zeros : n_bits;
+}
+
 /******************************************************************************
  * Copy of foxen/mem.h                                                        *
  ******************************************************************************/
@@ -893,27 +912,38 @@ static bool _fx_flac_decode_channel_count(
  * Decoding functions                                                         *
  ******************************************************************************/
 
+/* The stereo decorrelation helpers also apply the final output shift, which
+   left-aligns the samples in 32 bits, so that each block is only walked
+   once.  The loops are branch free and are vectorized by the compiler. */
+
 static inline void _fx_flac_post_process_left_side(int32_t *blk1, int32_t *blk2,
-                                                   uint32_t blk_size) {
+                                                   uint32_t blk_size,
+                                                   uint8_t shift) {
 	blk1 = (int32_t *)FX_ASSUME_ALIGNED(blk1);
 	blk2 = (int32_t *)FX_ASSUME_ALIGNED(blk2);
 	for (uint32_t i = 0U; i < blk_size; i++) {
-		blk2[i] = blk1[i] - blk2[i];
+		const uint32_t left = blk1[i];
+		blk1[i] = left << shift;
+		blk2[i] = (left - (uint32_t)blk2[i]) << shift;
 	}
 }
 
 static inline void _fx_flac_post_process_right_side(int32_t *blk1,
                                                     int32_t *blk2,
-                                                    uint32_t blk_size) {
+                                                    uint32_t blk_size,
+                                                    uint8_t shift) {
 	blk1 = (int32_t *)FX_ASSUME_ALIGNED(blk1);
 	blk2 = (int32_t *)FX_ASSUME_ALIGNED(blk2);
 	for (uint32_t i = 0U; i < blk_size; i++) {
-		blk1[i] = blk1[i] + blk2[i];
+		const uint32_t right = blk2[i];
+		blk1[i] = ((uint32_t)blk1[i] + right) << shift;
+		blk2[i] = right << shift;
 	}
 }
 
 static inline void _fx_flac_post_process_mid_side(int32_t *blk1, int32_t *blk2,
-                                                  uint32_t blk_size) {
+                                                  uint32_t blk_size,
+                                                  uint8_t shift) {
 	blk1 = (int32_t *)FX_ASSUME_ALIGNED(blk1);
 	blk2 = (int32_t *)FX_ASSUME_ALIGNED(blk2);
 	for (uint32_t i = 0U; i < blk_size; i++) {
@@ -922,27 +952,79 @@ static inline void _fx_flac_post_process_mid_side(int32_t *blk1, int32_t *blk2,
 		int32_t side = blk2[i];
 		mid = ((uint32_t)mid) << 1;
 		mid |= (side & 1); /* Round correctly */
-		blk1[i] = (mid + side) >> 1;
-		blk2[i] = (mid - side) >> 1;
+		blk1[i] = ((uint32_t)((mid + side) >> 1)) << shift;
+		blk2[i] = ((uint32_t)((mid - side) >> 1)) << shift;
 	}
 }
 
+static inline void _fx_flac_post_process_shift(int32_t *blk,
+                                               uint32_t blk_size,
+                                               uint8_t shift) {
+	blk = (int32_t *)FX_ASSUME_ALIGNED(blk);
+	for (uint32_t i = 0U; i < blk_size; i++) {
+		blk[i] = ((uint32_t)blk[i]) << shift;
+	}
+}
+
+/* Prediction loops for a fixed order are fully unrolled by the compiler and
+   the products computed in vector registers. */
+#define FX_LPC_RESTORE(ORDER, ACCU_T)                                     \
+	for (uint32_t i = ORDER; i < blk_size; i++) {                         \
+		ACCU_T accu = 0;                                                  \
+		for (uint32_t j = 0U; j < ORDER; j++) {                           \
+			accu += (ACCU_T)lpc_coeffs[j] * (ACCU_T)blk[i - j - 1];       \
+		}                                                                 \
+		blk[i] = blk[i] + (FX_LPC_ACCU_SIGNED(accu) >> lpc_shift);        \
+	}
+
+#define FX_LPC_RESTORE_ORDERS(ACCU_T)      \
+	switch (lpc_order) {                   \
+		case 0: break;                     \
+		case 1: FX_LPC_RESTORE(1, ACCU_T) break;   \
+		case 2: FX_LPC_RESTORE(2, ACCU_T) break;   \
+		case 3: FX_LPC_RESTORE(3, ACCU_T) break;   \
+		case 4: FX_LPC_RESTORE(4, ACCU_T) break;   \
+		case 5: FX_LPC_RESTORE(5, ACCU_T) break;   \
+		case 6: FX_LPC_RESTORE(6, ACCU_T) break;   \
+		case 7: FX_LPC_RESTORE(7, ACCU_T) break;   \
+		case 8: FX_LPC_RESTORE(8, ACCU_T) break;   \
+		case 10: FX_LPC_RESTORE(10, ACCU_T) break; \
+		case 12: FX_LPC_RESTORE(12, ACCU_T) break; \
+		default: FX_LPC_RESTORE(lpc_order, ACCU_T) break; \
+	}
+
 static inline void _fx_flac_restore_lpc_signal(int32_t *blk, uint32_t blk_size,
                                                int32_t *lpc_coeffs,
                                                uint8_t lpc_order,
-                                               int8_t lpc_shift) {
+                                               int8_t lpc_shift,
+                                               uint8_t bps) {
 	blk = (int32_t *)FX_ASSUME_ALIGNED(blk);
 	lpc_coeffs = (int32_t *)FX_ASSUME_ALIGNED(lpc_coeffs);
 
-	for (uint32_t i = lpc_order; i < blk_size; i++) {
-		int64_t accu = 0;
-		for (uint8_t j = 0; j < lpc_order; j++) {
-			accu += (int64_t)lpc_coeffs[j] * (int64_t)blk[i - j - 1];
-		}
-		blk[i] = blk[i] + (accu >> lpc_shift);
+	/* The prediction is at most the sum of the coefficient magnitudes times
+	   the largest sample.  If that fits in 32 bits then so does the exact
+	   sum, and wrapping unsigned arithmetic yields it no matter how the
+	   partial sums overflow. */
+	uint64_t coeff_sum = 0U;
+	for (uint32_t j = 0U; j < lpc_order; j++) {
+		coeff_sum += (lpc_coeffs[j] < 0) ? -(int64_t)lpc_coeffs[j]
+		                                 : lpc_coeffs[j];
+	}
+
+	if ((coeff_sum << (bps - 1U)) < (1ULL << 31U)) {
+#define FX_LPC_ACCU_SIGNED(X) ((int32_t)(X))
+		FX_LPC_RESTORE_ORDERS(uint32_t)
+#undef FX_LPC_ACCU_SIGNED
+	} else {
+#define FX_LPC_ACCU_SIGNED(X) (X)
+		FX_LPC_RESTORE_ORDERS(int64_t)
+#undef FX_LPC_ACCU_SIGNED
 	}
 }
 
+#undef FX_LPC_RESTORE_ORDERS
+#undef FX_LPC_RESTORE
+
 /******************************************************************************
  * Stream utility functions and macros                                        *
  ******************************************************************************/
@@ -1615,14 +1697,25 @@ static bool _fx_flac_process_in_frame(fx_flac_t *inst) {
 		case FLAC_SUBFRAME_RICE_UNARY:
 			/* Read the individual rice samples */
 			while (inst->partition_sample > 0U) {
-				/* Read the unary part of the Rice encoded sample bit-by-bit */
+				/* Read the unary part of the Rice encoded sample, counting all
+				   the zero bits held by the bitstream buffer at once */
 				if (inst->priv_state == FLAC_SUBFRAME_RICE_UNARY) {
 					while (true) {
-						const uint8_t bit = READ_BITS_CRC(1U);
-						if (bit) {
+						uint8_t n = BUFSIZE - inst->bitstream.pos;
+						if (n > BUFSIZE - 7U) {
+							n = BUFSIZE - 7U;
+						} else if (n == 0U) {
+							return false; /* Need more data */
+						}
+						const uint8_t zeros =
+						    fx_bitstream_count_zeros(&inst->bitstream, n);
+						if (zeros < n) {
+							READ_BITS_CRC(zeros + 1U);
+							inst->rice_unary_counter += zeros;
 							break;
 						}
-						inst->rice_unary_counter++;
+						READ_BITS_CRC(n);
+						inst->rice_unary_counter += n;
 					}
 				}
 
@@ -1671,7 +1764,7 @@ static bool _fx_flac_process_in_frame(fx_flac_t *inst) {
 			if (inst->partition_cur == (1U << sfh->rice_partition_order)) {
 				/* Decode the residual */
 				_fx_flac_restore_lpc_signal(blk, blk_n, sfh->lpc_coeffs,
-				                            sfh->order, sfh->lpc_shift);
+				                            sfh->order, sfh->lpc_shift, bps);
 				inst->priv_state = FLAC_SUBFRAME_FINALIZE;
 			} else {
 				inst->priv_state = FLAC_SUBFRAME_RICE_INIT;
@@ -1706,32 +1799,28 @@ static bool _fx_flac_process_in_frame(fx_flac_t *inst) {
 			(void)crc16;
 #endif
 
-			/* Post process side-stereo */
+			/* Post process side-stereo and shift the output such that the
+			   resulting int32 stream can be played back. */
 			int32_t *c1 = inst->blkbuf[0], *c2 = inst->blkbuf[1];
+			uint8_t shift = 32U - fh->sample_size;
 			switch (fh->channel_assignment) {
 				case LEFT_SIDE_STEREO:
-					_fx_flac_post_process_left_side(c1, c2, blk_n);
+					_fx_flac_post_process_left_side(c1, c2, blk_n, shift);
 					break;
 				case RIGHT_SIDE_STEREO:
-					_fx_flac_post_process_right_side(c1, c2, blk_n);
+					_fx_flac_post_process_right_side(c1, c2, blk_n, shift);
 					break;
 				case MID_SIDE_STEREO:
-					_fx_flac_post_process_mid_side(c1, c2, blk_n);
+					_fx_flac_post_process_mid_side(c1, c2, blk_n, shift);
 					break;
 				default:
-					break;
-			}
-
-			/* Shift the output such that the resulting int32 stream can be
-			   played back. */
-			uint8_t shift = 32U - fh->sample_size;
-			if (shift) {
-				for (uint8_t c = 0U; c < fh->channel_count; c++) {
-					int32_t *blk = inst->blkbuf[c];
-					for (uint16_t i = 0U; i < blk_n; i++) {
-						blk[i] = blk[i] * (1 << shift);
+					if (shift) {
+						for (uint8_t c = 0U; c < fh->channel_count; c++) {
+							_fx_flac_post_process_shift(inst->blkbuf[c], blk_n,
+							                            shift);
+						}
 					}
-				}
+					break;
 			}
 
 			/* We're done decoding this frame! Notify the outer loop! */
@@ -25,6 +25,7 @@ typedef CONDITION_VARIABLE  pthread_cond_t;
 #define condFree(cond)
 #define condWaitF(cond,mh)  (! SleepConditionVariableCS(&cond,&mh,INFINITE))
 #define condSignal(cond)    WakeConditionVariable(&cond)
+#define condBroadcast(cond) WakeAllConditionVariable(&cond)
 #define threadCreateF(th,func,arg)  ((th = CreateThread(NULL,0,func,arg,0,NULL)) == NULL)
 #define threadJoin(th)      WaitForSingleObject(th,INFINITE)
 
@@ -40,6 +41,7 @@ typedef CONDITION_VARIABLE  pthread_cond_t;
 #define condFree(cond)      pthread_cond_destroy(&cond)
 #define condWaitF(cond,mh)  pthread_cond_wait(&cond,&mh)
 #define condSignal(cond)    pthread_cond_signal(&cond)
+#define condBroadcast(cond) pthread_cond_broadcast(&cond)
 #define threadCreateF(th,func,arg)  (pthread_create(&th,NULL,func,arg) != 0)
 #define threadJoin(th)      pthread_join(th,NULL)
 
@@ -73,3 +73,8 @@ void wav_write(FILE* fp, float* samples, int count)
         fwrite(&is, 2, 1, fp);
     }
 }
+
+void wav_writeS16(FILE* fp, const int16_t* samples, int count)
+{
+    fwrite(samples, 2, count, fp);
+}
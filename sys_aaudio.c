@@ -31,7 +31,7 @@ static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
 
     voice->backend = NULL;
 
-    switch (voice->mix.format) {
+    switch (voice->outFormat) {
         case FAUN_S16:
             fmt = AAUDIO_FORMAT_PCM_I16;
             voice->frameBytes = chan * sizeof(int16_t);
@@ -50,10 +50,12 @@ static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
 
     // Use the default device & direction (output stream).
     AAudioStreamBuilder_setSharingMode(bld, AAUDIO_SHARING_MODE_SHARED);
+    // A zero (AAUDIO_UNSPECIFIED) rate selects the native device rate.
     AAudioStreamBuilder_setSampleRate(bld, mixRate);
     AAudioStreamBuilder_setChannelCount(bld, chan);
     AAudioStreamBuilder_setFormat(bld, fmt);
-    AAudioStreamBuilder_setBufferCapacityInFrames(bld, (mixRate/updateHz) * 2);
+    AAudioStreamBuilder_setBufferCapacityInFrames(bld,
+                                ((mixRate ? mixRate : 48000) / updateHz) * 2);
     /*
     AAudioStreamBuilder_setPerformanceMode(bld,
                                     AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
@@ -64,6 +66,10 @@ static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
     if (res != AAUDIO_OK)
         return "Cannot open AAudio stream";
 
+    if (! mixRate) {
+        mixRate = AAudioStream_getSampleRate(stream);
+        voice->mix.rate = mixRate;
+    }
     framesPerBurst = AAudioStream_getFramesPerBurst(stream);
 
     // Set voice->mix.used to one or two bursts.
@@ -109,8 +109,12 @@ static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
 
     voice->backend = ds;
 
+    if (! voice->mix.rate)
+        faun_setMixRate(voice, 44100);
+
     channels = faun_channelCount(voice->mix.chanLayout);
-    bufferSize = (SEC_COUNT*44100/updateHz) * (bitsPerSample/8) * channels;
+    bufferSize = (SEC_COUNT*voice->mix.rate/updateHz) *
+                 (bitsPerSample/8) * channels;
 
     ds->waveFmt.wFormatTag      = WAVE_FORMAT_PCM;
     ds->waveFmt.nChannels       = channels;
@@ -200,8 +204,9 @@ static const char* sysaudio_write(FaunVoice* voice, const void* data,
     uint32_t secBytes = ds->desc.dwBufferBytes / SEC_COUNT;
     int playSection;
     int wait = 0;
+    int convert = (voice->outFormat == FAUN_F32);
 
-    if (len != secBytes*2)
+    if (len != (convert ? secBytes*2 : secBytes))
         return "Unexpected sysaudio_write len";
 
     do
@@ -221,7 +226,7 @@ static const char* sysaudio_write(FaunVoice* voice, const void* data,
                                   secBytes, &part1, &len1, &part2, &len2, 0);
     if (FAILED(hr))
         return dsoundError("Buffer Lock failed", hr);
-    {
+    if (convert) {
     const float* fdat = (const float*) data;
     int16_t* sp = (int16_t*) part1;
     int samples1 = len1 / sizeof(int16_t);
@@ -230,6 +235,10 @@ static const char* sysaudio_write(FaunVoice* voice, const void* data,
         sp = (int16_t*) part2;
         convF32_S16(sp, sp + len2 / sizeof(int16_t), fdat + samples1);
     }
+    } else {
+        memcpy(part1, data, len1);
+        if (len2)
+            memcpy(part2, (const char*) data + len1, len2);
     }
     IDirectSoundBuffer8_Unlock(ds->ds8_buffer, part1, len1, part2, len2);
 
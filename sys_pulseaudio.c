@@ -49,6 +49,34 @@ static const char* sysaudio_open(const char* appName)
     return NULL;
 }
 
+static void _sinkInfo(pa_context* ctx, const pa_sink_info* info, int eol,
+                      void* userdata)
+{
+    (void) ctx;
+    if (info && ! eol)
+        *((uint32_t*) userdata) = info->sample_spec.rate;
+}
+
+/*
+  Return the sample rate of the default sink or zero if it is unknown.
+*/
+static uint32_t _defaultSinkRate()
+{
+    pa_operation* op;
+    uint32_t rate = 0;
+
+    op = pa_context_get_sink_info_by_name(paSession.context, "@DEFAULT_SINK@",
+                                          _sinkInfo, &rate);
+    if (op) {
+        while (pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
+            if (pa_mainloop_iterate(paSession.loop, 1, NULL) < 0)
+                break;
+        }
+        pa_operation_unref(op);
+    }
+    return rate;
+}
+
 static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
                                        const char* appName)
 {
@@ -67,16 +95,7 @@ static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
     (void) appName;
 
     ss.channels = faun_channelCount(voice->mix.chanLayout);
-    ss.rate     = voice->mix.rate;
-    ss.format   = _paFormat[voice->mix.format];
-
-    // Use default attributes except for a lower latency.
-    // This can be overridden by the PULSE_LATENCY_MSEC environment variable.
-    ba.maxlength = -1;
-    ba.tlength   = pa_usec_to_bytes(dur, &ss);
-    ba.prebuf    = -1;
-    ba.minreq    = -1;
-    ba.fragsize  = -1;
+    ss.format   = _paFormat[voice->outFormat];
 
     while (! paSession.stream) {
         error = pa_mainloop_iterate(paSession.loop, 1, NULL);
@@ -85,6 +104,13 @@ static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
 
         switch (pa_context_get_state(paSession.context)) {
             case PA_CONTEXT_READY:
+                // Mix at the sink rate so the server does not resample.
+                if (! voice->mix.rate) {
+                    ss.rate = _defaultSinkRate();
+                    faun_setMixRate(voice, ss.rate ? ss.rate : 44100);
+                }
+                ss.rate = voice->mix.rate;
+
                 paSession.stream = pa_stream_new(paSession.context,
                                                  "Faun Voice", &ss, NULL);
                 if (! paSession.stream)
@@ -99,6 +125,14 @@ static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
         }
     }
 
+    // Use default attributes except for a lower latency.
+    // This can be overridden by the PULSE_LATENCY_MSEC environment variable.
+    ba.maxlength = -1;
+    ba.tlength   = pa_usec_to_bytes(dur, &ss);
+    ba.prebuf    = -1;
+    ba.minreq    = -1;
+    ba.fragsize  = -1;
+
     // Use the default device & volume.  Flags are the same as pa_simple_new.
     error = pa_stream_connect_playback(paSession.stream, NULL, &ba,
                                        PA_STREAM_INTERPOLATE_TIMING |
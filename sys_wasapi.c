@@ -83,7 +83,7 @@ static const char* sysaudio_open(const char* appName)
     fmt = &waSession.format;
     fmt->wFormatTag      = WAVE_FORMAT_IEEE_FLOAT;
     fmt->nChannels       = 2;
-    fmt->nSamplesPerSec  = 44100;
+    fmt->nSamplesPerSec  = 44100;   // Set by sysaudio_allocVoice().
     fmt->nAvgBytesPerSec = 2 * 44100 * sizeof(float);
     fmt->wBitsPerSample  = 32;
     fmt->nBlockAlign     = (fmt->nChannels * fmt->wBitsPerSample) / 8;
@@ -127,10 +127,29 @@ static const char* sysaudio_allocVoice(FaunVoice* voice, int updateHz,
     void* ptr;
     UINT32 frameCount;
     HRESULT hr;
-    (void) voice;
+    WAVEFORMATEX* fmt = &waSession.format;
     (void) updateHz;
     (void) appName;
 
+    // Mix at the rate of the shared mode engine so it does not resample.
+    if (! voice->mix.rate) {
+        WAVEFORMATEX* mixFmt;
+        hr = IAudioClient_GetMixFormat(waSession.client, &mixFmt);
+        if (SUCCEEDED(hr)) {
+            faun_setMixRate(voice, mixFmt->nSamplesPerSec);
+            CoTaskMemFree(mixFmt);
+        } else
+            faun_setMixRate(voice, 44100);
+    }
+
+    if (voice->outFormat == FAUN_S16) {
+        fmt->wFormatTag      = WAVE_FORMAT_PCM;
+        fmt->wBitsPerSample  = 16;
+        fmt->nBlockAlign     = (fmt->nChannels * fmt->wBitsPerSample) / 8;
+    }
+    fmt->nSamplesPerSec  = voice->mix.rate;
+    fmt->nAvgBytesPerSec = fmt->nSamplesPerSec * fmt->nBlockAlign;
+
     hr = IAudioClient_Initialize(waSession.client, AUDCLNT_SHAREMODE_SHARED,
                                  AUDCLNT_STREAMFLAGS_NOPERSIST |
                                  AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
@@ -24,6 +24,7 @@ declare -A FILTER   # Requires bash 4 or zsh.
 TOTAL=0
 PASSED=0
 FAILURES=()
+SKIPPED=()
 KEEP_OUTPUT=""
 PRINT_CMD=""
 VALGRIND_CMD=""
@@ -67,6 +68,14 @@ fail() {
     echo -e "$UP$AMSG${spaces:${#AMSG}}$RED $TMS FAIL: $1$DFG"
 }
 
+# Call after announce to declare that the test was not run.
+# 1:reason
+skip() {
+    TOTAL=$((TOTAL-1))
+    SKIPPED+=($TEST_ID)
+    echo -e "$UP$AMSG${spaces:${#AMSG}} SKIP: $1"
+}
+
 # Print summary of test results.
 report() {
     if [ -z "$PRINT_CMD" ]; then
@@ -75,6 +84,9 @@ report() {
     if [ "$TOTAL" -ne "$PASSED" ]; then
         echo "FAILURES: ${FAILURES[@]}"
     fi
+    if [ ${#SKIPPED[@]} -ne 0 ]; then
+        echo "SKIPPED: ${SKIPPED[@]}"
+    fi
     [ "$TOTAL" -eq "$PASSED" ]
 }
 